@@ -0,0 +1,130 @@
+/**
+ * A bump allocator including the functionality to:
+ * - hand out memory by advancing an offset into the current chunk
+ * - chain on a larger chunk when the current one is full
+ * - release everything at once in constant time, keeping every chunk
+ *   for reuse so the arena settles at its high-water capacity
+ * - free all of its chunks
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN (2 * sizeof(void *)) // suits any object the shell stores
+
+/**
+ * Allocates a chunk with room for the given number of bytes.
+ *
+ * @param size The number of bytes in the chunk
+ * @return A pointer to the new chunk
+ */
+static struct ArenaChunk *
+init_chunk(size_t size)
+{
+  struct ArenaChunk *chunk = malloc(sizeof(struct ArenaChunk) + size);
+  chunk->next = NULL;
+  chunk->size = size;
+  return chunk;
+}
+
+/**
+ * Creates a new Arena with a first chunk of the given size.
+ *
+ * @param size The number of bytes in the first chunk
+ * @return A pointer to the new Arena
+ */
+struct Arena *
+init_arena(size_t size)
+{
+  struct Arena *arena = malloc(sizeof(struct Arena));
+  arena->head = init_chunk(size);
+  arena->current = arena->head;
+  arena->used = 0;
+  return arena;
+}
+
+/**
+ * Returns memory for an object of the given size, valid until the next
+ * arena_reset(). When the current chunk is full the next kept chunk is
+ * used, and only when none fits is a new one, at least twice as large,
+ * linked in after the current one.
+ *
+ * @param arena The pointer to the Arena
+ * @param size The number of bytes needed
+ * @return A pointer to the memory, aligned for any object
+ */
+void *
+arena_alloc(struct Arena *arena, size_t size)
+{
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  while (arena->current->size - arena->used < size)
+  {
+    struct ArenaChunk *next = arena->current->next;
+    if (next == NULL || next->size < size)
+    {
+      size_t grown = 2 * arena->current->size;
+      struct ArenaChunk *chunk = init_chunk(grown > size ? grown : size);
+      chunk->next = next;
+      arena->current->next = chunk;
+      next = chunk;
+    }
+    arena->current = next;
+    arena->used = 0;
+  }
+
+  void *p = arena->current->data + arena->used;
+  arena->used += size;
+  return p;
+}
+
+/**
+ * Copies the first len bytes of the given string into the arena and
+ * terminates the copy.
+ *
+ * @param arena The pointer to the Arena
+ * @param s The string to copy
+ * @param len The number of bytes to copy
+ * @return The pointer to the copy
+ */
+char *
+arena_strndup(struct Arena *arena, const char *s, size_t len)
+{
+  char *copy = arena_alloc(arena, len + 1);
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+/**
+ * Releases everything allocated from the arena at once. The chunks are
+ * kept, so later use does not allocate again until it needs more than
+ * the arena has held before.
+ *
+ * @param arena The pointer to the Arena
+ */
+void
+arena_reset(struct Arena *arena)
+{
+  arena->current = arena->head;
+  arena->used = 0;
+}
+
+/**
+ * Frees the memory of the given Arena and all of its chunks.
+ *
+ * @param arena The pointer to the Arena
+ */
+void
+cleanup_arena(struct Arena *arena)
+{
+  struct ArenaChunk *chunk = arena->head;
+  while (chunk != NULL)
+  {
+    struct ArenaChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  free(arena);
+}
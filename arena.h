@@ -0,0 +1,28 @@
+/* Header file for the bump allocator used to parse each command */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct ArenaChunk
+{
+  struct ArenaChunk *next;
+  size_t size;  // bytes available in data
+  char data[];
+};
+
+struct Arena
+{
+  struct ArenaChunk *head;    // first chunk, where a reset starts over
+  struct ArenaChunk *current; // chunk allocations are taken from
+  size_t used;                // bytes taken from the current chunk
+};
+
+struct Arena *init_arena(size_t size);
+void *arena_alloc(struct Arena *arena, size_t size);
+char *arena_strndup(struct Arena *arena, const char *s, size_t len);
+void arena_reset(struct Arena *arena);
+void cleanup_arena(struct Arena *arena);
+
+#endif
@@ -0,0 +1,39 @@
+#!/bin/sh
+# NAME: builtin_throughput.sh - measure commands/sec for an echo-heavy script
+# SYNOPSIS: bench/builtin_throughput.sh [SMALLSH] [LINES]
+# DESCRIPTION:
+# Generates a script of echo, printf, test and true commands with their
+# output redirected, as scripts that write reports and check files do,
+# and runs it with smallsh twice: once as written, so the built-in
+# utilities run in the shell, and once with each command named by its
+# full path, so every line spawns the installed program. Prints the
+# commands per second of each run.
+
+SMALLSH=${1:-./smallsh}
+LINES=${2:-20000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# Write LINES commands, prefixing each name with $1
+make_script() {
+  awk -v n="$LINES" -v p="$1" -v out="$DIR/out.txt" 'BEGIN {
+    for (i = 0; i < n; i += 4) {
+      printf "%secho line %d of the report > %s\n", p, i, out
+      printf "%sprintf \"%%s=%%d\\n\" key %d > %s\n", p, i, out
+      printf "%stest -f %s\n", p, out
+      printf "%strue\n", p
+    }
+  }'
+}
+
+run() {
+  make_script "$2" > "$DIR/script"
+  start=$(date +%s%N)
+  "$SMALLSH" "$DIR/script"
+  end=$(date +%s%N)
+  awk -v n="$LINES" -v ns=$((end - start)) -v label="$1" \
+    'BEGIN { printf "%-10s %10.0f commands/s\n", label, n / (ns / 1e9) }'
+}
+
+run "builtin" ""
+run "spawned" "/usr/bin/"
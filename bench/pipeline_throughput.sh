@@ -0,0 +1,22 @@
+#!/bin/sh
+# NAME: pipeline_throughput.sh - measure GB/s through a 3-stage pipeline
+# SYNOPSIS: bench/pipeline_throughput.sh [SMALLSH] [GIB]
+# DESCRIPTION:
+# Runs `head -c NG /dev/zero | cat | cat > /dev/null` inside smallsh with
+# the default pipe capacity and with SMALLSH_PIPESZ raised to 1 MiB,
+# printing the throughput of each run in GB/s.
+
+SMALLSH=${1:-./smallsh}
+GIB=${2:-4}
+BYTES=$((GIB * 1024 * 1024 * 1024))
+
+run() {
+  start=$(date +%s%N)
+  "$SMALLSH" -c "head -c $BYTES /dev/zero | cat | cat > /dev/null"
+  end=$(date +%s%N)
+  awk -v b="$BYTES" -v ns=$((end - start)) -v label="$1" \
+    'BEGIN { printf "%-14s %6.2f GB/s\n", label, b / ns }'
+}
+
+run "default"
+SMALLSH_PIPESZ=1048576 run "pipesz=1MiB"
@@ -0,0 +1,280 @@
+/**
+ * NAME: run_bench - time smallsh on fixed workloads and print JSON
+ * SYNOPSIS: run_bench [SMALLSH] [RUNS]
+ * DESCRIPTION:
+ * Generates one script per workload in a temporary directory: plain
+ * builtins, spawned commands, long argument lists, '$$'-heavy lines, a
+ * burst of background jobs, large redirected files, and loops run in
+ * the shell, where lines stand for iterations. Each script is
+ * run RUNS times (default 11, or $BENCH_RUNS) in script mode with its
+ * output discarded. Prints one JSON object with the median and 99th
+ * percentile wall time of every workload, and the median per line, so
+ * the output of two builds on the same machine can be compared.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+struct Workload
+{
+  const char *name;
+  int lines;                       // commands in the script
+  void (*write)(FILE *script, const char *dir, int lines);
+};
+
+/**
+ * Writes a script of the true builtin.
+ */
+static void
+write_true(FILE *script, const char *dir, int lines)
+{
+  for (int i = 0; i < lines; ++i)
+  {
+    fputs("true\n", script);
+  }
+}
+
+/**
+ * Writes a script of foreground commands that each spawn a process.
+ */
+static void
+write_spawn(FILE *script, const char *dir, int lines)
+{
+  for (int i = 0; i < lines; ++i)
+  {
+    fputs("/bin/true\n", script);
+  }
+}
+
+/**
+ * Writes a script of commands with 200 arguments each.
+ */
+static void
+write_long_args(FILE *script, const char *dir, int lines)
+{
+  for (int i = 0; i < lines; ++i)
+  {
+    fputs("true", script);
+    for (int j = 0; j < 200; ++j)
+    {
+      fprintf(script, " argument%03d", j);
+    }
+    fputc('\n', script);
+  }
+}
+
+/**
+ * Writes a script of lines full of '$$' expansions.
+ */
+static void
+write_pid_expand(FILE *script, const char *dir, int lines)
+{
+  for (int i = 0; i < lines; ++i)
+  {
+    fputs("true $$ a$$b $$$$ \"$$\" x$$ > /dev/null\n", script);
+  }
+}
+
+/**
+ * Writes a script that starts a burst of background jobs and waits for
+ * all of them.
+ */
+static void
+write_bg_burst(FILE *script, const char *dir, int lines)
+{
+  for (int i = 0; i < lines - 1; ++i)
+  {
+    fputs("/bin/true &\n", script);
+  }
+  fputs("wait\n", script);
+}
+
+/**
+ * Writes a 64 MiB data file and a script that copies it through
+ * redirections.
+ */
+static void
+write_redirect(FILE *script, const char *dir, int lines)
+{
+  char path[256];
+  snprintf(path, sizeof(path), "%s/big.dat", dir);
+  FILE *data = fopen(path, "w");
+  char block[65536];
+  memset(block, 'x', sizeof(block));
+  for (int i = 0; i < 1024; ++i)
+  {
+    fwrite(block, 1, sizeof(block), data);
+  }
+  fclose(data);
+  for (int i = 0; i < lines; ++i)
+  {
+    fprintf(script, "cat < %s/big.dat > %s/out.dat\n", dir, dir);
+  }
+}
+
+/**
+ * Writes a script of five nested for loops of ten words each, whose
+ * body runs 'lines' times (rounded to a power of ten).
+ */
+static void
+write_for_loop(FILE *script, const char *dir, int lines)
+{
+  static const char names[] = "abcde";
+  for (int i = 0; i < 5; ++i)
+  {
+    fprintf(script, "for %c in 0 1 2 3 4 5 6 7 8 9; do ", names[i]);
+  }
+  fputs("true $a$b$c$d$e > /dev/null", script);
+  for (int i = 0; i < 5; ++i)
+  {
+    fputs("; done", script);
+  }
+  fputs("\n", script);
+}
+
+/**
+ * Writes a script with a for loop over the output of seq whose body is
+ * an if testing the loop variable.
+ */
+static void
+write_if_loop(FILE *script, const char *dir, int lines)
+{
+  fprintf(script, "for i in $(seq %d)\ndo\n"
+          "  if test $i = 1; then true; else false; fi\ndone\n", lines);
+}
+
+static const struct Workload workloads[] = {
+  {"true_100k", 100000, write_true},
+  {"spawn_2k", 2000, write_spawn},
+  {"long_args_10k", 10000, write_long_args},
+  {"pid_expand_100k", 100000, write_pid_expand},
+  {"bg_burst_1k", 1001, write_bg_burst},
+  {"redirect_64m_x2", 2, write_redirect},
+  {"for_loop_100k", 100000, write_for_loop},
+  {"if_loop_100k", 100000, write_if_loop},
+};
+
+/**
+ * Returns the current monotonic time in milliseconds.
+ */
+static double
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * Runs smallsh on a script with stdin and stdout on /dev/null.
+ *
+ * @return The wall time in milliseconds, or -1 if it failed
+ */
+static double
+run_script(const char *smallsh, const char *path)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+                                   O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                   O_WRONLY, 0);
+  char *argv[] = {(char *)smallsh, (char *)path, NULL};
+
+  pid_t pid;
+  int status;
+  double start = now_ms();
+  int err = posix_spawn(&pid, smallsh, &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if (err != 0 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status))
+  {
+    return -1;
+  }
+  return now_ms() - start;
+}
+
+/**
+ * Compares two doubles for qsort().
+ */
+static int
+compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *smallsh = argc > 1 ? argv[1] : "./smallsh";
+  const char *runsEnv = getenv("BENCH_RUNS");
+  int runs = argc > 2 ? atoi(argv[2]) : runsEnv ? atoi(runsEnv) : 11;
+  if (runs < 1)
+  {
+    fprintf(stderr, "Usage: run_bench [SMALLSH] [RUNS]\n");
+    return EXIT_FAILURE;
+  }
+
+  char dir[] = "/tmp/smallsh-bench-XXXXXX";
+  if (mkdtemp(dir) == NULL)
+  {
+    perror("mkdtemp()");
+    return EXIT_FAILURE;
+  }
+  double *times = malloc(runs * sizeof(double));
+  size_t count = sizeof(workloads) / sizeof(workloads[0]);
+  int failed = 0;
+
+  printf("{\n  \"smallsh\": \"%s\",\n  \"runs\": %d,\n  \"workloads\": [\n",
+         smallsh, runs);
+  for (size_t w = 0; w < count; ++w)
+  {
+    const struct Workload *load = &workloads[w];
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s.sh", dir, load->name);
+    FILE *script = fopen(path, "w");
+    load->write(script, dir, load->lines);
+    fclose(script);
+
+    for (int r = 0; r < runs; ++r)
+    {
+      times[r] = run_script(smallsh, path);
+      if (times[r] < 0)
+      {
+        fprintf(stderr, "run_bench: %s failed\n", load->name);
+        failed = 1;
+      }
+    }
+    qsort(times, runs, sizeof(double), compare_double);
+    double median = runs % 2 ? times[runs / 2]
+                             : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+    double p99 = times[(99 * runs + 99) / 100 - 1]; // nearest rank
+    printf("    {\"name\": \"%s\", \"lines\": %d, \"median_ms\": %.3f, "
+           "\"p99_ms\": %.3f, \"median_us_per_line\": %.3f}%s\n",
+           load->name, load->lines, median, p99,
+           median * 1e3 / load->lines, w + 1 < count ? "," : "");
+    fflush(stdout);
+    unlink(path);
+  }
+  printf("  ]\n}\n");
+
+  char path[256];
+  snprintf(path, sizeof(path), "%s/big.dat", dir);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/out.dat", dir);
+  unlink(path);
+  rmdir(dir);
+  free(times);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,331 @@
+/**
+ * NAME: script_cache - compare running a script as text and compiled
+ * SYNOPSIS: script_cache [SMALLSH] [LINES] [RUNS]
+ * DESCRIPTION:
+ * Writes a script of LINES (default 20000) built-in commands with
+ * quotes, redirections, here-strings, pipelines and a tenth of lines
+ * expanding a variable, and runs smallsh on it RUNS times (default 11,
+ * or $BENCH_RUNS) in three ways: read as text, compiled from scratch
+ * into an empty SMALLSH_CACHE directory, and from the cache file left
+ * by an earlier run. For each it measures the time from starting the
+ * shell to the output of the script's first command, the time to the
+ * shell's exit, and, in separate runs with SMALLSH_TRACE set, the total
+ * time spent reading and parsing lines. Prints one JSON object with the
+ * medians and exits with a failure status if the three ways print
+ * different output, or if the script's opening lines, which chain
+ * assignments that each use the one before, print anything but HEAD.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+#define HEAD "first\n3 3 3\n" // output of the script's opening lines
+
+enum Mode
+{
+  MODE_TEXT,  // no cache
+  MODE_COLD,  // compile into an empty cache
+  MODE_WARM   // run the cache file of an earlier run
+};
+
+struct Run
+{
+  double firstMs; // start to the first byte of output
+  double totalMs; // start to exit
+  unsigned long sum; // checksum of the output
+  char head[sizeof(HEAD)]; // the start of the output
+};
+
+/**
+ * Returns a monotonic time in milliseconds.
+ */
+static double
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * Writes the script, starting with a command whose output marks the
+ * first command running, then assignments printing HEAD.
+ */
+static void
+write_script(FILE *script, int lines)
+{
+  fputs("echo first\n# a comment\nN=3\nM=$N L=$M\necho $N $M $L\n\n",
+        script);
+  for (int i = 0; i < lines; ++i)
+  {
+    switch (i % 10)
+    {
+      case 0:
+        fprintf(script, "echo line %d $N\n", i);
+        break;
+      case 1:
+        fputs("true alpha beta 'gamma delta' \"epsilon\" > /dev/null\n",
+              script);
+        break;
+      case 2:
+        fputs("true < /dev/null one two three four five six\n", script);
+        break;
+      case 3:
+        fputs("true <<<'a here-string' x y\n", script);
+        break;
+      case 4:
+        fputs("time -p true a b > /dev/null\n", script);
+        break;
+      case 5:
+        fputs("test -n word && true\n", script);
+        break;
+      case 6:
+        fputs("printf '%s\\n' a b c > /dev/null\n", script);
+        break;
+      case 7:
+        fputs("A=1 B=two C=\"three four\"\n", script);
+        break;
+      case 8:
+        fputs("true one\\ word \"two words\" 'x|y' \\> z\n", script);
+        break;
+      default:
+        fputs("false argument list with several words in it\n", script);
+    }
+  }
+}
+
+/**
+ * Runs smallsh on the script with the given cache directory and trace
+ * file, timing its first output and its exit.
+ *
+ * @param smallsh The path of smallsh
+ * @param path The path of the script
+ * @param cache The cache directory, or NULL for none
+ * @param trace The trace file, or NULL for none
+ * @param run Filled with the measurements
+ * @return -1 if the shell could not be run, 0 for success
+ */
+static int
+run_script(const char *smallsh, const char *path, const char *cache,
+           const char *trace, struct Run *run)
+{
+  int fds[2];
+  if (pipe(fds) == -1)
+  {
+    return -1;
+  }
+  if (cache != NULL)
+  {
+    setenv("SMALLSH_CACHE", cache, 1);
+  }
+  if (trace != NULL)
+  {
+    setenv("SMALLSH_TRACE", trace, 1);
+  }
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+                                   O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null",
+                                   O_WRONLY, 0);
+  posix_spawn_file_actions_addclose(&actions, fds[0]);
+  posix_spawn_file_actions_addclose(&actions, fds[1]);
+  char *argv[] = {(char *)smallsh, (char *)path, NULL};
+
+  pid_t pid;
+  double start = now_ms();
+  int err = posix_spawn(&pid, smallsh, &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  unsetenv("SMALLSH_CACHE");
+  unsetenv("SMALLSH_TRACE");
+  close(fds[1]);
+  if (err != 0)
+  {
+    close(fds[0]);
+    return -1;
+  }
+
+  char buf[65536];
+  ssize_t n;
+  size_t headLen = 0;
+  run->firstMs = -1;
+  run->sum = 0;
+  memset(run->head, 0, sizeof(run->head));
+  while ((n = read(fds[0], buf, sizeof(buf))) > 0)
+  {
+    if (run->firstMs < 0)
+    {
+      run->firstMs = now_ms() - start;
+    }
+    for (ssize_t i = 0; i < n && headLen + 1 < sizeof(run->head); ++i)
+    {
+      run->head[headLen++] = buf[i];
+    }
+    for (ssize_t i = 0; i < n; ++i)
+    {
+      run->sum = run->sum * 31 + (unsigned char)buf[i];
+    }
+  }
+  close(fds[0]);
+  int status;
+  if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status))
+  {
+    return -1;
+  }
+  run->totalMs = now_ms() - start;
+  return 0;
+}
+
+/**
+ * Adds up the durations of the read and parse spans in a trace file.
+ *
+ * @param trace The path of the trace file
+ * @return The total in milliseconds
+ */
+static double
+parse_ms(const char *trace)
+{
+  FILE *file = fopen(trace, "r");
+  if (file == NULL)
+  {
+    return -1;
+  }
+  char line[1024];
+  double us = 0;
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    const char *dur = strstr(line, "\"dur\":");
+    if (dur != NULL && (!strncmp(line, "{\"name\":\"read\"", 14) ||
+                        !strncmp(line, "{\"name\":\"parse\"", 15)))
+    {
+      us += atof(dur + 6);
+    }
+  }
+  fclose(file);
+  return us / 1e3;
+}
+
+/**
+ * Compares two doubles for qsort.
+ */
+static int
+compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Returns the median of the given values, sorting them.
+ */
+static double
+median(double *values, int count)
+{
+  qsort(values, count, sizeof(double), compare_double);
+  return count % 2 ? values[count / 2]
+                   : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *smallsh = argc > 1 ? argv[1] : "./smallsh";
+  int lines = argc > 2 ? atoi(argv[2]) : 20000;
+  const char *runsEnv = getenv("BENCH_RUNS");
+  int runs = argc > 3 ? atoi(argv[3]) : runsEnv ? atoi(runsEnv) : 11;
+  if (lines < 1 || runs < 1)
+  {
+    fprintf(stderr, "Usage: script_cache [SMALLSH] [LINES] [RUNS]\n");
+    return EXIT_FAILURE;
+  }
+
+  char dir[] = "/tmp/smallsh-cache-bench-XXXXXX";
+  if (mkdtemp(dir) == NULL)
+  {
+    perror("mkdtemp()");
+    return EXIT_FAILURE;
+  }
+  char path[256], cache[256], trace[256];
+  snprintf(path, sizeof(path), "%s/script.sh", dir);
+  snprintf(cache, sizeof(cache), "%s/cache", dir);
+  snprintf(trace, sizeof(trace), "%s/trace.json", dir);
+  FILE *script = fopen(path, "w");
+  write_script(script, lines);
+  fclose(script);
+
+  static const char *const names[] = {"text", "cold", "warm"};
+  double *first = malloc(runs * sizeof(double));
+  double *total = malloc(runs * sizeof(double));
+  double *parse = malloc(runs * sizeof(double));
+  unsigned long sums[3] = {0};
+  int headOk = 1;
+  int failed = 0;
+  char command[600];
+
+  printf("{\n  \"smallsh\": \"%s\",\n  \"lines\": %d,\n  \"runs\": %d,\n"
+         "  \"modes\": [\n", smallsh, lines, runs);
+  for (int mode = MODE_TEXT; mode <= MODE_WARM; ++mode)
+  {
+    for (int r = 0; r < 2 * runs; ++r)
+    {
+      if (mode == MODE_COLD || (mode == MODE_WARM && r == 0))
+      { // start from an empty cache
+        snprintf(command, sizeof(command), "rm -rf '%s'", cache);
+        system(command);
+        if (mode == MODE_WARM)
+        {
+          struct Run run;
+          run_script(smallsh, path, cache, NULL, &run);
+        }
+      }
+      struct Run run;
+      int traced = r >= runs;
+      if (run_script(smallsh, path, mode == MODE_TEXT ? NULL : cache,
+                     traced ? trace : NULL, &run) == -1)
+      {
+        fprintf(stderr, "script_cache: %s run failed\n", names[mode]);
+        failed = 1;
+        continue;
+      }
+      if (traced)
+      {
+        parse[r - runs] = parse_ms(trace);
+        unlink(trace);
+      }
+      else
+      {
+        first[r] = run.firstMs;
+        total[r] = run.totalMs;
+        sums[mode] = run.sum;
+      }
+      headOk &= !strcmp(run.head, HEAD);
+    }
+    printf("    {\"mode\": \"%s\", \"first_exec_ms\": %.3f, "
+           "\"total_ms\": %.3f, \"read_parse_ms\": %.3f}%s\n",
+           names[mode], median(first, runs), median(total, runs),
+           median(parse, runs), mode < MODE_WARM ? "," : "");
+    fflush(stdout);
+  }
+  int same = sums[MODE_COLD] == sums[MODE_TEXT] &&
+             sums[MODE_WARM] == sums[MODE_TEXT];
+  printf("  ],\n  \"same_output\": %s,\n  \"expected_head\": %s\n}\n",
+         same ? "true" : "false", headOk ? "true" : "false");
+
+  snprintf(command, sizeof(command), "rm -rf '%s'", dir);
+  system(command);
+  free(first);
+  free(total);
+  free(parse);
+  return failed || !same || !headOk ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,108 @@
+/**
+ * NAME: spawn_latency - compare fork+exec with posix_spawn as RSS grows
+ * SYNOPSIS: spawn_latency [ITERATIONS]
+ * DESCRIPTION:
+ * Touches an increasing amount of heap memory to grow the resident set,
+ * the way a long-running shell accumulates state, then times spawning
+ * and waiting for /bin/true with fork()+execv() and with posix_spawn().
+ * Prints the mean latency per spawn in microseconds for each RSS step.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static char *true_argv[] = {"/bin/true", NULL};
+
+/**
+ * Returns the current monotonic time in microseconds.
+ */
+static double
+now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ * Spawns /bin/true with fork() and execv() and waits for it.
+ */
+static void
+spawn_fork(void)
+{
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    execv(true_argv[0], true_argv);
+    _exit(127);
+  }
+  waitpid(pid, NULL, 0);
+}
+
+/**
+ * Spawns /bin/true with posix_spawn() and waits for it.
+ */
+static void
+spawn_posix(void)
+{
+  pid_t pid;
+  if (posix_spawn(&pid, true_argv[0], NULL, NULL, true_argv, environ) == 0)
+  {
+    waitpid(pid, NULL, 0);
+  }
+}
+
+/**
+ * Returns the mean time in microseconds taken by the given spawn method.
+ */
+static double
+time_spawns(void (*spawn)(void), int iterations)
+{
+  double start = now_us();
+  for (int i = 0; i < iterations; ++i)
+  {
+    spawn();
+  }
+  return (now_us() - start) / iterations;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int iterations = argc > 1 ? atoi(argv[1]) : 500;
+  size_t steps_mb[] = {0, 64, 256, 1024};
+  size_t total_mb = 0;
+
+  printf("%8s %14s %14s\n", "rss_mb", "fork_exec_us", "posix_spawn_us");
+  for (size_t i = 0; i < sizeof steps_mb / sizeof steps_mb[0]; ++i)
+  {
+    // Grow the resident set up to the next step and keep it touched
+    size_t grow = (steps_mb[i] - total_mb) << 20;
+    if (grow > 0)
+    {
+      char *ballast = malloc(grow);
+      if (ballast == NULL)
+      {
+        perror("malloc()");
+        break;
+      }
+      memset(ballast, 1, grow);
+      total_mb = steps_mb[i];
+    }
+
+    double fork_us = time_spawns(spawn_fork, iterations);
+    double spawn_us = time_spawns(spawn_posix, iterations);
+    printf("%8zu %14.1f %14.1f\n", total_mb, fork_us, spawn_us);
+    fflush(stdout);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,337 @@
+/**
+ * NAME: stress_jobs - check that smallsh scales to thousands of jobs
+ * SYNOPSIS: stress_jobs [SMALLSH] [JOBS]
+ * DESCRIPTION:
+ * Runs smallsh on scripts that launch bursts of short-lived background
+ * jobs and wait for them, at a tenth of JOBS (default 10000) and at
+ * JOBS, and checks that the time and memory per job stay bounded as the
+ * burst grows. Then it has one shell start JOBS long-lived background
+ * jobs and checks that all of them are running at once, times the
+ * shell reaping them once they are killed, starts JOBS of them again
+ * along with PIPELINES pipelines whose first command fails to start,
+ * ends the shell's input and checks that the shell exits within
+ * EXIT_LIMIT_MS, leaving neither running children nor zombies behind;
+ * as a child subreaper it inherits whatever the shell leaves. Prints
+ * one JSON object with the measurements and exits with a failure status
+ * if any check fails.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TIME_GROWTH_LIMIT 3.0 // per-job time at JOBS vs at JOBS / 10
+#define RSS_PER_JOB_LIMIT 1.0 // KiB of peak RSS added per extra job
+#define EXIT_LIMIT_MS 5000.0  // time for the shell to exit with live jobs
+#define PIPELINES 100         // pipelines among the jobs left at exit
+
+extern char **environ;
+
+struct Run
+{
+  double ms;  // wall time
+  long rssKb; // peak RSS of the shell
+};
+
+struct Live // measurements of the shell holding many live jobs
+{
+  int started;    // jobs the shell reported starting
+  int alive;      // of those, running together once all had started
+  double addUs;   // per job, to start them
+  double reapUs;  // per job, to reap them once killed
+  int pipelines;  // pipelines the shell reported starting before exit
+  double exitMs;  // to exit with as many jobs running again, or -1
+  long rssKb;     // peak RSS of the shell
+  int orphans;    // processes left behind
+};
+
+/**
+ * Returns the current monotonic time in milliseconds.
+ */
+static double
+now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * Runs smallsh on a script that starts the given number of /bin/true
+ * jobs in the background and then waits for them.
+ *
+ * @return The wall time and peak RSS of the run, ms -1 if it failed
+ */
+static struct Run
+run_burst(const char *smallsh, const char *dir, int jobs)
+{
+  struct Run run = {-1, 0};
+  char path[256];
+  snprintf(path, sizeof(path), "%s/burst.sh", dir);
+  FILE *script = fopen(path, "w");
+  for (int i = 0; i < jobs; ++i)
+  {
+    fputs("/bin/true &\n", script);
+  }
+  fputs("wait\n", script);
+  fclose(script);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                   O_WRONLY, 0);
+  char *argv[] = {(char *)smallsh, path, NULL};
+  pid_t pid;
+  int status;
+  struct rusage usage;
+  double start = now_ms();
+  if (posix_spawn(&pid, smallsh, &actions, NULL, argv, environ) == 0 &&
+      wait4(pid, &status, 0, &usage) == pid && WIFEXITED(status))
+  {
+    run.ms = now_ms() - start;
+    run.rssKb = usage.ru_maxrss;
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  unlink(path);
+  return run;
+}
+
+/**
+ * Collects the processes the shell left behind, which were reparented
+ * to this process: zombies are reaped and running ones killed first.
+ *
+ * @return The number of processes left behind
+ */
+static int
+collect_orphans(void)
+{
+  int orphans = 0;
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/task/%d/children", getpid());
+  for (;;)
+  {
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+    {
+      ++orphans; // a zombie, or one killed below
+    }
+    FILE *children = fopen(path, "r");
+    int pid, found = 0;
+    while (children != NULL && fscanf(children, "%d", &pid) == 1)
+    {
+      kill(pid, SIGKILL);
+      found = 1;
+    }
+    if (children != NULL)
+    {
+      fclose(children);
+    }
+    if (!found)
+    {
+      return orphans;
+    }
+    usleep(10000);
+  }
+}
+
+/**
+ * Sends lines to the shell from a forked writer, so the shell never
+ * blocks on a full output pipe while this process blocks writing, and
+ * reads the shell's output until a line containing the marker, noting
+ * the PIDs of the background jobs it reports.
+ *
+ * @param in The write end of the shell's stdin
+ * @param output The shell's stdout
+ * @param line The line to send
+ * @param times The number of times to send it, before "echo MARKER"
+ * @param marker The text marking the end of the lines' output
+ * @param pids Filled with the PIDs reported, or NULL
+ * @return The number of PIDs reported
+ */
+static int
+feed_shell(int in, FILE *output, const char *line, int times,
+           const char *marker, pid_t *pids)
+{
+  pid_t writer = fork();
+  if (writer == 0)
+  {
+    FILE *script = fdopen(in, "w");
+    for (int i = 0; i < times; ++i)
+    {
+      fputs(line, script);
+    }
+    fprintf(script, "echo %s\n", marker);
+    fflush(script);
+    _exit(0);
+  }
+
+  int count = 0;
+  char text[256];
+  while (fgets(text, sizeof(text), output) != NULL &&
+         strstr(text, marker) == NULL)
+  {
+    const char *bg = strstr(text, "background PID is ");
+    if (bg != NULL && pids != NULL)
+    {
+      pids[count] = atoi(bg + 18);
+    }
+    count += bg != NULL;
+  }
+  waitpid(writer, NULL, 0);
+  return count;
+}
+
+/**
+ * Has one interactive smallsh start the given number of long-lived
+ * background jobs and checks they all run at once, kills them and
+ * times the shell reaping them, starts as many again along with the
+ * pipelines, then ends its input and times how long it takes to exit,
+ * killing it if it takes more than twice EXIT_LIMIT_MS.
+ *
+ * @param jobs The number of jobs to hold at once
+ * @param live Filled with the measurements
+ */
+static void
+run_live(const char *smallsh, int jobs, struct Live *live)
+{
+  memset(live, 0, sizeof(struct Live));
+  live->exitMs = -1;
+  int in[2], out[2];
+  if (pipe2(in, O_CLOEXEC) == -1 || pipe2(out, O_CLOEXEC) == -1)
+  {
+    return;
+  }
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null",
+                                   O_WRONLY, 0); // the pipelines' errors
+  char *argv[] = {(char *)smallsh, NULL};
+  pid_t pid;
+  int err = posix_spawn(&pid, smallsh, &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(in[0]);
+  close(out[1]);
+  if (err != 0)
+  {
+    return;
+  }
+  FILE *output = fdopen(out[0], "r");
+  pid_t *pids = malloc(jobs * sizeof(pid_t));
+
+  // Start the jobs and check that every one of them is running
+  double start = now_ms();
+  live->started = feed_shell(in[1], output, "sleep 600 &\n", jobs,
+                             "jobs-started", pids);
+  live->addUs = (now_ms() - start) * 1e3 / jobs;
+  for (int i = 0; i < live->started; ++i)
+  {
+    live->alive += kill(pids[i], 0) == 0;
+  }
+
+  // Kill them all and time the shell reaping them
+  for (int i = 0; i < live->started; ++i)
+  {
+    kill(pids[i], SIGKILL);
+  }
+  start = now_ms();
+  feed_shell(in[1], output, "wait\n", 1, "jobs-reaped", NULL);
+  live->reapUs = (now_ms() - start) * 1e3 / jobs;
+
+  // Fill the table again and time the exit with every job running
+  feed_shell(in[1], output, "sleep 600 &\n", jobs, "jobs-restarted", NULL);
+  live->pipelines = feed_shell(in[1], output,
+                               "nosuchcmd_stress | sleep 600 | sleep 600 &\n",
+                               PIPELINES, "pipelines-started", NULL);
+  start = now_ms();
+  close(in[1]);
+  int status;
+  struct rusage usage;
+  pid_t done;
+  while ((done = wait4(pid, &status, WNOHANG, &usage)) == 0 &&
+         now_ms() - start < 2 * EXIT_LIMIT_MS)
+  {
+    usleep(1000);
+  }
+  if (done == pid)
+  {
+    live->exitMs = now_ms() - start;
+    live->rssKb = usage.ru_maxrss;
+  }
+  else
+  {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+  }
+  fclose(output);
+  free(pids);
+  live->orphans = collect_orphans();
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *smallsh = argc > 1 ? argv[1] : "./smallsh";
+  int jobs = argc > 2 ? atoi(argv[2]) : 10000;
+  if (jobs < 10)
+  {
+    fprintf(stderr, "Usage: stress_jobs [SMALLSH] [JOBS]\n");
+    return EXIT_FAILURE;
+  }
+  prctl(PR_SET_CHILD_SUBREAPER, 1);
+  setenv("SMALLSH_HISTFILE", "", 1); // keep the commands out of history
+
+  char dir[] = "/tmp/smallsh-stress-XXXXXX";
+  if (mkdtemp(dir) == NULL)
+  {
+    perror("mkdtemp()");
+    return EXIT_FAILURE;
+  }
+  struct Run small = run_burst(smallsh, dir, jobs / 10);
+  struct Run large = run_burst(smallsh, dir, jobs);
+  rmdir(dir);
+  struct Live live;
+  run_live(smallsh, jobs, &live);
+
+  double smallPerJob = small.ms * 1e3 / (jobs / 10);
+  double largePerJob = large.ms * 1e3 / jobs;
+  double rssPerJob = (double)(large.rssKb - small.rssKb) /
+                     (jobs - jobs / 10);
+  int timeOk = small.ms > 0 && large.ms > 0 &&
+               largePerJob <= TIME_GROWTH_LIMIT * smallPerJob;
+  int rssOk = small.ms > 0 && large.ms > 0 && rssPerJob <= RSS_PER_JOB_LIMIT;
+  int liveOk = live.started == jobs && live.alive == jobs;
+  int exitOk = live.pipelines == PIPELINES && live.exitMs >= 0 &&
+               live.exitMs <= EXIT_LIMIT_MS && live.orphans == 0;
+
+  printf("{\n");
+  printf("  \"burst_small\": {\"jobs\": %d, \"ms\": %.1f, \"us_per_job\": %.1f,"
+         " \"max_rss_kb\": %ld},\n", jobs / 10, small.ms, smallPerJob,
+         small.rssKb);
+  printf("  \"burst_large\": {\"jobs\": %d, \"ms\": %.1f, \"us_per_job\": %.1f,"
+         " \"max_rss_kb\": %ld},\n", jobs, large.ms, largePerJob, large.rssKb);
+  printf("  \"rss_kb_per_extra_job\": %.3f,\n", rssPerJob);
+  printf("  \"live\": {\"jobs\": %d, \"started\": %d, \"running\": %d,"
+         " \"add_us_per_job\": %.1f, \"reap_us_per_job\": %.1f,"
+         " \"max_rss_kb\": %ld},\n", jobs, live.started, live.alive,
+         live.addUs, live.reapUs, live.rssKb);
+  printf("  \"exit\": {\"live_jobs\": %d, \"pipelines\": %d, \"ms\": %.1f,"
+         " \"left_behind\": %d},\n", jobs, live.pipelines, live.exitMs,
+         live.orphans);
+  printf("  \"checks\": {\"time_per_job\": %s, \"rss_per_job\": %s,"
+         " \"live\": %s, \"exit\": %s}\n", timeOk ? "true" : "false",
+         rssOk ? "true" : "false", liveOk ? "true" : "false",
+         exitOk ? "true" : "false");
+  printf("}\n");
+  return timeOk && rssOk && liveOk && exitOk ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,102 @@
+/**
+ * NAME: tokenize - compare the shell's lexer with strtok_r
+ * SYNOPSIS: tokenize [ITERATIONS]
+ * DESCRIPTION:
+ * Builds command lines with argument lists of growing length, such as a
+ * glob expanded to many paths, and splits each one over and over, first
+ * with strtok_r() on a copy of the line as the shell used to and then
+ * with the quote-aware lexer. Prints the throughput of each in millions
+ * of tokens per second.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lexer.h"
+
+/**
+ * Returns the current monotonic time in seconds.
+ */
+static double
+now_s(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Builds a command line of the given number of path arguments.
+ *
+ * @param numArgs The number of arguments after the command name
+ * @param len Set to the length of the line
+ * @return The allocated line
+ */
+static char *
+make_line(int numArgs, size_t *len)
+{
+  char *line = malloc(64 + numArgs * 48);
+  size_t n = sprintf(line, "ls -l");
+  for (int i = 0; i < numArgs; ++i)
+  {
+    n += sprintf(line + n, " /usr/share/doc/package-%d/changelog.gz", i);
+  }
+  n += sprintf(line + n, " > listing.txt");
+  *len = n;
+  return line;
+}
+
+int
+main(int argc, char *argv[])
+{
+  long iterations = argc > 1 ? atol(argv[1]) : 20000;
+  int sizes[] = {8, 64, 512, 4096};
+
+  printf("%8s %14s %14s\n", "args", "strtok_r Mtok/s", "lexer Mtok/s");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+  {
+    size_t len;
+    char *line = make_line(sizes[s], &len);
+    char *copy = malloc(len + 1);
+    char *out = malloc(2 * len + 1);
+    long reps = iterations * 8 / sizes[s] + 1;
+    long tokens = 0;
+
+    double start = now_s();
+    for (long r = 0; r < reps; ++r)
+    {
+      memcpy(copy, line, len + 1);
+      char *saveptr;
+      for (char *t = strtok_r(copy, " ", &saveptr); t != NULL;
+           t = strtok_r(NULL, " ", &saveptr))
+      {
+        ++tokens;
+      }
+    }
+    double strtokRate = tokens / (now_s() - start) / 1e6;
+
+    tokens = 0;
+    start = now_s();
+    for (long r = 0; r < reps; ++r)
+    {
+      struct Lexer lexer;
+      struct Token token;
+      init_lexer(&lexer, line, len, out);
+      while (next_token(&lexer, &token) != TOKEN_END)
+      {
+        ++tokens;
+      }
+    }
+    double lexerRate = tokens / (now_s() - start) / 1e6;
+
+    printf("%8d %14.1f %14.1f\n", sizes[s], strtokRate, lexerRate);
+    free(line);
+    free(copy);
+    free(out);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,491 @@
+/**
+ * Definitions for the command hash, which remembers where each command
+ * was found on PATH so the directories are only searched on first use.
+ *
+ * The table uses open addressing with linear probing and is keyed by
+ * command name. It is emptied whenever PATH differs from the value it
+ * was filled under, and single entries are dropped when the remembered
+ * file turns out to be gone.
+ *
+ * Command completion needs every executable on PATH, so it builds an
+ * index of each PATH directory: the sorted names of its executables,
+ * read again only when the directory's mtime has changed. Once built,
+ * the index also serves the PATH searches of lookups, which then cost
+ * a stat of each directory rather than of each candidate file.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "command_hash.h"
+#include "utilities.h"
+
+#define DEFAULT_PATH "/bin:/usr/bin" // used by execvp when PATH is unset
+
+struct HashEntry
+{
+  char *name;         // NULL for an empty slot
+  char *path;
+  unsigned long hash;
+  unsigned long hits;
+};
+
+static struct HashEntry *table = NULL;
+static size_t capacity = 0; // always a power of two
+static size_t count = 0;
+static char *hashedPath = NULL; // the PATH the table was filled under
+
+struct DirIndex
+{
+  char *dir;             // "." for an empty PATH entry
+  struct timespec mtime; // of the directory when it was read
+  int loaded;            // Boolean for names being read
+  char **names;          // executables in the directory, sorted
+  size_t count;
+};
+
+static struct DirIndex *dirs = NULL; // one per PATH entry, in order
+static size_t numDirs = 0;
+static char *indexedPath = NULL; // the PATH the index was built for
+
+/**
+ * Computes the FNV-1a hash of the given string.
+ *
+ * @param s The string to hash
+ * @return The hash value
+ */
+static unsigned long
+hash_string(const char *s)
+{
+  unsigned long h = 2166136261UL;
+  for (; *s != '\0'; ++s)
+  {
+    h = (h ^ (unsigned char)*s) * 16777619UL;
+  }
+  return h;
+}
+
+/**
+ * Finds the slot holding the given name, or the empty slot where it
+ * would be inserted.
+ *
+ * @param name The command name
+ * @param hash The hash of the name
+ * @return The index of the slot
+ */
+static size_t
+find_slot(const char *name, unsigned long hash)
+{
+  size_t i = hash & (capacity - 1);
+  while (table[i].name != NULL &&
+         (table[i].hash != hash || strcmp(table[i].name, name)))
+  {
+    i = (i + 1) & (capacity - 1);
+  }
+  return i;
+}
+
+/**
+ * Doubles the capacity of the table and reinserts every entry.
+ */
+static void
+grow_table(void)
+{
+  struct HashEntry *old = table;
+  size_t oldCapacity = capacity;
+  capacity = capacity ? capacity * 2 : 64;
+  table = calloc(capacity, sizeof(struct HashEntry));
+  for (size_t i = 0; i < oldCapacity; ++i)
+  {
+    if (old[i].name != NULL)
+    {
+      table[find_slot(old[i].name, old[i].hash)] = old[i];
+    }
+  }
+  free(old);
+}
+
+/**
+ * Compares two names for qsort() and bsearch().
+ */
+static int
+compare_names(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Frees the names read from a directory.
+ *
+ * @param index The pointer to the DirIndex
+ */
+static void
+unload_dir(struct DirIndex *index)
+{
+  for (size_t i = 0; i < index->count; ++i)
+  {
+    free(index->names[i]);
+  }
+  free(index->names);
+  index->names = NULL;
+  index->count = 0;
+  index->loaded = 0;
+}
+
+/**
+ * Makes sure the names of a directory's executables are current,
+ * reading the directory again only if its mtime has changed.
+ *
+ * @param index The pointer to the DirIndex
+ */
+static void
+refresh_dir(struct DirIndex *index)
+{
+  struct stat sb;
+  if (stat(index->dir, &sb) == -1)
+  {
+    unload_dir(index); // a missing directory has no commands
+    return;
+  }
+  if (index->loaded && sb.st_mtim.tv_sec == index->mtime.tv_sec &&
+      sb.st_mtim.tv_nsec == index->mtime.tv_nsec)
+  {
+    return;
+  }
+  unload_dir(index);
+  index->mtime = sb.st_mtim;
+  index->loaded = 1;
+  DIR *dir = opendir(index->dir);
+  if (dir == NULL)
+  {
+    return;
+  }
+  size_t capacity = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (entry->d_name[0] == '.' &&
+        (entry->d_name[1] == '\0' || !strcmp(entry->d_name, "..")))
+    {
+      continue;
+    }
+    if (fstatat(dirfd(dir), entry->d_name, &sb, 0) == -1 ||
+        !S_ISREG(sb.st_mode) ||
+        faccessat(dirfd(dir), entry->d_name, X_OK, 0) == -1)
+    {
+      continue;
+    }
+    if (index->count == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 64;
+      index->names = realloc(index->names, capacity * sizeof(char *));
+    }
+    index->names[index->count++] = strdup(entry->d_name);
+  }
+  closedir(dir);
+  if (index->count > 0)
+  { // names is NULL for a directory without executables
+    qsort(index->names, index->count, sizeof(char *), compare_names);
+  }
+}
+
+/**
+ * Sets up an index entry for each directory of the given PATH, freeing
+ * the index of the previous PATH. Directories are read on first use.
+ *
+ * @param path The value of PATH
+ */
+static void
+index_path(const char *path)
+{
+  for (size_t i = 0; i < numDirs; ++i)
+  {
+    unload_dir(&dirs[i]);
+    free(dirs[i].dir);
+  }
+  free(dirs);
+  free(indexedPath);
+  indexedPath = strdup(path);
+  numDirs = 1;
+  for (const char *p = path; *p != '\0'; ++p)
+  {
+    numDirs += *p == ':';
+  }
+  dirs = calloc(numDirs, sizeof(struct DirIndex));
+  for (size_t i = 0; i < numDirs; ++i)
+  {
+    const char *colon = strchr(path, ':');
+    size_t dirLen = colon ? (size_t)(colon - path) : strlen(path);
+    dirs[i].dir = dirLen ? strndup(path, dirLen) : strdup(".");
+    path = colon ? colon + 1 : path + dirLen;
+  }
+}
+
+/**
+ * Searches the index of the PATH directories for an executable.
+ *
+ * @param name The command name
+ * @return The allocated full path of the command, or NULL if not found
+ */
+static char *
+search_index(const char *name)
+{
+  for (size_t i = 0; i < numDirs; ++i)
+  {
+    refresh_dir(&dirs[i]);
+    if (dirs[i].count > 0 &&
+        bsearch(&name, dirs[i].names, dirs[i].count, sizeof(char *),
+                compare_names) != NULL)
+    {
+      char *found = malloc(strlen(dirs[i].dir) + strlen(name) + 2);
+      sprintf(found, "%s/%s", dirs[i].dir, name);
+      return found;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Calls the given function for every executable on PATH whose name
+ * starts with the given prefix. A name found in several directories is
+ * passed once for each.
+ *
+ * @param prefix The start of the names
+ * @param found The function to call with each name and the data
+ * @param data Passed on to found
+ */
+void
+hash_complete(const char *prefix, void (*found)(const char *name, void *data),
+              void *data)
+{
+  const char *path = getenv("PATH");
+  if (path == NULL)
+  {
+    path = DEFAULT_PATH;
+  }
+  if (indexedPath == NULL || strcmp(indexedPath, path))
+  {
+    index_path(path);
+  }
+  size_t prefixLen = strlen(prefix);
+  for (size_t i = 0; i < numDirs; ++i)
+  {
+    struct DirIndex *index = &dirs[i];
+    refresh_dir(index);
+
+    // Find the first name not below the prefix, then take the run of
+    // names that start with it
+    size_t lo = 0, hi = index->count;
+    while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (strcmp(index->names[mid], prefix) < 0)
+      {
+        lo = mid + 1;
+      }
+      else
+      {
+        hi = mid;
+      }
+    }
+    for (; lo < index->count && !strncmp(index->names[lo], prefix, prefixLen);
+         ++lo)
+    {
+      found(index->names[lo], data);
+    }
+  }
+}
+
+/**
+ * Searches the directories of the given PATH for an executable regular
+ * file with the given name. Empty PATH entries mean the current
+ * directory. Once Tab completion has indexed the PATH the index is
+ * tried first, but a miss is checked with stat(), since making a file
+ * executable leaves its directory's mtime alone.
+ *
+ * @param name The command name
+ * @param path The value of PATH
+ * @return The allocated full path of the command, or NULL if not found
+ */
+static char *
+search_path(const char *name, const char *path)
+{
+  if (indexedPath != NULL && !strcmp(indexedPath, path))
+  {
+    char *found = search_index(name);
+    if (found != NULL)
+    {
+      return found;
+    }
+  }
+  size_t nameLen = strlen(name);
+  char *candidate = malloc(strlen(path) + nameLen + 3);
+  while (1)
+  {
+    const char *colon = strchr(path, ':');
+    size_t dirLen = colon ? (size_t)(colon - path) : strlen(path);
+    if (dirLen == 0)
+    {
+      memcpy(candidate, ".", 1);
+      dirLen = 1;
+    }
+    else
+    {
+      memcpy(candidate, path, dirLen);
+    }
+    candidate[dirLen] = '/';
+    memcpy(candidate + dirLen + 1, name, nameLen + 1);
+
+    struct stat sb;
+    if (!stat(candidate, &sb) && S_ISREG(sb.st_mode) &&
+        !access(candidate, X_OK))
+    {
+      return candidate;
+    }
+    if (colon == NULL)
+    {
+      break;
+    }
+    path = colon + 1;
+  }
+  free(candidate);
+  return NULL;
+}
+
+/**
+ * Returns the full path of the given command, searching PATH only when
+ * the command is not remembered yet. Names containing a '/' are returned
+ * unchanged.
+ *
+ * @param name The command name
+ * @return The path to execute, or NULL if the command was not found
+ */
+const char *
+hash_lookup(const char *name)
+{
+  if (strchr(name, '/') != NULL)
+  {
+    return name;
+  }
+
+  const char *path = getenv("PATH");
+  if (path == NULL)
+  {
+    path = DEFAULT_PATH;
+  }
+  if (hashedPath == NULL || strcmp(hashedPath, path))
+  { // PATH changed, so every remembered location may be stale
+    hash_reset();
+    hashedPath = strdup(path);
+  }
+
+  if (count + 1 > capacity / 2)
+  {
+    grow_table();
+  }
+  unsigned long hash = hash_string(name);
+  size_t i = find_slot(name, hash);
+  if (table[i].name == NULL)
+  {
+    char *found = search_path(name, path);
+    if (found == NULL)
+    {
+      return NULL;
+    }
+    table[i].name = strdup(name);
+    table[i].path = found;
+    table[i].hash = hash;
+    table[i].hits = 0;
+    ++count;
+  }
+  ++table[i].hits;
+  return table[i].path;
+}
+
+/**
+ * Drops the remembered location of the given command, e.g. after
+ * executing it failed because the file no longer exists.
+ *
+ * @param name The command name
+ */
+void
+hash_forget(const char *name)
+{
+  if (count == 0)
+  {
+    return;
+  }
+  size_t i = find_slot(name, hash_string(name));
+  if (table[i].name == NULL)
+  {
+    return;
+  }
+  free(table[i].name);
+  free(table[i].path);
+  table[i].name = NULL;
+  --count;
+
+  // Shift later entries of the probe run back into the hole
+  size_t mask = capacity - 1;
+  for (size_t j = (i + 1) & mask; table[j].name != NULL; j = (j + 1) & mask)
+  {
+    size_t home = table[j].hash & mask;
+    if (((j - home) & mask) >= ((j - i) & mask))
+    {
+      table[i] = table[j];
+      table[j].name = NULL;
+      i = j;
+    }
+  }
+}
+
+/**
+ * Forgets every remembered command location.
+ */
+void
+hash_reset(void)
+{
+  for (size_t i = 0; i < capacity; ++i)
+  {
+    if (table[i].name != NULL)
+    {
+      free(table[i].name);
+      free(table[i].path);
+      table[i].name = NULL;
+    }
+  }
+  count = 0;
+  free(hashedPath);
+  hashedPath = NULL;
+}
+
+/**
+ * Prints the remembered commands with the number of times each was
+ * looked up.
+ */
+void
+hash_print(void)
+{
+  if (count == 0)
+  {
+    printf("hash: hash table empty\n");
+    fflush(stdout);
+    return;
+  }
+  printf("hits\tcommand\n");
+  for (size_t i = 0; i < capacity; ++i)
+  {
+    if (table[i].name != NULL)
+    {
+      printf("%4lu\t%s\n", table[i].hits, table[i].path);
+    }
+  }
+  fflush(stdout);
+}
@@ -0,0 +1,11 @@
+#ifndef COMMAND_HASH_H
+#define COMMAND_HASH_H
+
+const char * hash_lookup(const char *name);
+void hash_forget(const char *name);
+void hash_reset(void);
+void hash_print(void);
+void hash_complete(const char *prefix,
+                   void (*found)(const char *name, void *data), void *data);
+
+#endif
@@ -0,0 +1,837 @@
+/**
+ * Definitions for the parser of command lists and control flow.
+ *
+ * A statement is what the shell reads before running anything: one
+ * line of commands separated by ';' or '&', or, when the line opens an if,
+ * for, while or until, every line up to the matching fi or done. It is
+ * parsed into a tree of Nodes that the caller evaluates, so the body of
+ * a loop is parsed once however many times it runs.
+ *
+ * Each pipeline keeps its tokens, and a pipeline whose words expand
+ * nothing is also parsed into its Input structs straight away and
+ * reused every time it runs. Others are parsed by get_input() each time
+ * they run, so variables and command substitutions are expanded then.
+ * Reserved words are only recognized unquoted and where a command would
+ * start.
+ *
+ * A function definition, name() { list; }, is a NODE_FUNCTION whose
+ * body is copied into the function table when it runs. An alias is
+ * expanded while parsing, by splicing the tokens of its text over the
+ * word that starts a command, so a loop or function body holds the
+ * expansion from then on.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "control_flow.h"
+#include "functions.h"
+#include "input_parsing.h"
+#include "lexer.h"
+#include "line_reader.h"
+#include "trace.h"
+#include "variables.h"
+
+#define MAX_ALIASES 16 // aliases expanded at the start of one command
+
+struct Parser // state of parsing one statement
+{
+  struct LineReader *reader;
+  const char *prompt;    // prompt for the next line, or NULL for none
+  struct Arena *arena;   // holds the tree
+  struct Token *tokens;  // tokens of the current line
+  int pos;               // index of the next token
+  int depth;             // compound commands still open
+  struct Node **pending; // commands of the line with here-documents
+  int numPending;
+  int failed;            // Boolean for a syntax error
+  int commands;          // pipelines parsed
+};
+
+static struct Node * parse_list(struct Parser *p);
+
+/**
+ * Allocates a Node with no parts.
+ *
+ * @param type The type of the node
+ * @param arena The pointer to the Arena for the node
+ * @return The pointer to the new Node
+ */
+struct Node *
+init_node(enum NodeType type, struct Arena *arena)
+{
+  struct Node *node = arena_alloc(arena, sizeof(struct Node));
+  memset(node, 0, sizeof(struct Node));
+  node->type = type;
+  return node;
+}
+
+/**
+ * Checks whether a pipeline has to be parsed each time it runs: when a
+ * word is expanded, when it starts with "run", whose options are
+ * checked then, or when it reads a here-document.
+ *
+ * @param tokens The tokens of the pipeline
+ * @return Boolean for parsing the pipeline when it runs
+ */
+static int
+parse_late(const struct Token *tokens)
+{
+  for (int i = 0; tokens[i].type != TOKEN_END; ++i)
+  {
+    if (tokens[i].type == TOKEN_ERROR || tokens[i].type == TOKEN_DLESS ||
+        (tokens[i].flags & TOKEN_EXPAND) ||
+        (i < 3 && tokens[i].flags == 0 && tokens[i].text != NULL &&
+         !strcmp(tokens[i].text, "run")))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Makes a NODE_COMMAND for a pipeline, parsing it now unless it has to
+ * be parsed each time it runs. A pipeline with a syntax error is left
+ * for get_input() to report when it runs.
+ *
+ * @param tokens The tokens of the pipeline, ending with a TOKEN_END
+ * @param arena The pointer to the Arena for the node
+ * @return The pointer to the new Node
+ */
+struct Node *
+command_node(struct Token *tokens, struct Arena *arena)
+{
+  struct Node *node = init_node(NODE_COMMAND, arena);
+  node->tokens = tokens;
+  if (!parse_late(tokens))
+  {
+    node->input = check_input(tokens, arena);
+  }
+  return node;
+}
+
+/**
+ * Reports a syntax error, only the first one of a statement.
+ *
+ * @param p The pointer to the Parser
+ * @param token The offending token, or NULL for the end of input
+ */
+static void
+parse_error(struct Parser *p, const struct Token *token)
+{
+  if (!p->failed)
+  {
+    syntax_error(token, p->arena);
+    p->failed = 1;
+  }
+}
+
+/**
+ * Checks whether a token is the given reserved word: an unquoted word.
+ *
+ * @param token The token to check
+ * @param word The reserved word
+ * @return Boolean for a match
+ */
+static int
+is_reserved(const struct Token *token, const char *word)
+{
+  return token->type == TOKEN_WORD && token->flags == 0 &&
+         !strcmp(token->text, word);
+}
+
+/**
+ * Checks whether a token is a reserved word that ends a list.
+ *
+ * @param token The token to check
+ * @return Boolean for a then, elif, else, fi, do, done or }
+ */
+static int
+ends_list(const struct Token *token)
+{
+  static const char *const words[] = {
+    "then", "elif", "else", "fi", "do", "done", "}",
+  };
+  for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); ++i)
+  {
+    if (is_reserved(token, words[i]))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Reads the bodies of the here-documents of the current line's
+ * commands, which come before the next line of commands.
+ *
+ * @param p The pointer to the Parser
+ */
+static void
+read_pending(struct Parser *p)
+{
+  for (int i = 0; i < p->numPending; ++i)
+  {
+    p->pending[i]->here = read_here_text(p->reader, p->prompt,
+                                         p->pending[i]->tokens, p->arena);
+  }
+  p->numPending = 0;
+}
+
+/**
+ * Counts the tokens of a line, ending it after a TOKEN_ERROR, which took
+ * at least one byte of the line and so has room after it.
+ *
+ * @param tokens The tokens from tokenize_input()
+ * @return The number of tokens before the TOKEN_END
+ */
+static int
+end_tokens(struct Token *tokens)
+{
+  int count = 0;
+  while (tokens[count].type != TOKEN_END &&
+         tokens[count].type != TOKEN_ERROR)
+  {
+    ++count;
+  }
+  if (tokens[count].type == TOKEN_ERROR)
+  {
+    tokens[++count].type = TOKEN_END;
+    tokens[count].flags = 0;
+    tokens[count].text = NULL;
+  }
+  return count;
+}
+
+/**
+ * Reads and tokenizes the next line of the statement, prompting with
+ * "> " for the lines after the first when prompting at all.
+ *
+ * @param p The pointer to the Parser
+ * @return Boolean for a line being read rather than the end of input
+ */
+static int
+next_line(struct Parser *p)
+{
+  read_pending(p);
+  size_t len;
+  char *line = read_command_line(p->reader, p->prompt, p->arena, &len);
+  if (p->prompt != NULL)
+  {
+    p->prompt = "> ";
+  }
+  if (line == NULL)
+  {
+    return 0;
+  }
+
+  p->tokens = tokenize_input(line, len, p->arena);
+  int count = end_tokens(p->tokens);
+  p->pending = arena_alloc(p->arena, (count + 1) * sizeof(struct Node *));
+  p->numPending = 0;
+  p->pos = 0;
+  return 1;
+}
+
+/**
+ * Moves past the line ends before a reserved word that may be on a
+ * later line.
+ *
+ * @param p The pointer to the Parser
+ * @return Boolean for success, 0 at the end of input
+ */
+static int
+skip_line_ends(struct Parser *p)
+{
+  while (p->tokens[p->pos].type == TOKEN_END)
+  {
+    if (!next_line(p))
+    {
+      parse_error(p, NULL);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Consumes the reserved word that has to come next, after a list that
+ * may not be empty.
+ *
+ * @param p The pointer to the Parser
+ * @param word The reserved word
+ * @param list The list before the word
+ * @return Boolean for success
+ */
+static int
+expect(struct Parser *p, const char *word, const struct Node *list)
+{
+  if (p->failed)
+  {
+    return 0;
+  }
+  if (list == NULL || !is_reserved(&p->tokens[p->pos], word))
+  {
+    parse_error(p, &p->tokens[p->pos]);
+    return 0;
+  }
+  ++p->pos;
+  return 1;
+}
+
+/**
+ * Replaces the word at the current position, when it is an unquoted
+ * alias, by the tokens of the alias's text, and does so again for the
+ * word that takes its place unless that alias was already expanded
+ * here, so an alias can refer to a command of the same name.
+ *
+ * @param p The pointer to the Parser
+ */
+static void
+expand_alias(struct Parser *p)
+{
+  const char *seen[MAX_ALIASES];
+  int numSeen = 0;
+  const struct Token *token = &p->tokens[p->pos];
+  const char *value;
+  while (numSeen < MAX_ALIASES && token->type == TOKEN_WORD &&
+         token->flags == 0 && (value = find_alias(token->text)) != NULL)
+  {
+    for (int i = 0; i < numSeen; ++i)
+    {
+      if (!strcmp(seen[i], token->text))
+      {
+        return;
+      }
+    }
+    seen[numSeen++] = token->text;
+
+    struct Token *alias = tokenize_input(value, strlen(value), p->arena);
+    int aliasCount = end_tokens(alias);
+    int rest = 1;
+    while (p->tokens[p->pos + rest].type != TOKEN_END)
+    {
+      ++rest;
+    }
+    // The word is replaced; the rest of the line, its end included, moves
+    int total = p->pos + aliasCount + rest;
+    struct Token *tokens = arena_alloc(p->arena,
+                                       total * sizeof(struct Token));
+    memcpy(tokens, p->tokens, p->pos * sizeof(struct Token));
+    memcpy(tokens + p->pos, alias, aliasCount * sizeof(struct Token));
+    memcpy(tokens + p->pos + aliasCount, p->tokens + p->pos + 1,
+           rest * sizeof(struct Token));
+    p->tokens = tokens;
+    struct Node **pending = arena_alloc(p->arena,
+                                        total * sizeof(struct Node *));
+    memcpy(pending, p->pending, p->numPending * sizeof(struct Node *));
+    p->pending = pending;
+    token = &p->tokens[p->pos];
+  }
+}
+
+/**
+ * Parses a pipeline, up to the next ';', the end of the line, or a '&'
+ * that it keeps as its last token to run in the background.
+ *
+ * @param p The pointer to the Parser
+ * @return The pointer to the NODE_COMMAND, or NULL on error
+ */
+static struct Node *
+parse_pipeline(struct Parser *p)
+{
+  int start = p->pos;
+  while (p->tokens[p->pos].type != TOKEN_SEMI &&
+         p->tokens[p->pos].type != TOKEN_END &&
+         p->tokens[p->pos].type != TOKEN_AMP)
+  {
+    if (p->tokens[p->pos++].type == TOKEN_PIPE)
+    { // the next stage starts a command too
+      expand_alias(p);
+    }
+  }
+  if (p->pos == start)
+  {
+    parse_error(p, &p->tokens[p->pos]);
+    return NULL;
+  }
+  p->pos += p->tokens[p->pos].type == TOKEN_AMP;
+  int count = p->pos - start;
+
+  struct Token *tokens = arena_alloc(p->arena,
+                                     (count + 1) * sizeof(struct Token));
+  memcpy(tokens, p->tokens + start, count * sizeof(struct Token));
+  tokens[count].type = TOKEN_END;
+  tokens[count].flags = 0;
+  tokens[count].text = NULL;
+  struct Node *node = command_node(tokens, p->arena);
+  for (int i = 0; i < count; ++i)
+  {
+    if (tokens[i].type == TOKEN_DLESS)
+    {
+      p->pending[p->numPending++] = node;
+      break;
+    }
+  }
+  ++p->commands;
+  return node;
+}
+
+/**
+ * Parses the rest of an if or elif, through the fi.
+ *
+ * @param p The pointer to the Parser
+ * @return The pointer to the NODE_IF, or NULL on error
+ */
+static struct Node *
+parse_if(struct Parser *p)
+{
+  struct Node *node = init_node(NODE_IF, p->arena);
+  ++p->pos;
+  node->cond = parse_list(p);
+  if (!expect(p, "then", node->cond))
+  {
+    return NULL;
+  }
+  node->body = parse_list(p);
+  if (!p->failed && is_reserved(&p->tokens[p->pos], "elif"))
+  {
+    if (node->body == NULL)
+    {
+      parse_error(p, &p->tokens[p->pos]);
+      return NULL;
+    }
+    node->orElse = parse_if(p);
+    return node->orElse ? node : NULL;
+  }
+  if (!p->failed && is_reserved(&p->tokens[p->pos], "else"))
+  {
+    if (node->body == NULL)
+    {
+      parse_error(p, &p->tokens[p->pos]);
+      return NULL;
+    }
+    ++p->pos;
+    node->orElse = parse_list(p);
+    return expect(p, "fi", node->orElse) ? node : NULL;
+  }
+  return expect(p, "fi", node->body) ? node : NULL;
+}
+
+/**
+ * Parses a while or until loop.
+ *
+ * @param p The pointer to the Parser
+ * @param type NODE_WHILE or NODE_UNTIL
+ * @return The pointer to the node, or NULL on error
+ */
+static struct Node *
+parse_loop(struct Parser *p, enum NodeType type)
+{
+  struct Node *node = init_node(type, p->arena);
+  ++p->pos;
+  node->cond = parse_list(p);
+  if (!expect(p, "do", node->cond))
+  {
+    return NULL;
+  }
+  node->body = parse_list(p);
+  return expect(p, "done", node->body) ? node : NULL;
+}
+
+/**
+ * Parses a for loop. Without "in" and a list of words it runs over the
+ * positional parameters.
+ *
+ * @param p The pointer to the Parser
+ * @return The pointer to the NODE_FOR, or NULL on error
+ */
+static struct Node *
+parse_for(struct Parser *p)
+{
+  struct Node *node = init_node(NODE_FOR, p->arena);
+  struct Token *name = &p->tokens[++p->pos];
+  if (name->type != TOKEN_WORD || name->flags != 0 ||
+      var_name_len(name->text, strlen(name->text)) != strlen(name->text))
+  {
+    parse_error(p, name);
+    return NULL;
+  }
+  node->name = name->text;
+  ++p->pos;
+
+  if (is_reserved(&p->tokens[p->pos], "in"))
+  {
+    int start = ++p->pos;
+    while (p->tokens[p->pos].type == TOKEN_WORD)
+    {
+      ++p->pos;
+    }
+    int count = p->pos - start;
+    node->tokens = arena_alloc(p->arena, (count + 1) * sizeof(struct Token));
+    memcpy(node->tokens, p->tokens + start, count * sizeof(struct Token));
+    node->tokens[count].type = TOKEN_END;
+    node->tokens[count].flags = 0;
+    node->tokens[count].text = NULL;
+  }
+  if (p->tokens[p->pos].type == TOKEN_SEMI)
+  {
+    ++p->pos;
+  }
+  else if (p->tokens[p->pos].type != TOKEN_END &&
+           !is_reserved(&p->tokens[p->pos], "do"))
+  {
+    parse_error(p, &p->tokens[p->pos]);
+    return NULL;
+  }
+  if (!skip_line_ends(p))
+  {
+    return NULL;
+  }
+  if (!is_reserved(&p->tokens[p->pos], "do"))
+  {
+    parse_error(p, &p->tokens[p->pos]);
+    return NULL;
+  }
+  ++p->pos;
+  node->body = parse_list(p);
+  return expect(p, "done", node->body) ? node : NULL;
+}
+
+/**
+ * Parses a group of commands in braces.
+ *
+ * @param p The pointer to the Parser
+ * @return The pointer to the NODE_LIST, or NULL on error
+ */
+static struct Node *
+parse_group(struct Parser *p)
+{
+  struct Node *node = init_node(NODE_LIST, p->arena);
+  ++p->pos;
+  node->body = parse_list(p);
+  return expect(p, "}", node->body) ? node : NULL;
+}
+
+/**
+ * Measures the name of a function definition at the current position:
+ * an unquoted name followed by "()", as part of the same word or as a
+ * word of its own.
+ *
+ * @param p The pointer to the Parser
+ * @return The length of the name, or 0 if no function is defined here
+ */
+static size_t
+function_name(const struct Parser *p)
+{
+  const struct Token *token = &p->tokens[p->pos];
+  if (token->type != TOKEN_WORD || token->flags != 0)
+  {
+    return 0;
+  }
+  size_t len = strlen(token->text);
+  size_t nameLen = var_name_len(token->text, len);
+  if (nameLen == 0)
+  {
+    return 0;
+  }
+  if (nameLen == len)
+  {
+    return is_reserved(token + 1, "()") ? nameLen : 0;
+  }
+  return nameLen + 2 == len && !strcmp(token->text + nameLen, "()") ?
+         nameLen : 0;
+}
+
+/**
+ * Parses a function definition, whose body is a group of commands that
+ * may start on a later line.
+ *
+ * @param p The pointer to the Parser
+ * @param nameLen The length of the function's name
+ * @return The pointer to the NODE_FUNCTION, or NULL on error
+ */
+static struct Node *
+parse_function(struct Parser *p, size_t nameLen)
+{
+  struct Node *node = init_node(NODE_FUNCTION, p->arena);
+  const struct Token *token = &p->tokens[p->pos];
+  node->name = arena_strndup(p->arena, token->text, nameLen);
+  p->pos += token->text[nameLen] == '\0' ? 2 : 1;
+  if (!skip_line_ends(p))
+  {
+    return NULL;
+  }
+  if (!is_reserved(&p->tokens[p->pos], "{"))
+  {
+    parse_error(p, &p->tokens[p->pos]);
+    return NULL;
+  }
+  node->body = parse_group(p);
+  return node->body ? node : NULL;
+}
+
+/**
+ * Parses one command: a pipeline or a compound command.
+ *
+ * @param p The pointer to the Parser
+ * @return The pointer to the node, or NULL on error
+ */
+static struct Node *
+parse_command(struct Parser *p)
+{
+  expand_alias(p);
+  const struct Token *token = &p->tokens[p->pos];
+  struct Node *node;
+  size_t nameLen;
+  if (is_reserved(token, "if"))
+  {
+    ++p->depth;
+    node = parse_if(p);
+  }
+  else if (is_reserved(token, "for"))
+  {
+    ++p->depth;
+    node = parse_for(p);
+  }
+  else if (is_reserved(token, "while") || is_reserved(token, "until"))
+  {
+    ++p->depth;
+    node = parse_loop(p, token->text[0] == 'w' ? NODE_WHILE : NODE_UNTIL);
+  }
+  else if (is_reserved(token, "{"))
+  {
+    ++p->depth;
+    node = parse_group(p);
+  }
+  else if ((nameLen = function_name(p)) != 0)
+  {
+    ++p->depth;
+    node = parse_function(p, nameLen);
+  }
+  else
+  {
+    return parse_pipeline(p);
+  }
+  --p->depth;
+  return node;
+}
+
+/**
+ * Parses a list of commands separated by ';', '&' or, inside a compound
+ * command, by line ends, up to a reserved word ending the list or, at
+ * the top level, the end of the line. A pipeline keeps its '&'; a
+ * compound command is marked to run in the background.
+ *
+ * @param p The pointer to the Parser
+ * @return The pointer to the first command, or NULL for an empty list
+ */
+static struct Node *
+parse_list(struct Parser *p)
+{
+  struct Node *head = NULL;
+  struct Node **link = &head;
+  while (!p->failed)
+  {
+    const struct Token *token = &p->tokens[p->pos];
+    if (token->type == TOKEN_END)
+    {
+      if (p->depth == 0)
+      {
+        break;
+      }
+      if (!next_line(p))
+      {
+        parse_error(p, NULL);
+      }
+      continue;
+    }
+    if (ends_list(token))
+    {
+      break;
+    }
+
+    struct Node *node = parse_command(p);
+    if (node == NULL)
+    {
+      break;
+    }
+    *link = node;
+    link = &node->next;
+    token = &p->tokens[p->pos];
+    if (node->type == NODE_COMMAND && token[-1].type == TOKEN_AMP)
+    { // the pipeline's '&' ended it
+    }
+    else if (token->type == TOKEN_SEMI)
+    {
+      ++p->pos;
+    }
+    else if (token->type == TOKEN_AMP && node->type != NODE_FUNCTION)
+    {
+      node->background = 1;
+      ++p->pos;
+    }
+    else if (token->type != TOKEN_END)
+    {
+      parse_error(p, token);
+    }
+  }
+  return head;
+}
+
+/**
+ * Prompts for and reads the next statement from the given reader,
+ * along with the bodies of its here-documents, and parses it into a
+ * tree. The tree lives in the arena until it is reset.
+ *
+ * @param reader The pointer to the LineReader supplying input
+ * @param prompt The prompt to print first, or NULL for none
+ * @param arena The pointer to the Arena for the tree
+ * @return The NODE_LIST of the statement's commands, empty for a blank
+ *         line, a comment or a syntax error, or NULL at the end of input
+ */
+struct Node *
+get_statement(struct LineReader *reader, const char *prompt,
+              struct Arena *arena)
+{
+  struct Parser p = {reader, prompt, arena, NULL, 0, 0, NULL, 0, 0, 0};
+  if (!next_line(&p))
+  {
+    return NULL;
+  }
+  long long start = tracing ? trace_clock() : 0;
+  struct Node *statement = init_node(NODE_LIST, arena);
+  statement->body = parse_list(&p);
+  if (!p.failed && p.tokens[p.pos].type != TOKEN_END)
+  { // a reserved word closing nothing
+    parse_error(&p, &p.tokens[p.pos]);
+  }
+  read_pending(&p);
+  if (p.failed)
+  {
+    statement->body = NULL;
+  }
+  if (tracing)
+  {
+    trace_event(TRACE_PARSE, start, 0, p.commands, NULL);
+  }
+  return statement;
+}
+
+/**
+ * Returns the Input structs to run a NODE_COMMAND with: the ones parsed
+ * with the node, or ones parsed and expanded now, with the bodies of
+ * any here-documents.
+ *
+ * @param node The pointer to the NODE_COMMAND
+ * @param arena The pointer to the Arena for a new parse
+ * @return The pointer to the first command of the pipeline
+ */
+struct Input *
+node_input(struct Node *node, struct Arena *arena)
+{
+  if (node->input != NULL)
+  {
+    return node->input;
+  }
+  long long start = tracing ? trace_clock() : 0;
+  struct Input *input = get_input(node->tokens, arena);
+  if (node->here != NULL)
+  {
+    struct LineReader *reader = init_reader_str(node->here);
+    read_here_docs(input, reader, NULL, arena);
+    cleanup_reader(reader);
+  }
+  if (tracing)
+  {
+    int commands = 0;
+    for (struct Input *stage = input; stage != NULL && stage->args != NULL;
+         stage = stage->next)
+    {
+      ++commands;
+    }
+    trace_event(TRACE_PARSE, start, 0, commands, NULL);
+  }
+  return input;
+}
+
+/**
+ * Copies an array of tokens and their text into an arena.
+ *
+ * @param tokens The tokens, ending with a TOKEN_END
+ * @param arena The pointer to the Arena for the copy
+ * @return The pointer to the copy
+ */
+static struct Token *
+copy_tokens(const struct Token *tokens, struct Arena *arena)
+{
+  int count = 0;
+  while (tokens[count].type != TOKEN_END)
+  {
+    ++count;
+  }
+  struct Token *copy = arena_alloc(arena, (count + 1) * sizeof(struct Token));
+  for (int i = 0; i <= count; ++i)
+  {
+    copy[i] = tokens[i];
+    if (tokens[i].text != NULL)
+    {
+      copy[i].text = arena_strndup(arena, tokens[i].text,
+                                   strlen(tokens[i].text));
+    }
+  }
+  return copy;
+}
+
+/**
+ * Copies a tree, with the commands following it in its list, into
+ * another arena so it can outlive the statement it was parsed from.
+ * Pipelines that were parsed with the tree are parsed again into the
+ * copy.
+ *
+ * @param node The pointer to the first Node, or NULL
+ * @param arena The pointer to the Arena for the copy
+ * @return The pointer to the copy of the first Node, or NULL
+ */
+struct Node *
+copy_node(const struct Node *node, struct Arena *arena)
+{
+  struct Node *head = NULL;
+  struct Node **link = &head;
+  for (; node != NULL; node = node->next)
+  {
+    struct Node *copy;
+    if (node->type == NODE_COMMAND)
+    {
+      copy = command_node(copy_tokens(node->tokens, arena), arena);
+    }
+    else
+    {
+      copy = init_node(node->type, arena);
+      if (node->tokens != NULL)
+      {
+        copy->tokens = copy_tokens(node->tokens, arena);
+      }
+    }
+    if (node->here != NULL)
+    {
+      copy->here = arena_strndup(arena, node->here, strlen(node->here));
+    }
+    if (node->name != NULL)
+    {
+      copy->name = arena_strndup(arena, node->name, strlen(node->name));
+    }
+    copy->background = node->background;
+    copy->cond = copy_node(node->cond, arena);
+    copy->body = copy_node(node->body, arena);
+    copy->orElse = copy_node(node->orElse, arena);
+    *link = copy;
+    link = &copy->next;
+  }
+  return head;
+}
@@ -0,0 +1,43 @@
+/* Header file for the parser of command lists and control flow */
+
+#ifndef CONTROL_FLOW_H
+#define CONTROL_FLOW_H
+
+#include "arena.h"
+#include "input_parsing.h"
+#include "lexer.h"
+#include "line_reader.h"
+
+enum NodeType
+{
+  NODE_LIST,    // commands in sequence, in body, or a { } group
+  NODE_COMMAND, // a pipeline
+  NODE_IF,      // if cond; then body; else orElse; fi
+  NODE_FOR,     // for name in tokens; do body; done
+  NODE_WHILE,   // while cond; do body; done
+  NODE_UNTIL,   // until cond; do body; done
+  NODE_FUNCTION // name() body, defining a function
+};
+
+struct Node // a command of the syntax tree a statement is parsed into
+{
+  enum NodeType type;
+  struct Token *tokens; // the pipeline, or the words of a for loop
+  struct Input *input;  // the pipeline parsed once, if it expands nothing
+  char *here;           // lines of the pipeline's here-documents, or NULL
+  char *name;           // variable of a for loop, or name of a function
+  struct Node *cond;    // condition of an if or loop
+  struct Node *body;    // then part, loop body or list
+  struct Node *orElse;  // else part, an elif being a nested NODE_IF
+  struct Node *next;    // next command of the list
+  int background;       // Boolean for a compound command ended by '&'
+};
+
+struct Node * init_node(enum NodeType type, struct Arena *arena);
+struct Node * get_statement(struct LineReader *reader, const char *prompt,
+                            struct Arena *arena);
+struct Node * command_node(struct Token *tokens, struct Arena *arena);
+struct Input * node_input(struct Node *node, struct Arena *arena);
+struct Node * copy_node(const struct Node *node, struct Arena *arena);
+
+#endif
@@ -0,0 +1,202 @@
+/**
+ * Definitions for the shell's event loop.
+ *
+ * SIGCHLD is blocked for the life of the shell and delivered through a
+ * signalfd instead, which sits in two epoll sets: one that also watches
+ * the input descriptor while the shell waits at the prompt, and one
+ * that watches children alone while a foreground job runs. Either way,
+ * children are reaped and background jobs reported as soon as they
+ * finish rather than after the next line of input.
+ */
+
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include "event_loop.h"
+#include "process_control.h"
+
+static struct JobTable *jobTable = NULL;
+static const char *promptStr = NULL;
+static int sigFd = -1;      // signalfd for SIGCHLD
+static int inputSet = -1;   // epoll set for sigFd and the input
+static int childSet = -1;   // epoll set for sigFd alone
+static int inputFd = -1;    // input descriptor watched by inputSet
+static int inputPolled = 0; // Boolean for inputFd supporting epoll
+static void (*redrawHook)(void) = NULL; // shows the prompt instead
+
+/**
+ * Blocks SIGCHLD and sets up the signalfd and epoll sets used to wait
+ * for input and children.
+ *
+ * @param jobs The pointer to the job table children are reaped into
+ * @param prompt The prompt to show again after reporting a finished
+ *        background job while waiting for input, or NULL for none
+ */
+void
+init_events(struct JobTable *jobs, const char *prompt)
+{
+  jobTable = jobs;
+  promptStr = prompt;
+
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  sigFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+  struct epoll_event event = {0};
+  event.events = EPOLLIN;
+  event.data.fd = sigFd;
+  inputSet = epoll_create1(EPOLL_CLOEXEC);
+  childSet = epoll_create1(EPOLL_CLOEXEC);
+  epoll_ctl(inputSet, EPOLL_CTL_ADD, sigFd, &event);
+  epoll_ctl(childSet, EPOLL_CTL_ADD, sigFd, &event);
+}
+
+/**
+ * Gives a subshell forked from the shell a signalfd and epoll sets of
+ * its own, since the ones it inherits keep waking the shell rather than
+ * the subshell when its children exit.
+ */
+void
+reset_events(void)
+{
+  cleanup_events();
+  inputFd = -1;
+  inputPolled = 0;
+  redrawHook = NULL;
+  init_events(jobTable, NULL);
+}
+
+/**
+ * Drains the queued SIGCHLD notifications and reaps every child that
+ * has finished.
+ *
+ * @param prompt The prompt to restore after any reports, or NULL
+ */
+static void
+handle_children(const char *prompt)
+{
+  struct signalfd_siginfo info;
+  while (read(sigFd, &info, sizeof info) == sizeof info)
+  {
+    // each notification may stand for several children; reap() gets all
+  }
+  if (prompt != NULL && redrawHook != NULL)
+  { // the line editor shows the prompt along with the line being edited
+    if (reap(jobTable, "") > 0)
+    {
+      redrawHook();
+    }
+    return;
+  }
+  reap(jobTable, prompt);
+}
+
+/**
+ * Sets the function that shows the prompt again after background jobs
+ * are reported while waiting for input, in place of printing it.
+ *
+ * @param redraw The function, or NULL to print the prompt
+ */
+void
+set_redraw(void (*redraw)(void))
+{
+  redrawHook = redraw;
+}
+
+/**
+ * Blocks until the given input descriptor is readable, reaping and
+ * reporting children as they finish in the meantime. Descriptors that
+ * epoll cannot watch, such as regular files, are always readable.
+ *
+ * @param fd The input descriptor
+ */
+void
+wait_for_input(int fd)
+{
+  if (fd != inputFd)
+  {
+    struct epoll_event event = {0};
+    if (inputPolled)
+    {
+      epoll_ctl(inputSet, EPOLL_CTL_DEL, inputFd, &event);
+    }
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    inputFd = fd;
+    inputPolled = !epoll_ctl(inputSet, EPOLL_CTL_ADD, fd, &event);
+  }
+  if (!inputPolled)
+  {
+    handle_children(NULL);
+    return;
+  }
+
+  int ready = 0;
+  while (!ready)
+  {
+    struct epoll_event events[2];
+    int n = epoll_wait(inputSet, events, 2, -1);
+    for (int i = 0; i < n; ++i)
+    {
+      if (events[i].data.fd == sigFd)
+      {
+        handle_children(promptStr);
+      }
+      else
+      {
+        ready = 1; // readable, hung up or in error; read() will tell
+      }
+    }
+    // n == -1 with EINTR means a SIGTSTP handler ran; keep waiting
+  }
+}
+
+/**
+ * Blocks until at least one child has changed state and reaps it, along
+ * with any others that have finished.
+ */
+void
+wait_for_children(void)
+{
+  while (!wait_for_children_timed(-1))
+  {
+    // interrupted by a signal handler; keep waiting
+  }
+}
+
+/**
+ * Like wait_for_children(), but gives up after the given time.
+ *
+ * @param timeoutMs The most milliseconds to block for, or -1 for no limit
+ * @return Boolean for having reaped, false if the time ran out or a
+ *         signal handler interrupted the wait
+ */
+int
+wait_for_children_timed(int timeoutMs)
+{
+  struct epoll_event event;
+  if (epoll_wait(childSet, &event, 1, timeoutMs) <= 0)
+  {
+    return 0;
+  }
+  handle_children(NULL);
+  return 1;
+}
+
+/**
+ * Closes the descriptors used by the event loop.
+ */
+void
+cleanup_events(void)
+{
+  close(childSet);
+  close(inputSet);
+  close(sigFd);
+}
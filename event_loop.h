@@ -0,0 +1,14 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "job_table.h"
+
+void init_events(struct JobTable *jobs, const char *prompt);
+void reset_events(void);
+void wait_for_input(int fd);
+void set_redraw(void (*redraw)(void));
+void wait_for_children(void);
+int wait_for_children_timed(int timeoutMs);
+void cleanup_events(void);
+
+#endif
@@ -0,0 +1,380 @@
+/**
+ * Definitions for the tables of shell functions and aliases.
+ *
+ * Both live in one table using open addressing with linear probing,
+ * keyed by name, since a name can be both. A function's body is copied
+ * out of the statement that defined it into an arena of its own, with
+ * its pipelines parsed again there, so every call runs the same tree.
+ * Replacing a function while it runs, from its own body for instance,
+ * keeps the old body until the last of its calls returns.
+ *
+ * Aliases are plain strings, expanded by the parser when it meets one
+ * as the first word of a command. Entries are never removed, only
+ * emptied, so the table needs no tombstones.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "control_flow.h"
+#include "functions.h"
+
+struct NameEntry
+{
+  char *name;         // NULL for an empty slot
+  size_t len;
+  unsigned long hash;
+  struct Function *function; // NULL when no function has the name
+  char *alias;        // NULL when no alias has the name
+};
+
+static struct NameEntry *table = NULL;
+static size_t capacity = 0; // always a power of two
+static size_t count = 0;
+
+/**
+ * Computes the FNV-1a hash of the given bytes.
+ *
+ * @param s The bytes to hash
+ * @param len The number of bytes
+ * @return The hash value
+ */
+static unsigned long
+hash_bytes(const char *s, size_t len)
+{
+  unsigned long h = 2166136261UL;
+  for (size_t i = 0; i < len; ++i)
+  {
+    h = (h ^ (unsigned char)s[i]) * 16777619UL;
+  }
+  return h;
+}
+
+/**
+ * Finds the slot holding the given name, or the empty slot where it
+ * would be inserted.
+ *
+ * @param name The name, not necessarily '\0'-terminated
+ * @param len The length of the name
+ * @param hash The hash of the name
+ * @return The index of the slot
+ */
+static size_t
+find_slot(const char *name, size_t len, unsigned long hash)
+{
+  size_t i = hash & (capacity - 1);
+  while (table[i].name != NULL &&
+         (table[i].hash != hash || table[i].len != len ||
+          memcmp(table[i].name, name, len)))
+  {
+    i = (i + 1) & (capacity - 1);
+  }
+  return i;
+}
+
+/**
+ * Looks up the entry of a name.
+ *
+ * @param name The name, not necessarily '\0'-terminated
+ * @param len The length of the name
+ * @return The pointer to the entry, or NULL if the name has none
+ */
+static struct NameEntry *
+find_entry(const char *name, size_t len)
+{
+  if (count == 0)
+  {
+    return NULL;
+  }
+  struct NameEntry *entry = &table[find_slot(name, len,
+                                             hash_bytes(name, len))];
+  return entry->name != NULL ? entry : NULL;
+}
+
+/**
+ * Returns the entry of a name, adding an empty one if it has none.
+ *
+ * @param name The name, not necessarily '\0'-terminated
+ * @param len The length of the name
+ * @return The pointer to the entry
+ */
+static struct NameEntry *
+add_entry(const char *name, size_t len)
+{
+  if (count + 1 > capacity / 2)
+  {
+    struct NameEntry *old = table;
+    size_t oldCapacity = capacity;
+    capacity = capacity ? capacity * 2 : 32;
+    table = calloc(capacity, sizeof(struct NameEntry));
+    for (size_t i = 0; i < oldCapacity; ++i)
+    {
+      if (old[i].name != NULL)
+      {
+        table[find_slot(old[i].name, old[i].len, old[i].hash)] = old[i];
+      }
+    }
+    free(old);
+  }
+
+  unsigned long hash = hash_bytes(name, len);
+  struct NameEntry *entry = &table[find_slot(name, len, hash)];
+  if (entry->name == NULL)
+  {
+    entry->name = malloc(len + 1);
+    memcpy(entry->name, name, len);
+    entry->name[len] = '\0';
+    entry->len = len;
+    entry->hash = hash;
+    ++count;
+  }
+  return entry;
+}
+
+/**
+ * Frees a function no longer defined once none of its calls are left.
+ *
+ * @param function The pointer to the Function
+ */
+static void
+release_function(struct Function *function)
+{
+  if (!function->defined && function->calls == 0)
+  {
+    cleanup_arena(function->arena);
+    free(function);
+  }
+}
+
+/**
+ * Defines a function, or replaces the one with the same name, with a
+ * copy of the given body.
+ *
+ * @param name The name of the function
+ * @param body The NODE_LIST of the body, in the defining statement's
+ *        arena
+ */
+void
+define_function(const char *name, const struct Node *body)
+{
+  struct Function *function = malloc(sizeof(struct Function));
+  function->arena = init_arena(1024);
+  function->body = copy_node(body, function->arena);
+  function->calls = 0;
+  function->defined = 1;
+
+  struct NameEntry *entry = add_entry(name, strlen(name));
+  if (entry->function != NULL)
+  {
+    entry->function->defined = 0;
+    release_function(entry->function);
+  }
+  entry->function = function;
+}
+
+/**
+ * Looks up a function by name.
+ *
+ * @param name The name of the function
+ * @return The pointer to the Function, or NULL if there is none
+ */
+struct Function *
+find_function(const char *name)
+{
+  struct NameEntry *entry = find_entry(name, strlen(name));
+  return entry != NULL ? entry->function : NULL;
+}
+
+/**
+ * Looks up a function to call, keeping its body until the call ends
+ * with leave_function().
+ *
+ * @param name The name of the function
+ * @return The pointer to the Function, or NULL if there is none
+ */
+struct Function *
+enter_function(const char *name)
+{
+  struct Function *function = find_function(name);
+  if (function != NULL)
+  {
+    ++function->calls;
+  }
+  return function;
+}
+
+/**
+ * Ends a call of a function, freeing the function if it was replaced
+ * during the call.
+ *
+ * @param function The pointer to the Function
+ */
+void
+leave_function(struct Function *function)
+{
+  --function->calls;
+  release_function(function);
+}
+
+/**
+ * Defines an alias, or replaces the one with the same name.
+ *
+ * @param name The name, not necessarily '\0'-terminated
+ * @param len The length of the name
+ * @param value The text the name stands for
+ */
+void
+set_alias(const char *name, size_t len, const char *value)
+{
+  struct NameEntry *entry = add_entry(name, len);
+  free(entry->alias);
+  entry->alias = strdup(value);
+}
+
+/**
+ * Looks up an alias by name.
+ *
+ * @param name The name of the alias
+ * @return The text of the alias, valid until it is changed, or NULL if
+ *         there is none
+ */
+const char *
+find_alias(const char *name)
+{
+  struct NameEntry *entry = find_entry(name, strlen(name));
+  return entry != NULL ? entry->alias : NULL;
+}
+
+/**
+ * Removes an alias.
+ *
+ * @param name The name of the alias
+ * @return 0 for success, or -1 if there is no such alias
+ */
+int
+remove_alias(const char *name)
+{
+  struct NameEntry *entry = find_entry(name, strlen(name));
+  if (entry == NULL || entry->alias == NULL)
+  {
+    return -1;
+  }
+  free(entry->alias);
+  entry->alias = NULL;
+  return 0;
+}
+
+/**
+ * Removes every alias.
+ */
+void
+remove_aliases(void)
+{
+  for (size_t i = 0; i < capacity; ++i)
+  {
+    free(table[i].alias);
+    table[i].alias = NULL;
+  }
+}
+
+/**
+ * Prints an alias as the command that defines it, single-quoting the
+ * text.
+ *
+ * @param entry The pointer to the entry of the alias
+ */
+static void
+print_entry(const struct NameEntry *entry)
+{
+  printf("alias %s='", entry->name);
+  for (const char *c = entry->alias; *c != '\0'; ++c)
+  {
+    if (*c == '\'')
+    {
+      fputs("'\\''", stdout);
+    }
+    else
+    {
+      putchar(*c);
+    }
+  }
+  fputs("'\n", stdout);
+}
+
+/**
+ * Compares the names of two entries for qsort().
+ */
+static int
+compare_entries(const void *a, const void *b)
+{
+  return strcmp((*(const struct NameEntry *const *)a)->name,
+                (*(const struct NameEntry *const *)b)->name);
+}
+
+/**
+ * Prints one alias, or all of them sorted by name, as the commands
+ * that define them.
+ *
+ * @param name The name of the alias, or NULL for all of them
+ * @return 0 for success, or -1 if there is no such alias
+ */
+int
+alias_print(const char *name)
+{
+  if (name != NULL)
+  {
+    struct NameEntry *entry = find_entry(name, strlen(name));
+    if (entry == NULL || entry->alias == NULL)
+    {
+      return -1;
+    }
+    print_entry(entry);
+    return 0;
+  }
+
+  const struct NameEntry **sorted = malloc((count + 1) *
+                                           sizeof(struct NameEntry *));
+  size_t numAliases = 0;
+  for (size_t i = 0; i < capacity; ++i)
+  {
+    if (table[i].alias != NULL)
+    {
+      sorted[numAliases++] = &table[i];
+    }
+  }
+  qsort(sorted, numAliases, sizeof(struct NameEntry *), compare_entries);
+  for (size_t i = 0; i < numAliases; ++i)
+  {
+    print_entry(sorted[i]);
+  }
+  free(sorted);
+  return 0;
+}
+
+/**
+ * Frees every function and alias.
+ */
+void
+cleanup_functions(void)
+{
+  for (size_t i = 0; i < capacity; ++i)
+  {
+    if (table[i].name != NULL)
+    {
+      if (table[i].function != NULL)
+      {
+        table[i].function->defined = 0;
+        release_function(table[i].function);
+      }
+      free(table[i].alias);
+      free(table[i].name);
+    }
+  }
+  free(table);
+  table = NULL;
+  capacity = count = 0;
+}
@@ -0,0 +1,30 @@
+/* Header file for the tables of shell functions and aliases */
+
+#ifndef FUNCTIONS_H
+#define FUNCTIONS_H
+
+#include <stddef.h>
+
+#include "arena.h"
+#include "control_flow.h"
+
+struct Function // a shell function, parsed once when it is defined
+{
+  struct Node *body;   // the brace group the function runs
+  struct Arena *arena; // holds the body
+  int calls;           // calls running, which keep a replaced body alive
+  int defined;         // Boolean, cleared when the function is replaced
+};
+
+void define_function(const char *name, const struct Node *body);
+struct Function * find_function(const char *name);
+struct Function * enter_function(const char *name);
+void leave_function(struct Function *function);
+void set_alias(const char *name, size_t len, const char *value);
+const char * find_alias(const char *name);
+int remove_alias(const char *name);
+void remove_aliases(void);
+int alias_print(const char *name);
+void cleanup_functions(void);
+
+#endif
@@ -0,0 +1,542 @@
+/**
+ * Definitions for the persistent command history.
+ *
+ * Commands are appended, one per line, to $SMALLSH_HISTFILE, or to
+ * ~/.smallsh_history by default, which stays a plain text file for
+ * auditing; an empty SMALLSH_HISTFILE turns history off. Next to it,
+ * the same name with ".idx" appended holds the index: a header followed
+ * by one fixed-size record per command giving where its line is. Both
+ * files are memory-mapped, so starting up costs the same however long
+ * the history is, and the N'th command is found directly.
+ *
+ * For prefix search, the header keeps the latest command for each hash
+ * bucket of the first 1, 2, 3 and 4 bytes of a command, and every
+ * record links to the previous command in each of its buckets. Finding
+ * the latest command with a given prefix walks only the chain of
+ * commands that share its first bytes.
+ *
+ * Shells append under an exclusive flock(2) on the index: the line is
+ * written to the text first, then the index catches up with the text,
+ * writing the new records before the header that counts them. Readers
+ * take no lock; they only use the records the header counts. Lines a
+ * crashed shell wrote but never indexed are indexed by the next append,
+ * and a missing or damaged index is rebuilt from the text.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history.h"
+
+#define HIST_MAGIC "SMHIST1"  // includes the terminator, 8 bytes
+#define HIST_LEVELS 4         // prefix lengths with a chain of their own
+#define HIST_BUCKETS 4096     // buckets per prefix length
+
+struct HistHeader
+{
+  char magic[8];
+  uint64_t count;    // commands indexed
+  uint64_t textSize; // bytes of the text they cover
+  uint32_t heads[HIST_LEVELS][HIST_BUCKETS]; // latest command + 1, or 0
+};
+
+struct HistEntry
+{
+  uint64_t offset; // of the line in the text
+  uint32_t len;    // without the newline
+  uint32_t prev[HIST_LEVELS]; // previous command + 1 in the same bucket
+  uint32_t unused;
+};
+
+#define MAP_SLACK (1 << 20) // bytes mapped past the end of a file
+
+struct Mapping
+{
+  const char *base; // NULL if nothing is mapped
+  size_t size;      // bytes of the file that may be read
+  size_t capacity;  // bytes mapped, at least size
+};
+
+static int textFd = -1;
+static int indexFd = -1;
+static struct Mapping textMap = {NULL, 0, 0};
+static struct Mapping indexMap = {NULL, 0, 0};
+static const char *text = NULL;                // textMap.base
+static const struct HistHeader *header = NULL; // indexMap.base
+
+/**
+ * Brings the mapping of a file up to date with its size. The mapping
+ * reaches past the end of the file, so appends by this and other shells
+ * rarely need it to be mapped again; only the bytes within the file are
+ * ever read.
+ *
+ * @param fd The file descriptor
+ * @param map The pointer to the Mapping
+ * @return -1 for failure, 0 for success
+ */
+static int
+map_file(int fd, struct Mapping *map)
+{
+  struct stat st;
+  if (fstat(fd, &st) == -1)
+  {
+    return -1;
+  }
+  size_t size = st.st_size;
+  if (size <= map->capacity)
+  {
+    map->size = size;
+    return 0;
+  }
+  size_t capacity = size * 2 + MAP_SLACK;
+  void *base = mmap(NULL, capacity, PROT_READ, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+  {
+    return -1;
+  }
+  if (map->base != NULL)
+  {
+    munmap((void *)map->base, map->capacity);
+  }
+  map->base = base;
+  map->size = size;
+  map->capacity = capacity;
+  return 0;
+}
+
+/**
+ * Unmaps a file.
+ *
+ * @param map The pointer to the Mapping
+ */
+static void
+unmap_file(struct Mapping *map)
+{
+  if (map->base != NULL)
+  {
+    munmap((void *)map->base, map->capacity);
+  }
+  map->base = NULL;
+  map->size = map->capacity = 0;
+}
+
+/**
+ * Brings both mappings up to date with what other shells appended.
+ *
+ * @return -1 for failure, 0 for success
+ */
+static int
+remap(void)
+{
+  int result = map_file(textFd, &textMap) == -1 ||
+               map_file(indexFd, &indexMap) == -1 ? -1 : 0;
+  text = textMap.base;
+  header = (const struct HistHeader *)indexMap.base;
+  return result;
+}
+
+/**
+ * Returns the record of the given command, counting from 0.
+ */
+static const struct HistEntry *
+get_entry(uint64_t i)
+{
+  return (const struct HistEntry *)(header + 1) + i;
+}
+
+/**
+ * Computes the bucket of the first bytes of a command.
+ *
+ * @param s The command
+ * @param len The number of bytes to hash
+ * @return The bucket
+ */
+static unsigned
+prefix_bucket(const char *s, size_t len)
+{
+  uint32_t h = 2166136261U;
+  for (size_t i = 0; i < len; ++i)
+  {
+    h = (h ^ (unsigned char)s[i]) * 16777619U;
+  }
+  return h & (HIST_BUCKETS - 1);
+}
+
+/**
+ * Fills in the record for a line of the text, linking it into the
+ * chains of its prefix buckets.
+ *
+ * @param entry The pointer to the record
+ * @param offset The offset of the line in the text
+ * @param len The length of the line
+ * @param heads The latest command + 1 of each bucket
+ * @param buckets Set to the bucket of each prefix length the line has
+ * @return The number of prefix lengths the line has
+ */
+static int
+fill_entry(struct HistEntry *entry, uint64_t offset, size_t len,
+           const uint32_t heads[HIST_LEVELS][HIST_BUCKETS],
+           unsigned buckets[HIST_LEVELS])
+{
+  memset(entry, 0, sizeof(struct HistEntry));
+  entry->offset = offset;
+  entry->len = len;
+  int levels = len < HIST_LEVELS ? len : HIST_LEVELS;
+  for (int level = 0; level < levels; ++level)
+  {
+    buckets[level] = prefix_bucket(text + offset, level + 1);
+    entry->prev[level] = heads[level][buckets[level]];
+  }
+  return levels;
+}
+
+/**
+ * Empties the index, leaving a header with no commands.
+ */
+static void
+reset_index(void)
+{
+  struct HistHeader empty = {HIST_MAGIC};
+  ftruncate(indexFd, 0);
+  ftruncate(indexFd, sizeof(struct HistHeader));
+  pwrite(indexFd, &empty, offsetof(struct HistHeader, heads), 0);
+}
+
+/**
+ * Indexes the complete lines of the text that the index does not cover
+ * yet, starting the index over if it does not match the text. Records
+ * are always written before the header that counts them. A single new
+ * line, the usual case, updates the header in place; more are indexed
+ * against a copy of it that is written back whole. Must be called with
+ * the exclusive lock held.
+ */
+static void
+catch_up(void)
+{
+  if (remap() == -1)
+  {
+    return;
+  }
+  if (indexMap.size < sizeof(struct HistHeader) ||
+      memcmp(header->magic, HIST_MAGIC, sizeof(header->magic)) ||
+      header->textSize > textMap.size ||
+      indexMap.size < sizeof(struct HistHeader) +
+                      header->count * sizeof(struct HistEntry))
+  {
+    reset_index();
+    if (remap() == -1)
+    {
+      return;
+    }
+  }
+
+  // Find the complete lines past the indexed ones
+  uint64_t count = header->count;
+  uint64_t textSize = header->textSize;
+  size_t numLines = 0;
+  const char *scan = text + textSize;
+  const char *newline;
+  while (scan < text + textMap.size &&
+         (newline = memchr(scan, '\n', text + textMap.size - scan)) != NULL)
+  {
+    ++numLines;
+    scan = newline + 1;
+  }
+  off_t entryPos = sizeof(struct HistHeader) +
+                   count * sizeof(struct HistEntry);
+  struct HistEntry entry;
+  unsigned buckets[HIST_LEVELS];
+
+  if (numLines == 1)
+  {
+    size_t len = scan - 1 - (text + textSize);
+    int levels = fill_entry(&entry, textSize, len, header->heads, buckets);
+    pwrite(indexFd, &entry, sizeof(entry), entryPos);
+    for (int level = 0; level < levels; ++level)
+    {
+      uint32_t number = count + 1;
+      pwrite(indexFd, &number, sizeof(number),
+             offsetof(struct HistHeader, heads[level][buckets[level]]));
+    }
+  }
+  else if (numLines > 1)
+  {
+    struct HistHeader *next = malloc(sizeof(struct HistHeader));
+    memcpy(next, header, sizeof(struct HistHeader));
+    struct HistEntry *added = malloc(numLines * sizeof(struct HistEntry));
+    uint64_t offset = textSize;
+    for (size_t i = 0; i < numLines; ++i)
+    {
+      const char *line = text + offset;
+      size_t len = (const char *)memchr(line, '\n', scan - line) - line;
+      int levels = fill_entry(&added[i], offset, len, next->heads, buckets);
+      for (int level = 0; level < levels; ++level)
+      {
+        next->heads[level][buckets[level]] = count + i + 1;
+      }
+      offset += len + 1;
+    }
+    pwrite(indexFd, added, numLines * sizeof(struct HistEntry), entryPos);
+    pwrite(indexFd, next->heads, sizeof(next->heads),
+           offsetof(struct HistHeader, heads));
+    free(added);
+    free(next);
+  }
+  if (numLines > 0)
+  {
+    uint64_t counts[2] = {count + numLines, scan - text};
+    pwrite(indexFd, counts, sizeof(counts), offsetof(struct HistHeader, count));
+  }
+}
+
+/**
+ * Opens and maps the history, indexing any commands the index is
+ * missing. History is left off if the files cannot be opened.
+ */
+void
+init_history(void)
+{
+  const char *name = getenv("SMALLSH_HISTFILE");
+  const char *home = getenv("HOME");
+  char path[4096];
+  if (name != NULL && *name == '\0')
+  {
+    return; // set but empty turns history off
+  }
+  if (name != NULL)
+  {
+    snprintf(path, sizeof(path), "%s", name);
+  }
+  else if (home != NULL)
+  {
+    snprintf(path, sizeof(path), "%s/.smallsh_history", home);
+  }
+  else
+  {
+    return;
+  }
+  textFd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  strncat(path, ".idx", sizeof(path) - strlen(path) - 1);
+  indexFd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (textFd == -1 || indexFd == -1)
+  {
+    perror("history");
+    cleanup_history();
+    return;
+  }
+
+  flock(indexFd, LOCK_EX);
+  catch_up();
+  flock(indexFd, LOCK_UN);
+  if (header == NULL)
+  {
+    cleanup_history();
+  }
+}
+
+/**
+ * Appends a command to the history. Blank lines are left out.
+ *
+ * @param line The command, without a newline
+ * @param len The length of the command
+ */
+void
+history_add(const char *line, size_t len)
+{
+  if (header == NULL || len == 0 || strspn(line, " \t") >= len)
+  {
+    return;
+  }
+  char *copy = malloc(len + 1);
+  memcpy(copy, line, len);
+  copy[len] = '\n';
+
+  flock(indexFd, LOCK_EX);
+  write(textFd, copy, len + 1); // one O_APPEND write keeps lines whole
+  catch_up();
+  flock(indexFd, LOCK_UN);
+  free(copy);
+}
+
+/**
+ * Finds the latest command that starts with the given prefix.
+ *
+ * @param prefix The prefix
+ * @param len The length of the prefix, at least 1
+ * @param count The number of commands to search; later ones another
+ *        shell is adding meanwhile are passed over
+ * @return The record of the command, or NULL if there is none
+ */
+static const struct HistEntry *
+find_prefix(const char *prefix, size_t len, uint64_t count)
+{
+  int level = (len < HIST_LEVELS ? len : HIST_LEVELS) - 1;
+  uint32_t i = header->heads[level][prefix_bucket(prefix, level + 1)];
+  while (i != 0)
+  {
+    if (sizeof(struct HistHeader) + i * sizeof(struct HistEntry) >
+        indexMap.size && (remap() == -1 || sizeof(struct HistHeader) +
+                          i * sizeof(struct HistEntry) > indexMap.size))
+    {
+      return NULL; // the index was started over meanwhile
+    }
+    const struct HistEntry *entry = get_entry(i - 1);
+    if (i <= count && entry->len >= len &&
+        !memcmp(text + entry->offset, prefix, len))
+    {
+      return entry;
+    }
+    i = entry->prev[level];
+  }
+  return NULL;
+}
+
+/**
+ * Replaces a line starting with a history reference by the command it
+ * refers to, followed by the rest of the line, and echoes the result.
+ * The reference is the first word: "!!" for the latest command, "!N"
+ * for command N, "!-N" for the N'th latest, or "!PREFIX" for the latest
+ * one starting with PREFIX. Other lines are returned as they are.
+ *
+ * @param line The line
+ * @param len The pointer to the length of the line, updated
+ * @param arena The pointer to the Arena for the new line
+ * @return The line to run, or NULL if the reference found nothing
+ */
+char *
+history_expand(const char *line, size_t *len, struct Arena *arena)
+{
+  if (*len < 2 || line[0] != '!' || line[1] == ' ' || line[1] == '\t' ||
+      line[1] == '=')
+  {
+    return (char *)line;
+  }
+  size_t wordLen = 1;
+  while (wordLen < *len && line[wordLen] != ' ' && line[wordLen] != '\t')
+  {
+    ++wordLen;
+  }
+
+  const struct HistEntry *entry = NULL;
+  if (header != NULL)
+  {
+    uint64_t count = header->count; // before remapping, see catch_up()
+    remap();
+    char *end;
+    long n = strtol(line + 1, &end, 10);
+    if (wordLen == 2 && line[1] == '!')
+    {
+      n = -1;
+      end = (char *)line + wordLen;
+    }
+    if (end == line + wordLen && n > 0 && n <= count)
+    {
+      entry = get_entry(n - 1);
+    }
+    else if (end == line + wordLen && n < 0 && -n <= count)
+    {
+      entry = get_entry(count + n);
+    }
+    else if (end != line + wordLen)
+    {
+      entry = find_prefix(line + 1, wordLen - 1, count);
+    }
+  }
+  if (entry == NULL)
+  {
+    fprintf(stderr, "smallsh: %.*s: event not found\n", (int)wordLen, line);
+    fflush(stderr);
+    return NULL;
+  }
+
+  size_t restLen = *len - wordLen;
+  char *expanded = arena_alloc(arena, entry->len + restLen + 1);
+  memcpy(expanded, text + entry->offset, entry->len);
+  memcpy(expanded + entry->len, line + wordLen, restLen);
+  *len = entry->len + restLen;
+  expanded[*len] = '\0';
+  printf("%s\n", expanded);
+  fflush(stdout);
+  return expanded;
+}
+
+/**
+ * Returns the number of commands in the history.
+ */
+unsigned long
+history_count(void)
+{
+  return header != NULL ? header->count : 0;
+}
+
+/**
+ * Returns a command from the history.
+ *
+ * @param i The index of the command, counting from 0, below
+ *        history_count()
+ * @param len Set to the length of the command
+ * @return The pointer to the command, which has no terminator
+ */
+const char *
+history_get(unsigned long i, size_t *len)
+{
+  remap();
+  const struct HistEntry *entry = get_entry(i);
+  *len = entry->len;
+  return text + entry->offset;
+}
+
+/**
+ * Prints the history with the number of each command, as the history
+ * built-in command does.
+ *
+ * @param last The number of latest commands to print, 0 for all
+ */
+void
+history_print(unsigned long last)
+{
+  if (header == NULL)
+  {
+    return;
+  }
+  uint64_t count = header->count;
+  remap();
+  uint64_t i = last > 0 && last < count ? count - last : 0;
+  for (; i < count; ++i)
+  {
+    const struct HistEntry *entry = get_entry(i);
+    printf("%5llu  %.*s\n", (unsigned long long)i + 1, (int)entry->len,
+           text + entry->offset);
+  }
+}
+
+/**
+ * Unmaps and closes the history files.
+ */
+void
+cleanup_history(void)
+{
+  unmap_file(&textMap);
+  unmap_file(&indexMap);
+  if (textFd != -1)
+  {
+    close(textFd);
+  }
+  if (indexFd != -1)
+  {
+    close(indexFd);
+  }
+  text = NULL;
+  header = NULL;
+  textFd = indexFd = -1;
+}
@@ -0,0 +1,18 @@
+/* Header file for the persistent command history */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+void init_history(void);
+void history_add(const char *line, size_t len);
+char * history_expand(const char *line, size_t *len, struct Arena *arena);
+void history_print(unsigned long last);
+unsigned long history_count(void);
+const char * history_get(unsigned long i, size_t *len);
+void cleanup_history(void);
+
+#endif
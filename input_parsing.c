@@ -2,185 +2,1241 @@
  * Definitions for user input functions
  */ 
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "arena.h"
+#include "history.h"
+#include "line_editor.h"
 #include "input_parsing.h"
-#include "utilities.h"
+#include "trace.h"
+#include "variables.h"
+
+static char *scratch = NULL; // where expansions are built
+static size_t scratchSize = 0;
+static size_t scratchTop = 0; // where a nested expansion may start
+
+// runs the command of a substitution, set by set_substitution()
+static char *(*substituteHook)(const char *command, size_t len,
+                               size_t *outLen, void *data) = NULL;
+static void *substituteData = NULL;
+
+static int quiet = 0;  // Boolean for syntax errors not being reported
+static int failed = 0; // Boolean for a syntax error since quiet was set
 
 /**
- * Reads a line of input from the user character by character, checking
- * for '$$' variable expansion along the way.
- * 
- * @param pidstr The current process ID as a string
- * @return The input divided up into a struct of arguments
+ * Prompts for and reads one line from the given reader, through the
+ * line editor when the reader is a terminal.
+ *
+ * @param reader The pointer to the LineReader supplying input
+ * @param prompt The prompt to print first, or NULL for none
+ * @param len Set to the length of the line
+ * @return The line, valid until the next read, or NULL at the end of
+ *         input
  */
-struct Input * 
-get_userinput()
+static char *
+prompt_line(struct LineReader *reader, const char *prompt, size_t *len)
 {
-    size_t buf_size = 64;
-    char *buf = malloc((buf_size));
-    char *pidstr = get_pidstr();
-    int count = 0;
-    char c;
-    char next;
-
-    printf(": ");
+  if (reader->terminal && prompt != NULL)
+  {
     fflush(stdout);
-    while (1)
+    return edit_line(reader, prompt, len);
+  }
+  if (prompt != NULL)
+  {
+    fputs(prompt, stdout);
+    fflush(stdout);
+  }
+  return read_line(reader, len);
+}
+
+/**
+ * Grows the scratch buffer that expansions are built in.
+ *
+ * @param size The number of bytes needed
+ */
+static void
+reserve_scratch(size_t size)
+{
+  if (size > scratchSize)
+  {
+    scratchSize = scratchSize ? scratchSize : 256;
+    while (scratchSize < size)
+    {
+      scratchSize *= 2;
+    }
+    scratch = realloc(scratch, scratchSize);
+  }
+}
+
+/**
+ * Appends bytes to the scratch buffer.
+ *
+ * @param used The number of bytes in the buffer, updated
+ * @param text The bytes to append
+ * @param len The number of bytes
+ */
+static void
+append_scratch(size_t *used, const char *text, size_t len)
+{
+  reserve_scratch(*used + len + 1);
+  if (len > 0)
+  {
+    memcpy(scratch + *used, text, len);
+  }
+  *used += len;
+}
+
+/**
+ * Sets the function that runs the command of a "$(...)" substitution
+ * and returns its output, with trailing newlines removed, in a buffer
+ * the caller frees. Without one, substitutions expand to nothing.
+ *
+ * @param run The function, passed the command's text and length, set
+ *        to the output's length and given data
+ * @param data The pointer passed on to run
+ */
+void
+set_substitution(char *(*run)(const char *command, size_t len,
+                              size_t *outLen, void *data), void *data)
+{
+  substituteHook = run;
+  substituteData = data;
+}
+
+/**
+ * Runs the command of a "$(...)" and appends its output to the scratch
+ * buffer. The command may expand words of its own, so nested
+ * expansions are built above the bytes already used.
+ *
+ * @param p The '$'
+ * @param close The pointer past the closing ')'
+ * @param used The number of bytes in the scratch buffer, updated
+ */
+static void
+append_subst(const char *p, const char *close, size_t *used)
+{
+  size_t len = 0;
+  char *output = NULL;
+  if (substituteHook != NULL)
+  {
+    size_t top = scratchTop;
+    scratchTop = *used;
+    output = substituteHook(p + 2, close - 1 - (p + 2), &len,
+                            substituteData);
+    scratchTop = top;
+  }
+  append_scratch(used, output, len);
+  free(output);
+}
+
+/**
+ * Looks up the expansion of a '$' and what follows it: $NAME, ${NAME},
+ * one of the special parameters $$, $?, $!, $#, $* and $@, or a
+ * positional parameter, $1 to $9 or ${N}. A variable that is not set
+ * expands to nothing.
+ *
+ * @param p The '$'
+ * @param end One past the last byte of the text
+ * @param used Set to the number of bytes the expansion replaces
+ * @param len Set to the length of the value
+ * @return The value, or NULL if the '$' is an ordinary character
+ */
+static const char *
+expand_dollar(const char *p, const char *end, size_t *used, size_t *len)
+{
+  const char *name = p + 1;
+  int braced = name < end && *name == '{';
+  name += braced;
+  size_t nameLen = 0;
+  if (name < end && (*name == '$' || *name == '?' || *name == '!' ||
+                     *name == '#' || *name == '*' || *name == '@'))
+  {
+    nameLen = 1;
+  }
+  else if (name < end && *name >= '1' && *name <= '9')
+  { // only braces make a number of several digits
+    nameLen = 1;
+    while (braced && name + nameLen < end && name[nameLen] >= '0' &&
+           name[nameLen] <= '9')
+    {
+      ++nameLen;
+    }
+  }
+  else
+  {
+    nameLen = var_name_len(name, end - name);
+  }
+  if (nameLen == 0 ||
+      (braced && (name + nameLen == end || name[nameLen] != '}')))
+  {
+    return NULL;
+  }
+  *used = 1 + nameLen + 2 * braced;
+
+  const char *value = get_var(name, nameLen, len);
+  if (value == NULL)
+  {
+    *len = 0;
+    return "";
+  }
+  return value;
+}
+
+/**
+ * Expands the body of a here-document whose delimiter was not quoted.
+ * Variables and command substitutions are expanded as in words, and a
+ * backslash only escapes '$' and itself; everything else, quotes
+ * included, is kept.
+ *
+ * @param body The text of the body
+ * @param len The length of the body, updated to that of the result
+ * @param arena The pointer to the Arena for the result
+ * @return The pointer to the expanded body
+ */
+static char *
+expand_here(const char *body, size_t *len, struct Arena *arena)
+{
+  const char *end = body + *len;
+  const char *p = body;
+  size_t start = scratchTop;
+  size_t used = start;
+  reserve_scratch(used + 1);
+  while (p < end)
+  {
+    size_t skip;
+    size_t valueLen;
+    const char *value;
+    const char *close;
+    if (p[0] == '\\' && p + 1 < end && (p[1] == '$' || p[1] == '\\'))
+    {
+      append_scratch(&used, p + 1, 1);
+      p += 2;
+    }
+    else if (p[0] == '$' && p + 1 < end && p[1] == '(' &&
+             (close = skip_subst(p + 2, end)) != NULL)
+    {
+      append_subst(p, close, &used);
+      p = close;
+    }
+    else if (p[0] == '$' &&
+             (value = expand_dollar(p, end, &skip, &valueLen)) != NULL)
+    {
+      append_scratch(&used, value, valueLen);
+      p += skip;
+    }
+    else
+    {
+      append_scratch(&used, p++, 1);
+    }
+  }
+  *len = used - start;
+  return arena_strndup(arena, scratch + start, used - start);
+}
+
+/**
+ * Reads the bodies of the here-documents in the given pipeline, in
+ * order, from the lines following the command. Each body runs up to a
+ * line holding just its delimiter, or to the end of input with a
+ * warning, and is kept in the arena as the stage's here text.
+ *
+ * @param input The first command of the pipeline
+ * @param reader The pointer to the LineReader supplying input
+ * @param prompt The prompt for each line of a body, or NULL for none
+ * @param arena The pointer to the Arena for the bodies
+ */
+void
+read_here_docs(struct Input *input, struct LineReader *reader,
+               const char *prompt, struct Arena *arena)
+{
+  for (struct Input *stage = input; stage != NULL; stage = stage->next)
+  {
+    if (stage->hereEnd == NULL)
     {
-      c = fgetc(stdin);
-      if (c == '\n' || c == EOF)
+      continue;
+    }
+
+    // Lines only last until the next read, so collect them in a buffer
+    size_t endLen = strlen(stage->hereEnd);
+    size_t size = 0;
+    size_t capacity = 256;
+    char *body = malloc(capacity);
+    char *line;
+    size_t len;
+    while ((line = prompt_line(reader, prompt, &len)) != NULL &&
+           (len != endLen || memcmp(line, stage->hereEnd, len) != 0))
+    {
+      while (size + len + 1 > capacity)
       {
-        break;
+        capacity *= 2;
+        body = realloc(body, capacity);
       }
-      if (count == buf_size - 1)
+      memcpy(body + size, line, len);
+      size += len;
+      body[size++] = '\n';
+    }
+    if (line == NULL)
+    {
+      fprintf(stderr, "smallsh: here-document ended by end of input "
+              "(wanted '%s')\n", stage->hereEnd);
+      fflush(stderr);
+    }
+
+    if (stage->hereExpand)
+    {
+      stage->here = expand_here(body, &size, arena);
+    }
+    else
+    {
+      stage->here = arena_strndup(arena, body, size);
+    }
+    stage->hereLen = size;
+    stage->hereEnd = NULL;
+    free(body);
+  }
+}
+
+/**
+ * Prompts for and reads the next line of a command from the given
+ * reader, through the line editor when the reader is a terminal.
+ * When prompting, a line that refers to the history is replaced by the
+ * command it recalls, and the line is added to the history.
+ *
+ * @param reader The pointer to the LineReader supplying input
+ * @param prompt The prompt to print first, or NULL for none
+ * @param arena The pointer to the Arena for a recalled command
+ * @param len Set to the length of the line
+ * @return The line, valid until the next read, or NULL at the end of
+ *         input
+ */
+char *
+read_command_line(struct LineReader *reader, const char *prompt,
+                  struct Arena *arena, size_t *len)
+{
+  long long start = tracing ? trace_clock() : 0;
+  char *line = prompt_line(reader, prompt, len);
+  if (line == NULL)
+  {
+    return NULL;
+  }
+  if (tracing)
+  {
+    trace_event(TRACE_READ, start, 0, *len, NULL);
+  }
+
+  // Interactive lines can recall earlier commands and are remembered
+  if (prompt != NULL)
+  {
+    line = history_expand(line, len, arena);
+    if (line == NULL)
+    {
+      line = "";
+      *len = 0;
+    }
+    history_add(line, *len);
+  }
+  return line;
+}
+
+/**
+ * Finds the delimiters of the here-documents a command will read, the
+ * way get_input() and read_here_docs() see them: the last input
+ * redirection of each stage counts, and a command that runs nothing
+ * reads no bodies.
+ *
+ * @param tokens The tokens of the command
+ * @param ends Filled with the delimiters, in order
+ * @param arena The pointer to the Arena for unquoted delimiters
+ * @return The number of delimiters
+ */
+static int
+find_here_ends(const struct Token *tokens, char **ends,
+               struct Arena *arena)
+{
+  int count = 0;
+  int words = 0;
+  const struct Token *last = NULL; // last input redirection of the stage
+  for (int i = 0; ; ++i)
+  {
+    enum TokenType type = tokens[i].type;
+    if (type == TOKEN_END || type == TOKEN_PIPE)
+    {
+      if (words == 0)
       {
-        buf_size *= 2;
-        buf = realloc(buf, buf_size);
+        return 0;
       }
-      if (c == '$')
+      if (last != NULL && last->type == TOKEN_DLESS)
       {
-        if ((next = fgetc(stdin)) == '$')
+        const struct Token *word = last + 1;
+        if (word->flags & TOKEN_EXPAND)
         {
-          sprintf(buf + count, "%s", pidstr);
-          count += strlen(pidstr);
+          size_t len = strlen(word->text);
+          ends[count] = arena_alloc(arena, len + 1);
+          ends[count][unquote(ends[count], word->text, len)] = '\0';
         }
         else
         {
-            buf[count] = c;
-            if (next != '\n') buf[count++] = next;
-            else break;
+          ends[count] = word->text;
         }
+        ++count;
+      }
+      if (type == TOKEN_END)
+      {
+        return count;
+      }
+      words = 0;
+      last = NULL;
+    }
+    else if (type == TOKEN_ERROR)
+    {
+      return 0;
+    }
+    else if (type == TOKEN_WORD ||
+             (type == TOKEN_AMP && tokens[i + 1].type != TOKEN_END))
+    {
+      ++words;
+    }
+    else if (type != TOKEN_AMP)
+    {
+      if (tokens[i + 1].type != TOKEN_WORD)
+      {
+        return 0;
       }
-      else
+      if (type != TOKEN_GREAT)
       {
-        buf[count++] = c;
+        last = &tokens[i];
       }
+      ++i;
     }
-    buf[count] = '\0'; // terminate the buffer
+  }
+}
 
-    // Convert the buffer into tokens to populate the Input struct
-    char **tokens = tokenize_input(buf);
-    struct Input *input = get_input(tokens);
-    free(buf);
-    free(pidstr);
-    free(tokens);
-    return input;
+/**
+ * Reads the lines holding the bodies of a command's here-documents,
+ * which follow the line the command is on, so the command can be run
+ * later or more than once. The lines are kept as they are, delimiters
+ * included, for read_here_docs() to read when the command runs.
+ *
+ * @param reader The pointer to the LineReader supplying input
+ * @param prompt The prompt for each line of a body, or NULL for none
+ * @param tokens The tokens of the command
+ * @param arena The pointer to the Arena for the lines
+ * @return The lines, or NULL if the command reads no here-document
+ */
+char *
+read_here_text(struct LineReader *reader, const char *prompt,
+               const struct Token *tokens, struct Arena *arena)
+{
+  int numTokens = 0;
+  while (tokens[numTokens].type != TOKEN_END)
+  {
+    ++numTokens;
+  }
+  char **ends = arena_alloc(arena, (numTokens + 1) * sizeof(char *));
+  int numEnds = find_here_ends(tokens, ends, arena);
+  if (numEnds == 0)
+  {
+    return NULL;
+  }
+
+  // Lines only last until the next read, so collect them in a buffer
+  size_t size = 0;
+  size_t capacity = 256;
+  char *text = malloc(capacity);
+  for (int i = 0; i < numEnds; ++i)
+  {
+    size_t endLen = strlen(ends[i]);
+    char *line;
+    size_t len;
+    while ((line = prompt_line(reader, prompt, &len)) != NULL)
+    {
+      while (size + len + 2 > capacity)
+      {
+        capacity *= 2;
+        text = realloc(text, capacity);
+      }
+      memcpy(text + size, line, len);
+      size += len;
+      text[size++] = '\n';
+      if (len == endLen && !memcmp(line, ends[i], len))
+      {
+        break;
+      }
+    }
+  }
+  char *copy = arena_strndup(arena, text, size);
+  free(text);
+  return copy;
 }
 
 /**
- * Breaks the given buffer into an array of tokens using ' ' as the
- * delimiter.
+ * Breaks the given line into words and operators with the lexer. Word
+ * text is copied into the arena with quotes removed; the line itself is
+ * left untouched.
  *
- * @param buf The buffer to be split
- * @return The array of tokens
+ * @param line The line to be split
+ * @param len The length of the line
+ * @param arena The pointer to the Arena for the tokens and their text
+ * @return The array of tokens, ending with a TOKEN_END or TOKEN_ERROR
  */
-char ** 
-tokenize_input(char *buf)
+struct Token *
+tokenize_input(const char *line, size_t len, struct Arena *arena)
 {
-  size_t array_size = 4 * (sizeof(char*));
-  char **tokens = malloc(array_size);
+  // Every token but the last takes at least one byte of the line, and
+  // the words' text with their terminators fits in twice its length
+  struct Token *tokens = arena_alloc(arena, (len + 1) * sizeof(struct Token));
+  struct Lexer lexer;
+  init_lexer(&lexer, line, len, arena_alloc(arena, 2 * len + 1));
 
-  // Iterate over the buffer to generate tokens
   int count = 0;
-  tokens[count++] = strtok(buf, " ");
-  while (tokens[count - 1] != NULL)
+  while (next_token(&lexer, &tokens[count]) != TOKEN_END &&
+         tokens[count].type != TOKEN_ERROR)
+  {
+    ++count;
+  }
+  return tokens;
+}
+
+/**
+ * Measures a reference to all the positional parameters that makes a
+ * field of each: "$@" or "${@}" anywhere, or "$*" or "${*}" outside
+ * double quotes.
+ *
+ * @param p The '$'
+ * @param end One past the last byte of the text
+ * @param dquote Boolean for being inside double quotes
+ * @return The length of the reference, or 0 if there is none
+ */
+static size_t
+all_params(const char *p, const char *end, int dquote)
+{
+  size_t len = p + 2 < end && p[1] == '{' ? 4 : 2;
+  const char *c = p + len / 2;
+  if (p + len > end || (len == 4 && p[3] != '}') ||
+      (*c != '@' && (*c != '*' || dquote)))
+  {
+    return 0;
+  }
+  return len;
+}
+
+/**
+ * Expands a word the lexer kept raw because it contains a '$', removing
+ * its quotes at the same time. Variables and command substitutions are
+ * expanded outside single quotes; a '$' that starts no expansion is
+ * kept as it is. When splitting, the output of each unquoted
+ * substitution is split into fields at blanks and newlines, each
+ * positional parameter in "$@" is a field of its own, empty fields are
+ * dropped, and the fields are left one after another in the
+ * arena, each ending with a '\0'.
+ *
+ * @param raw The raw text of the word
+ * @param split Boolean for splitting the output of substitutions
+ * @param arena The pointer to the Arena for the result
+ * @param text Set to the first field of the expanded word
+ * @return The number of fields, always 1 when not splitting
+ */
+static int
+expand_word(const char *raw, int split, struct Arena *arena, char **text)
+{
+  const char *end = raw + strlen(raw);
+  size_t start = scratchTop;
+  size_t used = start;
+  int splitting = 0;
+  reserve_scratch(used + 1);
+
+  // Track which quotes we are inside of, copying one quoted part at a
+  // time with unquote() and expanding between them
+  const char *p = raw;
+  int dquote = 0;
+  while (p < end)
   {
-    if (count * sizeof(char*) == array_size - sizeof(char*))
-    { // resize the tokens array if needed
-      array_size *= 2;
-      tokens = realloc(tokens, array_size);
+    size_t skip;
+    size_t valueLen;
+    const char *value;
+    if (p[0] == '$' && p + 1 < end && p[1] == '(')
+    {
+      const char *close = skip_subst(p + 2, end);
+      size_t from = used;
+      append_subst(p, close, &used);
+      p = close;
+      if (split && !dquote)
+      { // mark where fields end; a '\0' cannot come from anywhere else
+        for (size_t k = from; k < used; ++k)
+        {
+          if (scratch[k] == ' ' || scratch[k] == '\t' || scratch[k] == '\n')
+          {
+            scratch[k] = '\0';
+          }
+        }
+        splitting = 1;
+      }
+    }
+    else if (split && *p == '$' && (skip = all_params(p, end, dquote)))
+    {
+      char **params = get_params();
+      for (int i = 0; params[i] != NULL; ++i)
+      {
+        if (i > 0)
+        { // a '\0' ends a field, as for substitutions
+          append_scratch(&used, "", 1);
+        }
+        append_scratch(&used, params[i], strlen(params[i]));
+      }
+      splitting = 1;
+      p += skip;
+    }
+    else if (*p == '$' && (value = expand_dollar(p, end, &skip, &valueLen)))
+    {
+      append_scratch(&used, value, valueLen);
+      p += skip;
+    }
+    else if (*p == '"')
+    {
+      dquote = !dquote;
+      ++p;
+    }
+    else if (*p == '\\' && p + 1 < end)
+    {
+      if (dquote && !strchr("$`\"\\", p[1]))
+      {
+        append_scratch(&used, p, 1);
+      }
+      append_scratch(&used, p + 1, 1);
+      p += 2;
+    }
+    else if (*p == '\'' && !dquote)
+    {
+      const char *close = strchr(p + 1, '\'');
+      reserve_scratch(used + (close - p) + 1);
+      used += unquote(scratch + used, p, close + 1 - p);
+      p = close + 1;
     }
-    tokens[count++] = strtok(NULL, " ");
+    else
+    {
+      append_scratch(&used, p++, 1);
+    }
+  }
+  if (!splitting)
+  {
+    *text = arena_strndup(arena, scratch + start, used - start);
+    return 1;
   }
 
-  return tokens;
+  // Copy the fields out in one pass, dropping the empty ones
+  char *out = arena_alloc(arena, used - start + 1);
+  int fields = 0;
+  *text = out;
+  for (size_t k = start; k < used;)
+  {
+    if (scratch[k] == '\0')
+    {
+      ++k;
+      continue;
+    }
+    while (k < used && scratch[k] != '\0')
+    {
+      *out++ = scratch[k++];
+    }
+    *out++ = '\0';
+    ++fields;
+  }
+  return fields;
 }
 
 /**
- * Initializes and returns a pointer to an Input struct from the given
- * user input.
+ * Allocates an Input struct with no arguments, redirections or
+ * following pipeline stage.
  *
- * @param tokens The tokenized user input as an array of strings
- * @return The pointer to the initialized Input struct
+ * @param arena The pointer to the Arena for the struct
+ * @return The pointer to the new Input struct
  */
 struct Input *
-get_input(char **tokens)
+init_input(struct Arena *arena)
 {
-  struct Input *input = malloc(sizeof(struct Input));
+  struct Input *input = arena_alloc(arena, sizeof(struct Input));
   input->args = NULL;
   input->numArgs = 0;
   input->infile = NULL;
   input->outfile = NULL;
+  input->here = NULL;
+  input->hereLen = 0;
+  input->hereEnd = NULL;
+  input->hereExpand = 0;
   input->background = 0;
+  input->timed = 0;
+  input->assign = 0;
+  input->words = NULL;
+  input->limits = NULL;
+  input->next = NULL;
+  return input;
+}
 
-  if (tokens[0] != NULL) // check for an empty input
+/**
+ * Reports a syntax error at the given token and returns an empty Input
+ * struct so the line is ignored.
+ *
+ * @param token The offending token, or NULL for the end of input
+ * @param arena The pointer to the Arena for the struct
+ * @return The pointer to an empty Input struct
+ */
+struct Input *
+syntax_error(const struct Token *token, struct Arena *arena)
+{
+  static const char *const names[] = {
+    [TOKEN_END] = "newline", [TOKEN_LESS] = "<", [TOKEN_DLESS] = "<<",
+    [TOKEN_TLESS] = "<<<", [TOKEN_GREAT] = ">",
+    [TOKEN_AMP] = "&", [TOKEN_PIPE] = "|", [TOKEN_SEMI] = ";",
+  };
+  failed = 1;
+  if (quiet)
+  {
+    return init_input(arena);
+  }
+  if (token == NULL)
+  {
+    fprintf(stderr, "syntax error: unexpected end of input\n");
+  }
+  else if (token->type == TOKEN_ERROR)
+  {
+    fprintf(stderr, "syntax error: unterminated quote or $(\n");
+  }
+  else
+  {
+    fprintf(stderr, "syntax error near '%s'\n",
+            token->text ? token->text : names[token->type]);
+  }
+  fflush(stderr);
+  return init_input(arena);
+}
+
+/**
+ * Allocates the args array for the pipeline stage starting at the given
+ * token, with room for every token up to the next '|'.
+ *
+ * @param tokens The tokens starting with the stage
+ * @param arena The pointer to the Arena for the array
+ * @param room Set to the number of arguments there is room for
+ * @return The pointer to the args array
+ */
+static char **
+init_args(struct Token *tokens, struct Arena *arena, int *room)
+{
+  int count = 0;
+  while (tokens[count].type != TOKEN_END && tokens[count].type != TOKEN_PIPE)
+  {
+    ++count;
+  }
+  *room = count;
+  return arena_alloc(arena, (count + 1) * sizeof(char*));
+}
+
+/**
+ * Adds a word to the arguments of a pipeline stage. A command
+ * substitution may split it into any number of fields, which point into
+ * the expanded text; the args array is moved to a larger one when the
+ * room counted for the stage's tokens runs out.
+ *
+ * @param stage The stage
+ * @param token The word token
+ * @param room The number of arguments there is room for, updated
+ * @param arena The pointer to the Arena for the text and array
+ */
+static void
+add_arg(struct Input *stage, struct Token *token, int *room,
+        struct Arena *arena)
+{
+  if (!(token->flags & TOKEN_EXPAND))
+  {
+    stage->args[stage->numArgs++] = token->text;
+    return;
+  }
+
+  // Assignments keep the whole output as their value
+  char *text;
+  int fields = expand_word(token->text, !(token->flags & TOKEN_ASSIGN),
+                           arena, &text);
+  if (fields > 1)
+  {
+    *room += fields - 1;
+    char **args = arena_alloc(arena, (*room + 1) * sizeof(char*));
+    memcpy(args, stage->args, stage->numArgs * sizeof(char*));
+    stage->args = args;
+  }
+  for (int k = 0; k < fields; ++k)
+  {
+    stage->args[stage->numArgs++] = text;
+    text += strlen(text) + 1;
+  }
+}
+
+/**
+ * Returns the text of a word token, expanding it first if needed.
+ *
+ * @param token The word token
+ * @param arena The pointer to the Arena for an expanded copy
+ * @return The text of the word
+ */
+char *
+word_text(struct Token *token, struct Arena *arena)
+{
+  char *text = token->text;
+  if (token->flags & TOKEN_EXPAND)
+  {
+    expand_word(token->text, 0, arena, &text);
+  }
+  return text;
+}
+
+/**
+ * Applies one of the input redirections '<', '<<' and '<<<' to a
+ * pipeline stage. A here-string's text is its word with a newline
+ * added; a here-document only notes its delimiter, unquoted but not
+ * expanded, until its body is read.
+ *
+ * @param stage The stage to redirect
+ * @param token The redirection operator, followed by its word
+ * @param arena The pointer to the Arena for copies of the text
+ */
+static void
+set_input(struct Input *stage, struct Token *token, struct Arena *arena)
+{
+  struct Token *word = token + 1;
+  stage->infile = NULL;
+  stage->here = NULL;
+  stage->hereLen = 0;
+  stage->hereEnd = NULL;
+  if (token->type == TOKEN_LESS)
+  {
+    stage->infile = word_text(word, arena);
+  }
+  else if (token->type == TOKEN_TLESS)
+  {
+    char *text = word_text(word, arena);
+    size_t len = strlen(text);
+    stage->here = arena_alloc(arena, len + 2);
+    memcpy(stage->here, text, len);
+    memcpy(stage->here + len, "\n", 2);
+    stage->hereLen = len + 1;
+  }
+  else if (word->flags & TOKEN_EXPAND)
+  { // the lexer kept the raw text, so only remove the quotes
+    size_t len = strlen(word->text);
+    stage->hereEnd = arena_alloc(arena, len + 1);
+    stage->hereEnd[unquote(stage->hereEnd, word->text, len)] = '\0';
+    stage->hereExpand = !(word->flags & TOKEN_QUOTED);
+  }
+  else
+  {
+    stage->hereEnd = word->text;
+    stage->hereExpand = !(word->flags & TOKEN_QUOTED);
+  }
+}
+
+/**
+ * Checks whether the given token is the unquoted word given.
+ *
+ * @param token The token to check
+ * @param word The word to compare with
+ * @return Boolean for a match
+ */
+static int
+is_word(const struct Token *token, const char *word)
+{
+  return token->type == TOKEN_WORD && token->flags == 0 &&
+         !strcmp(token->text, word);
+}
+
+/**
+ * Parses the options of a "run" prefix, each given as "--OPTION VALUE"
+ * or "--OPTION=VALUE", up to the first word not starting with "--" or
+ * just after a "--".
+ *
+ * @param tokens The tokenized user input
+ * @param i The index of the token after "run", updated to the first one
+ *        after the options
+ * @param arena The pointer to the Arena for the settings
+ * @return The pointer to the settings, or NULL if an option is invalid
+ *         or no command follows them
+ */
+static struct RunLimits *
+parse_run(struct Token *tokens, int *i, struct Arena *arena)
+{
+  struct RunLimits *limits = arena_alloc(arena, sizeof(struct RunLimits));
+  init_limits(limits);
+  int room = 0;
+  while (tokens[*i + room].type == TOKEN_WORD)
+  {
+    ++room;
+  }
+  // An "--OPTION=VALUE" word is listed as two, the option and the value
+  limits->words = arena_alloc(arena, (2 * room + 1) * sizeof(char*));
+
+  while (tokens[*i].type == TOKEN_WORD)
   {
-    size_t args_size = 4 * sizeof(char*);
-    input->args = malloc(args_size);
-    int i = 0; // tokens index
-    int j = 0; // args index
+    char *option = word_text(&tokens[*i], arena);
+    if (strncmp(option, "--", 2))
+    {
+      break;
+    }
+    ++*i;
+    if (option[2] == '\0')
+    {
+      break;
+    }
 
-    // Check each token to populate the Input struct
-    while (tokens[i] != NULL)
+    char *value = strchr(option, '=');
+    if (value != NULL)
     {
-      if (!strcmp(tokens[i], "<")) 
-      { // found a path for input redirection
-        input->infile = strdup(tokens[i + 1]);
-        i += 2;
-      }
-      else if (!strcmp(tokens[i], ">")) 
-      { // found a path for output redirection
-        input->outfile = strdup(tokens[i + 1]);
+      option = arena_strndup(arena, option, value - option);
+      ++value;
+    }
+    else if (tokens[*i].type == TOKEN_WORD)
+    {
+      value = word_text(&tokens[(*i)++], arena);
+    }
+    else
+    {
+      fprintf(stderr, "run: %s needs a value\n", option);
+      fflush(stderr);
+      return NULL;
+    }
+    if (set_limit(limits, option, value) == -1)
+    {
+      return NULL;
+    }
+    limits->words[limits->numWords++] = option;
+    limits->words[limits->numWords++] = value;
+  }
+  if (tokens[*i].type != TOKEN_WORD)
+  {
+    fprintf(stderr, "run: no command given\n" RUN_USAGE);
+    fflush(stderr);
+    return NULL;
+  }
+  return limits;
+}
+
+/**
+ * Checks whether the given tokens are a command made of nothing but
+ * NAME=value words, apart from redirections and a trailing '&'.
+ *
+ * @param tokens The tokens of the command
+ * @return 1 if they are, or 0
+ */
+static int
+is_assignment(struct Token *tokens)
+{
+  int words = 0;
+  for (int k = 0; tokens[k].type != TOKEN_END; ++k)
+  {
+    if (tokens[k].type == TOKEN_PIPE)
+    {
+      return 0;
+    }
+    if (tokens[k].type != TOKEN_WORD)
+    {
+      k += tokens[k].type != TOKEN_AMP; // skip a redirection's path
+    }
+    else if (!(tokens[k].flags & TOKEN_ASSIGN))
+    {
+      return 0;
+    }
+    else
+    {
+      ++words;
+    }
+  }
+  return words > 0;
+}
+
+/**
+ * Initializes and returns a pointer to an Input struct from the given
+ * tokens. A leading "time", "time -p" or "time -v" is a keyword
+ * applying to the whole pipeline rather than a command, as is a
+ * following "run" with its options for the scheduling and limits of the
+ * job's processes. A command whose words are all NAME=value assignments
+ * is marked as setting variables instead of being run, keeping its
+ * words' tokens so each value is expanded only once the ones before it
+ * are set. Of '<', '<<' and '<<<', the last one given sets a command's
+ * stdin; the body of a '<<' is read later by read_here_docs(). Commands
+ * separated by '|' become a pipeline, one Input struct per command
+ * linked through next; a trailing '&' applies to the whole pipeline and
+ * is recorded on the first command. Quoted operators are plain words.
+ * Arguments and paths point at the tokens' text rather than copies,
+ * except where a word is expanded.
+ *
+ * @param tokens The tokenized user input
+ * @param arena The pointer to the Arena for the structs
+ * @return The pointer to the initialized Input struct
+ */
+struct Input *
+get_input(struct Token *tokens, struct Arena *arena)
+{
+  struct Input *input = init_input(arena);
+  struct Input *stage = input;
+
+  if (tokens[0].type == TOKEN_END) // skip empty inputs and comments
+  {
+    return input;
+  }
+
+  int i = 0; // tokens index
+  int room;  // args the current stage has room for
+  if (is_word(&tokens[0], "time"))
+  {
+    input->timed = TIME_HUMAN;
+    ++i;
+    if (is_word(&tokens[1], "-p"))
+    {
+      input->timed = TIME_PORTABLE;
+      ++i;
+    }
+    else if (is_word(&tokens[1], "-v"))
+    {
+      input->timed = TIME_KEYVALUE;
+      ++i;
+    }
+  }
+  if (is_word(&tokens[i], "run"))
+  {
+    ++i;
+    input->limits = parse_run(tokens, &i, arena);
+    if (input->limits == NULL)
+    {
+      return init_input(arena);
+    }
+  }
+  stage->args = init_args(tokens + i, arena, &room);
+  if (is_assignment(tokens + i))
+  {
+    input->assign = 1;
+    input->words = arena_alloc(arena, (room + 1) * sizeof(struct Token *));
+  }
+
+  // Check each token to populate the Input struct
+  while (tokens[i].type != TOKEN_END)
+  {
+    switch (tokens[i].type)
+    {
+      case TOKEN_LESS:
+      case TOKEN_DLESS:
+      case TOKEN_TLESS:
+      case TOKEN_GREAT: // found a path for input or output redirection
+        if (tokens[i + 1].type != TOKEN_WORD)
+        {
+          return syntax_error(&tokens[i + 1], arena);
+        }
+        if (tokens[i].type == TOKEN_GREAT)
+        {
+          stage->outfile = word_text(&tokens[i + 1], arena);
+        }
+        else
+        { // the last input redirection wins
+          set_input(stage, &tokens[i], arena);
+        }
         i += 2;
-      }
-      else if (!strcmp(tokens[i], "&") && tokens[i + 1] == NULL)
-      { // found a "&" argument at the end
+        break;
+
+      case TOKEN_PIPE: // found the end of a pipeline stage
+        stage->args[stage->numArgs] = NULL;
+        if (stage->numArgs == 0 || tokens[i + 1].type == TOKEN_END)
+        {
+          return syntax_error(&tokens[i], arena);
+        }
+        stage->next = init_input(arena);
+        stage = stage->next;
+        stage->args = init_args(tokens + i + 1, arena, &room);
+        ++i;
+        break;
+
+      case TOKEN_AMP: // ends the command, so it can only come last
+        if (tokens[i + 1].type != TOKEN_END)
+        {
+          return syntax_error(&tokens[i], arena);
+        }
         input->background = 1;
         ++i;
-      }
-      else
-      { // found a regular argument
-        if (j * sizeof(char*) == args_size - sizeof(char*))
-        { // resize the args array
-          args_size *= 2;
-          input->args = realloc(input->args, args_size);
+        break;
+
+      case TOKEN_ERROR:
+        return syntax_error(&tokens[i], arena);
+
+      default: // found a regular argument
+        if (input->assign)
+        {
+          input->words[stage->numArgs] = &tokens[i];
+          stage->args[stage->numArgs++] = tokens[i++].text;
+        }
+        else
+        {
+          add_arg(stage, &tokens[i++], &room, arena);
         }
-        input->args[j++] = strdup(tokens[i++]);
-      }
     }
-    input->numArgs = j;
-    input->args[j] = NULL; // terminate the args array
+  }
+  stage->args[stage->numArgs] = NULL; // terminate the args array
+  if (stage->numArgs == 0 && stage != input)
+  {
+    return syntax_error(&tokens[i], arena);
+  }
+  if (stage->numArgs == 0)
+  { // only redirections, '&' or "time"; nothing to run
+    input = init_input(arena);
   }
 
   return input;
 }
 
 /**
- * Frees the memory used by the given Input struct and its members.
+ * Parses the given tokens like get_input() without reporting syntax
+ * errors, e.g. to compile a line ahead of running it. The tokens must
+ * not need expanding and must not start with "run", whose options are
+ * only checked when the line runs.
  *
- * @param input The pointer to the Input struct
+ * @param tokens The tokenized user input
+ * @param arena The pointer to the Arena for the structs
+ * @return The pointer to the initialized Input struct, or NULL if the
+ *         line has a syntax error
  */
-void 
-cleanup_input(struct Input *input)
+struct Input *
+check_input(struct Token *tokens, struct Arena *arena)
+{
+  int wasQuiet = quiet;
+  int hadFailed = failed;
+  quiet = 1;
+  failed = 0;
+  struct Input *input = get_input(tokens, arena);
+  if (failed)
+  {
+    input = NULL;
+  }
+  quiet = wasQuiet;
+  failed = hadFailed;
+  return input;
+}
+
+/**
+ * Turns the reporting of syntax errors off or back on. Turning it off
+ * also forgets any earlier error, for syntax_failed().
+ *
+ * @param on Boolean for not reporting syntax errors
+ */
+void
+quiet_syntax(int on)
+{
+  quiet = on;
+  if (on)
+  {
+    failed = 0;
+  }
+}
+
+/**
+ * Checks whether a syntax error was found since reporting was turned
+ * off with quiet_syntax().
+ *
+ * @return Boolean for a syntax error
+ */
+int
+syntax_failed(void)
 {
-  if (input->args != NULL)
+  return failed;
+}
+
+/**
+ * Expands a list of words as arguments are, e.g. the words a for loop
+ * runs over.
+ *
+ * @param tokens The word tokens, ending with a TOKEN_END
+ * @param arena The pointer to the Arena for the words
+ * @return The '\0'-terminated array of words
+ */
+char **
+expand_words(struct Token *tokens, struct Arena *arena)
+{
+  struct Input *list = init_input(arena);
+  int room;
+  list->args = init_args(tokens, arena, &room);
+  for (int i = 0; tokens[i].type != TOKEN_END; ++i)
   {
-    for (int i = 0; i < input->numArgs; ++i) // free all args
+    add_arg(list, &tokens[i], &room, arena);
+  }
+  list->args[list->numArgs] = NULL;
+  return list->args;
+}
+
+/**
+ * Rebuilds a command line from the given Input struct, e.g. to show
+ * which command a background job is running.
+ *
+ * @param input The pointer to the first command of the Input
+ * @return The allocated command line
+ */
+char *
+format_input(struct Input *input)
+{
+  size_t len = 11; // room for "time -p ", " &" and the '\0'
+  if (input->limits != NULL)
+  {
+    len += 4; // "run "
+    for (int i = 0; i < input->limits->numWords; ++i)
     {
-      free(input->args[i]);
+      len += strlen(input->limits->words[i]) + 1;
     }
-    free(input->args); // free the args array
   }
-  if (input->infile != NULL)
+  for (struct Input *stage = input; stage != NULL; stage = stage->next)
+  {
+    for (int i = 0; i < stage->numArgs; ++i)
+    {
+      len += strlen(stage->args[i]) + 1;
+    }
+    len += stage->infile ? strlen(stage->infile) + 3 : 0;
+    len += stage->outfile ? strlen(stage->outfile) + 3 : 0;
+    len += 3; // room for " | "
+  }
+
+  char *line = malloc(len);
+  char *end = line;
+  *end = '\0';
+  if (input->timed)
+  {
+    end += sprintf(end, input->timed == TIME_PORTABLE ? "time -p " :
+                        input->timed == TIME_KEYVALUE ? "time -v " : "time ");
+  }
+  if (input->limits != NULL)
   {
-    free(input->infile); // free the infile string
+    end += sprintf(end, "run ");
+    for (int i = 0; i < input->limits->numWords; ++i)
+    {
+      end += sprintf(end, "%s ", input->limits->words[i]);
+    }
+  }
+  for (struct Input *stage = input; stage != NULL; stage = stage->next)
+  {
+    for (int i = 0; i < stage->numArgs; ++i)
+    {
+      end += sprintf(end, i ? " %s" : "%s", stage->args[i]);
+    }
+    if (stage->infile != NULL)
+    {
+      end += sprintf(end, " < %s", stage->infile);
+    }
+    if (stage->outfile != NULL)
+    {
+      end += sprintf(end, " > %s", stage->outfile);
+    }
+    if (stage->next != NULL)
+    {
+      end += sprintf(end, " | ");
+    }
   }
-  if (input->outfile != NULL)
+  if (input->background)
   {
-    free(input->outfile); // free the outfile string
+    sprintf(end, " &");
   }
-  free(input); // free the struct itself
+  return line;
 }
@@ -1,18 +1,52 @@
 #ifndef INPUT_PARSING_H
 #define INPUT_PARSING_H
 
+#include "arena.h"
+#include "lexer.h"
+#include "line_reader.h"
+#include "run_limits.h"
+
+#define TIME_HUMAN 1    // "time": one resource per line
+#define TIME_PORTABLE 2 // "time -p": real, user and sys as POSIX has them
+#define TIME_KEYVALUE 3 // "time -v": one line of key=value pairs
+
 struct Input // used to organize instances of user input
 {
   char **args;
   int numArgs;
   char *infile;
   char *outfile;
+  char *here;     // text of a here-document or here-string for stdin
+  size_t hereLen; // length of the text in here
+  char *hereEnd;  // delimiter of a here-document still to be read, or NULL
+  int hereExpand; // Boolean for expanding '$' in the here-document
   int background; // Boolean for background processes
+  int timed;      // TIME_* format to report the resources used in, or 0
+  int assign;     // Boolean for arguments that are all NAME=value
+  struct Token **words; // an assignment's unexpanded word tokens, or NULL
+  struct RunLimits *limits; // settings given with run, or NULL
+  struct Input *next; // next command of a pipeline, or NULL
 };
 
-struct Input * get_userinput();
-char ** tokenize_input(char *buf);
-struct Input * get_input(char **tokens);
-void cleanup_input(struct Input *input);
+char * read_command_line(struct LineReader *reader, const char *prompt,
+                         struct Arena *arena, size_t *len);
+char * read_here_text(struct LineReader *reader, const char *prompt,
+                      const struct Token *tokens, struct Arena *arena);
+struct Token * tokenize_input(const char *line, size_t len,
+                              struct Arena *arena);
+struct Input * init_input(struct Arena *arena);
+struct Input * get_input(struct Token *tokens, struct Arena *arena);
+struct Input * check_input(struct Token *tokens, struct Arena *arena);
+char * word_text(struct Token *token, struct Arena *arena);
+struct Input * syntax_error(const struct Token *token, struct Arena *arena);
+void quiet_syntax(int on);
+int syntax_failed(void);
+char ** expand_words(struct Token *tokens, struct Arena *arena);
+void read_here_docs(struct Input *input, struct LineReader *reader,
+                    const char *prompt, struct Arena *arena);
+char * format_input(struct Input *input);
+void set_substitution(char *(*run)(const char *command, size_t len,
+                                   size_t *outLen, void *data),
+                      void *data);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,301 @@
+/**
+ * A table of the jobs started by the shell including the functionality to:
+ * - add a job for the processes of a pipeline
+ * - find the job a process belongs to in constant time
+ * - remove a job once all of its processes are reaped
+ * - walk the live jobs in launch order
+ *
+ * Job records live in a slab of fixed-size chunks that is only ever
+ * extended, so records keep their address and finished records are
+ * recycled through a free list instead of being freed. Processes are
+ * mapped to their job by an open addressing hash keyed by PID.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "job_table.h"
+#include "utilities.h"
+
+/**
+ * Creates a new empty JobTable with one chunk of job records ready.
+ *
+ * @return A pointer to the new JobTable
+ */
+struct JobTable *
+init_jobs(void)
+{
+  struct JobTable *jobs = malloc(sizeof(struct JobTable));
+  jobs->chunks = NULL;
+  jobs->numChunks = 0;
+  jobs->freeJob = -1;
+  jobs->head = -1;
+  jobs->tail = -1;
+  jobs->size = 0;
+  jobs->capacity = 64;
+  jobs->slots = calloc(jobs->capacity, sizeof(struct PidSlot));
+  jobs->numPids = 0;
+  return jobs;
+}
+
+/**
+ * Returns the job record at the given position in the slab.
+ *
+ * @param jobs The pointer to the JobTable
+ * @param index The position of the record, or -1
+ * @return The pointer to the Job, or NULL for -1
+ */
+struct Job *
+get_job(struct JobTable *jobs, int index)
+{
+  if (index < 0)
+  {
+    return NULL;
+  }
+  return &jobs->chunks[index / JOB_CHUNK_SIZE][index % JOB_CHUNK_SIZE];
+}
+
+/**
+ * Adds another chunk of free job records to the slab.
+ *
+ * @param jobs The pointer to the JobTable
+ */
+static void
+grow_slab(struct JobTable *jobs)
+{
+  int n = jobs->numChunks++;
+  jobs->chunks = realloc(jobs->chunks, jobs->numChunks * sizeof(struct Job *));
+  jobs->chunks[n] = malloc(JOB_CHUNK_SIZE * sizeof(struct Job));
+
+  // Chain the new records onto the free list, lowest index first
+  for (int i = JOB_CHUNK_SIZE - 1; i >= 0; --i)
+  {
+    struct Job *job = &jobs->chunks[n][i];
+    job->index = n * JOB_CHUNK_SIZE + i;
+    job->next = jobs->freeJob;
+    jobs->freeJob = job->index;
+  }
+}
+
+/**
+ * Returns the home slot of the given PID in the hash.
+ */
+static size_t
+pid_home(struct JobTable *jobs, pid_t pid)
+{
+  return ((unsigned long)pid * 2654435761UL) & (jobs->capacity - 1);
+}
+
+/**
+ * Finds the slot holding the given PID, or the empty slot where it
+ * would be inserted.
+ */
+static size_t
+find_slot(struct JobTable *jobs, pid_t pid)
+{
+  size_t i = pid_home(jobs, pid);
+  while (jobs->slots[i].pid != 0 && jobs->slots[i].pid != pid)
+  {
+    i = (i + 1) & (jobs->capacity - 1);
+  }
+  return i;
+}
+
+/**
+ * Maps the given PID to the job at the given index, doubling the hash
+ * first if it would become more than half full.
+ */
+static void
+insert_pid(struct JobTable *jobs, pid_t pid, int job)
+{
+  if (2 * (jobs->numPids + 1) > jobs->capacity)
+  {
+    struct PidSlot *old = jobs->slots;
+    size_t oldCapacity = jobs->capacity;
+    jobs->capacity *= 2;
+    jobs->slots = calloc(jobs->capacity, sizeof(struct PidSlot));
+    for (size_t i = 0; i < oldCapacity; ++i)
+    {
+      if (old[i].pid != 0)
+      {
+        jobs->slots[find_slot(jobs, old[i].pid)] = old[i];
+      }
+    }
+    free(old);
+  }
+  size_t i = find_slot(jobs, pid);
+  jobs->slots[i].pid = pid;
+  jobs->slots[i].job = job;
+  jobs->numPids++;
+}
+
+/**
+ * Adds a job for the given processes of a pipeline to the end of the
+ * table. PIDs of -1, for commands that failed to start, are skipped.
+ *
+ * @param jobs The pointer to the JobTable
+ * @param command The command line that started the job, or NULL
+ * @param pids The PIDs of the pipeline's processes, first to last
+ * @param count The number of PIDs
+ * @param background Boolean for a job running in the background
+ * @return A pointer to the new Job
+ */
+struct Job *
+add_job(struct JobTable *jobs, const char *command, const pid_t *pids,
+        int count, int background)
+{
+  if (jobs->freeJob == -1)
+  {
+    grow_slab(jobs);
+  }
+  struct Job *job = get_job(jobs, jobs->freeJob);
+  jobs->freeJob = job->next;
+
+  job->pgid = -1;
+  job->lastPid = -1;
+  job->liveProcs = 0;
+  job->stoppedProcs = 0;
+  job->status = 0;
+  job->command = command ? strdup(command) : NULL;
+  job->background = background;
+  job->timed = 0;
+  memset(&job->usage, 0, sizeof(job->usage));
+  clock_gettime(CLOCK_MONOTONIC, &job->start);
+  for (int i = 0; i < count; ++i)
+  {
+    if (pids[i] == -1)
+    {
+      continue;
+    }
+    if (job->pgid == -1)
+    {
+      job->pgid = pids[i];
+    }
+    job->lastPid = pids[i];
+    job->liveProcs++;
+    insert_pid(jobs, pids[i], job->index);
+  }
+
+  // Link the job in at the end of the launch order
+  job->prev = jobs->tail;
+  job->next = -1;
+  if (jobs->tail == -1)
+  {
+    jobs->head = job->index;
+  }
+  else
+  {
+    get_job(jobs, jobs->tail)->next = job->index;
+  }
+  jobs->tail = job->index;
+  jobs->size++;
+  return job;
+}
+
+/**
+ * Finds the job the given process belongs to.
+ *
+ * @param jobs The pointer to the JobTable
+ * @param pid The PID of the process
+ * @return A pointer to the Job, or NULL if the PID is not in the table
+ */
+struct Job *
+find_job(struct JobTable *jobs, pid_t pid)
+{
+  size_t i = find_slot(jobs, pid);
+  if (jobs->slots[i].pid == 0)
+  {
+    return NULL;
+  }
+  return get_job(jobs, jobs->slots[i].job);
+}
+
+/**
+ * Removes the given PID from the table, e.g. once it has been reaped.
+ *
+ * @param jobs The pointer to the JobTable
+ * @param pid The PID of the process
+ */
+void
+forget_pid(struct JobTable *jobs, pid_t pid)
+{
+  size_t i = find_slot(jobs, pid);
+  if (jobs->slots[i].pid == 0)
+  {
+    return;
+  }
+  jobs->slots[i].pid = 0;
+  jobs->numPids--;
+
+  // Shift later entries of the probe run back into the hole
+  size_t mask = jobs->capacity - 1;
+  for (size_t j = (i + 1) & mask; jobs->slots[j].pid != 0; j = (j + 1) & mask)
+  {
+    size_t home = pid_home(jobs, jobs->slots[j].pid);
+    if (((j - home) & mask) >= ((j - i) & mask))
+    {
+      jobs->slots[i] = jobs->slots[j];
+      jobs->slots[j].pid = 0;
+      i = j;
+    }
+  }
+}
+
+/**
+ * Unlinks the given job from the table and returns its record to the
+ * free list. Its processes should already have been forgotten.
+ *
+ * @param jobs The pointer to the JobTable
+ * @param job The pointer to the Job to remove
+ */
+void
+remove_job(struct JobTable *jobs, struct Job *job)
+{
+  if (job->prev == -1)
+  {
+    jobs->head = job->next;
+  }
+  else
+  {
+    get_job(jobs, job->prev)->next = job->next;
+  }
+  if (job->next == -1)
+  {
+    jobs->tail = job->prev;
+  }
+  else
+  {
+    get_job(jobs, job->next)->prev = job->prev;
+  }
+  jobs->size--;
+
+  free(job->command);
+  job->command = NULL;
+  job->next = jobs->freeJob;
+  jobs->freeJob = job->index;
+}
+
+/**
+ * Frees the memory of the given JobTable, its records and the commands
+ * of any jobs still in it.
+ *
+ * @param jobs The pointer to the JobTable
+ */
+void
+cleanup_jobs(struct JobTable *jobs)
+{
+  for (struct Job *job = get_job(jobs, jobs->head); job != NULL;
+       job = get_job(jobs, job->next))
+  {
+    free(job->command);
+  }
+  for (int i = 0; i < jobs->numChunks; ++i)
+  {
+    free(jobs->chunks[i]);
+  }
+  free(jobs->chunks);
+  free(jobs->slots);
+  free(jobs);
+}
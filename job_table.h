@@ -0,0 +1,57 @@
+/* Header file for the table of jobs started by the shell */
+
+#ifndef JOB_TABLE_H
+#define JOB_TABLE_H
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define JOB_CHUNK_SIZE 256 // job records allocated at a time
+
+struct Job
+{
+  pid_t pgid;       // process group, led by the first process started
+  pid_t lastPid;    // last process of the pipeline, reported to the user
+  int liveProcs;    // processes not reaped yet
+  int stoppedProcs; // live processes stopped by a signal
+  int status;       // wait status of the last process
+  char *command;    // the command line that started the job, or NULL
+  int background;   // Boolean, false for the job the shell waits on
+  int timed;        // TIME_* format to report the usage in, or 0
+  struct timespec start;
+  struct rusage usage; // summed over the reaped processes, maxrss the max
+  int index;        // position of the record in the slab
+  int prev;         // neighbours in launch order, -1 at either end
+  int next;         // also links free records together
+};
+
+struct PidSlot
+{
+  pid_t pid; // 0 for an empty slot
+  int job;   // index of the job the process belongs to
+};
+
+struct JobTable
+{
+  struct Job **chunks;  // slab of job records, JOB_CHUNK_SIZE per chunk
+  int numChunks;
+  int freeJob;          // first free record, -1 if none
+  int head;             // oldest live job, -1 if none
+  int tail;             // newest live job, -1 if none
+  int size;             // number of live jobs
+  struct PidSlot *slots; // open addressing map from PID to job
+  size_t capacity;      // always a power of two
+  size_t numPids;
+};
+
+struct JobTable *init_jobs(void);
+struct Job *get_job(struct JobTable *jobs, int index);
+struct Job *add_job(struct JobTable *jobs, const char *command,
+                    const pid_t *pids, int count, int background);
+struct Job *find_job(struct JobTable *jobs, pid_t pid);
+void forget_pid(struct JobTable *jobs, pid_t pid);
+void remove_job(struct JobTable *jobs, struct Job *job);
+void cleanup_jobs(struct JobTable *jobs);
+
+#endif
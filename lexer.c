@@ -0,0 +1,425 @@
+/**
+ * Definitions for the command line lexer.
+ *
+ * The lexer splits a line into words and the operators <, <<, <<<, >, &,
+ * | and ; in a single pass, honouring single quotes, double quotes and
+ * backslash escapes. Runs of ordinary bytes are skipped a vector at a
+ * time: each block of 16 (SSE2) or 32 (AVX2) bytes is compared against
+ * every byte with a meaning to the lexer at once, with a table-driven
+ * scalar loop for the tail and for other targets. The line is never
+ * modified; word text is written to a separate output buffer and all
+ * state lives in struct Lexer, so any number of lexers can run at once.
+ */
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "lexer.h"
+
+/**
+ * Scalar class table: nonzero for the bytes that end a run of ordinary
+ * word characters.
+ */
+static const unsigned char special[256] = {
+  [' '] = 1, ['\t'] = 1, ['\''] = 1, ['"'] = 1, ['\\'] = 1,
+  ['$'] = 1, ['<'] = 1, ['>'] = 1, ['&'] = 1, ['|'] = 1, [';'] = 1,
+};
+
+#if defined(__SSE2__)
+/**
+ * Returns a bitmask with a bit set for each special byte of the 16-byte
+ * block at p.
+ */
+static unsigned
+special_mask16(const char *p)
+{
+  __m128i v = _mm_loadu_si128((const __m128i *)p);
+  __m128i m = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('$')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+  return (unsigned)_mm_movemask_epi8(m);
+}
+#endif
+
+#if defined(__AVX2__)
+/**
+ * Returns a bitmask with a bit set for each special byte of the 32-byte
+ * block at p.
+ */
+static unsigned
+special_mask32(const char *p)
+{
+  __m256i v = _mm256_loadu_si256((const __m256i *)p);
+  __m256i m = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('$')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+  return (unsigned)_mm256_movemask_epi8(m);
+}
+#endif
+
+/**
+ * Finds the first special byte at or after p.
+ *
+ * @param p The first byte to classify
+ * @param end One past the last byte of the line
+ * @return The pointer to the first special byte, or end if there is none
+ */
+static const char *
+scan_plain(const char *p, const char *end)
+{
+#if defined(__AVX2__)
+  for (; end - p >= 32; p += 32)
+  {
+    unsigned mask = special_mask32(p);
+    if (mask != 0)
+    {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  for (; end - p >= 16; p += 16)
+  {
+    unsigned mask = special_mask16(p);
+    if (mask != 0)
+    {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+  while (p < end && !special[(unsigned char)*p])
+  {
+    ++p;
+  }
+  return p;
+}
+
+/**
+ * Checks whether a word starts with a variable name and '=', with no
+ * quotes or escapes before the '='.
+ *
+ * @param p The first byte of the word
+ * @param end One past the last byte of the word
+ * @return Boolean for an assignment
+ */
+static int
+is_assignment(const char *p, const char *end)
+{
+  const char *name = p;
+  while (p < end && (*p == '_' || (*p >= 'a' && *p <= 'z') ||
+                     (*p >= 'A' && *p <= 'Z') ||
+                     (p > name && *p >= '0' && *p <= '9')))
+  {
+    ++p;
+  }
+  return p > name && p < end && *p == '=';
+}
+
+/**
+ * Finds the end of a command substitution, skipping over nested
+ * parentheses, quotes and escapes inside it.
+ *
+ * @param p The first byte after the "$("
+ * @param end One past the last byte of the line
+ * @return The pointer past the closing ')', or NULL if there is none
+ */
+const char *
+skip_subst(const char *p, const char *end)
+{
+  int depth = 1;
+  while (p < end)
+  {
+    char c = *p++;
+    if (c == '\\')
+    {
+      p += p < end;
+    }
+    else if (c == '\'')
+    {
+      p = memchr(p, '\'', end - p);
+      if (p == NULL)
+      {
+        return NULL;
+      }
+      ++p;
+    }
+    else if (c == '"')
+    {
+      while (p < end && *p != '"')
+      {
+        if (*p == '\\' && p + 1 < end)
+        {
+          p += 2;
+        }
+        else if (*p == '$' && p + 1 < end && p[1] == '(')
+        {
+          p = skip_subst(p + 2, end);
+          if (p == NULL)
+          {
+            return NULL;
+          }
+        }
+        else
+        {
+          ++p;
+        }
+      }
+      if (p == end)
+      {
+        return NULL;
+      }
+      ++p;
+    }
+    else if (c == '(')
+    {
+      ++depth;
+    }
+    else if (c == ')' && --depth == 0)
+    {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Prepares a lexer for the given line.
+ *
+ * @param lexer The pointer to the Lexer
+ * @param line The line to split; it is not modified
+ * @param len The length of the line
+ * @param out The buffer for word text, with room for len + 1 bytes plus
+ *        one more per word
+ */
+void
+init_lexer(struct Lexer *lexer, const char *line, size_t len, char *out)
+{
+  lexer->pos = line;
+  lexer->end = line + len;
+  lexer->out = out;
+}
+
+/**
+ * Reads the next token of the line. Word text is written to the
+ * lexer's output buffer with its quotes and escapes removed, unless the
+ * word has a '$' outside single quotes: then its raw text is kept and
+ * TOKEN_EXPAND set, so expansion can tell quoted from unquoted parts.
+ * A "$(...)" command substitution is kept whole inside its word.
+ * A word starting with NAME= before any quote is marked TOKEN_ASSIGN.
+ * A '#' at the start of a word begins a comment, which ends the line.
+ *
+ * @param lexer The pointer to the Lexer
+ * @param token Filled with the token that was read
+ * @return The type of the token
+ */
+enum TokenType
+next_token(struct Lexer *lexer, struct Token *token)
+{
+  const char *p = lexer->pos;
+  const char *end = lexer->end;
+  token->flags = 0;
+  token->text = NULL;
+
+  while (p < end && (*p == ' ' || *p == '\t'))
+  {
+    ++p;
+  }
+  if (p == end || *p == '#')
+  {
+    lexer->pos = end;
+    return token->type = TOKEN_END;
+  }
+
+  // Operators are single bytes, apart from runs of up to three '<'
+  lexer->pos = p + 1;
+  switch (*p)
+  {
+    case '<':
+      if (p + 1 == end || p[1] != '<')
+      {
+        return token->type = TOKEN_LESS;
+      }
+      if (p + 2 == end || p[2] != '<')
+      {
+        lexer->pos = p + 2;
+        return token->type = TOKEN_DLESS;
+      }
+      lexer->pos = p + 3;
+      return token->type = TOKEN_TLESS;
+    case '>': return token->type = TOKEN_GREAT;
+    case '&': return token->type = TOKEN_AMP;
+    case '|': return token->type = TOKEN_PIPE;
+    case ';': return token->type = TOKEN_SEMI;
+  }
+
+  // Find the end of the word, noting what it contains
+  const char *start = p;
+  int dollar = 0;
+  while ((p = scan_plain(p, end)) < end)
+  {
+    char c = *p;
+    if (c == ' ' || c == '\t' || c == '<' || c == '>' || c == '&' ||
+        c == '|' || c == ';')
+    {
+      break;
+    }
+    else if (c == '\\')
+    {
+      token->flags |= TOKEN_QUOTED;
+      p += (p + 1 < end) ? 2 : 1;
+    }
+    else if (c == '\'')
+    {
+      const char *close = memchr(p + 1, '\'', end - p - 1);
+      if (close == NULL)
+      {
+        lexer->pos = end;
+        return token->type = TOKEN_ERROR;
+      }
+      token->flags |= TOKEN_QUOTED;
+      p = close + 1;
+    }
+    else if (c == '"')
+    {
+      for (++p; p < end && *p != '"'; ++p)
+      {
+        if (*p == '\\' && p + 1 < end)
+        {
+          ++p;
+        }
+        else if (*p == '$')
+        {
+          dollar = 1;
+          if (p + 1 < end && p[1] == '(')
+          {
+            const char *close = skip_subst(p + 2, end);
+            if (close == NULL)
+            {
+              lexer->pos = end;
+              return token->type = TOKEN_ERROR;
+            }
+            p = close - 1;
+          }
+        }
+      }
+      if (p == end)
+      {
+        lexer->pos = end;
+        return token->type = TOKEN_ERROR;
+      }
+      token->flags |= TOKEN_QUOTED;
+      ++p;
+    }
+    else // '$'
+    {
+      dollar = 1;
+      if (p + 1 < end && p[1] == '(')
+      { // a command substitution is part of the word, spaces and all
+        p = skip_subst(p + 2, end);
+        if (p == NULL)
+        {
+          lexer->pos = end;
+          return token->type = TOKEN_ERROR;
+        }
+      }
+      else
+      {
+        ++p;
+      }
+    }
+  }
+  lexer->pos = p;
+
+  // Write out the word's text
+  size_t len = p - start;
+  token->text = lexer->out;
+  if (is_assignment(start, p))
+  {
+    token->flags |= TOKEN_ASSIGN;
+  }
+  if (dollar)
+  {
+    memcpy(lexer->out, start, len);
+    token->flags |= TOKEN_EXPAND;
+  }
+  else if (token->flags & TOKEN_QUOTED)
+  {
+    len = unquote(lexer->out, start, len);
+  }
+  else
+  {
+    memcpy(lexer->out, start, len);
+  }
+  lexer->out[len] = '\0';
+  lexer->out += len + 1;
+  return token->type = TOKEN_WORD;
+}
+
+/**
+ * Copies the raw text of a word with its quotes and escapes removed.
+ * Inside double quotes a backslash only escapes $, `, " and itself.
+ * Quotes are assumed to be balanced, as next_token() checks.
+ *
+ * @param dst The buffer for the result, at least len bytes long
+ * @param src The raw text of the word
+ * @param len The length of the raw text
+ * @return The length of the result
+ */
+size_t
+unquote(char *dst, const char *src, size_t len)
+{
+  const char *end = src + len;
+  char *out = dst;
+  while (src < end)
+  {
+    char c = *src++;
+    if (c == '\\' && src < end)
+    {
+      *out++ = *src++;
+    }
+    else if (c == '\'')
+    {
+      while (src < end && *src != '\'')
+      {
+        *out++ = *src++;
+      }
+      ++src;
+    }
+    else if (c == '"')
+    {
+      while (src < end && *src != '"')
+      {
+        if (*src == '\\' && src + 1 < end && strchr("$`\"\\", src[1]))
+        {
+          ++src;
+        }
+        *out++ = *src++;
+      }
+      ++src;
+    }
+    else
+    {
+      *out++ = c;
+    }
+  }
+  return out - dst;
+}
@@ -0,0 +1,46 @@
+/* Header file for the command line lexer */
+
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stddef.h>
+
+enum TokenType
+{
+  TOKEN_END,   // end of the line or start of a comment
+  TOKEN_WORD,
+  TOKEN_LESS,  // <
+  TOKEN_DLESS, // <<, a here-document
+  TOKEN_TLESS, // <<<, a here-string
+  TOKEN_GREAT, // >
+  TOKEN_AMP,   // &
+  TOKEN_PIPE,  // |
+  TOKEN_SEMI,  // ;
+  TOKEN_ERROR  // unterminated quote or command substitution
+};
+
+#define TOKEN_QUOTED 1 // the word had quotes or escapes in it
+#define TOKEN_EXPAND 2 // the word keeps its raw text for '$' expansion
+#define TOKEN_ASSIGN 4 // the word starts with an unquoted NAME=
+
+struct Token
+{
+  enum TokenType type;
+  int flags;
+  char *text; // '\0'-terminated word text, or NULL for operators
+};
+
+struct Lexer // state of one lexing pass, so passes can run side by side
+{
+  const char *pos; // next byte to read
+  const char *end; // one past the last byte of the line
+  char *out;       // where the next word's text is written
+};
+
+void init_lexer(struct Lexer *lexer, const char *line, size_t len,
+                char *out);
+enum TokenType next_token(struct Lexer *lexer, struct Token *token);
+size_t unquote(char *dst, const char *src, size_t len);
+const char * skip_subst(const char *p, const char *end);
+
+#endif
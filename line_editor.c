@@ -0,0 +1,753 @@
+/**
+ * Definitions for the line editor used when commands are typed at a
+ * terminal.
+ *
+ * While a line is edited the terminal is switched out of canonical mode
+ * and echo, and the editor draws the prompt and the line itself,
+ * scrolling it sideways when it is wider than the terminal. The
+ * terminal's own settings are back in place before the line is run.
+ * The usual keys work: arrows, Home and End, Backspace and Delete,
+ * Ctrl-A, E, B, F, K, U, W and L, Up and Down (or Ctrl-P and N) to step
+ * through the history, Ctrl-C to drop the line and Ctrl-D to end input
+ * on an empty one.
+ *
+ * Tab completes the word before the cursor: the first word of a command
+ * from the built-in commands and the executables on PATH, which come
+ * from the index the command hash keeps, and any other word, or one
+ * containing a '/', from the names in its directory. When several names
+ * match, Tab inserts what they have in common and a second Tab lists
+ * them.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "command_hash.h"
+#include "event_loop.h"
+#include "history.h"
+#include "line_editor.h"
+#include "shell_commands.h"
+
+#define CTRL_KEY(c) ((c) & 0x1f)
+#define KEY_UP 1000     // keys sent as escape sequences
+#define KEY_DOWN 1001
+#define KEY_LEFT 1002
+#define KEY_RIGHT 1003
+#define KEY_HOME 1004
+#define KEY_END 1005
+#define KEY_DELETE 1006
+
+struct Candidates // names a word can be completed to
+{
+  char **names;
+  size_t count;
+  size_t capacity;
+  const char *prefix; // of the word being completed
+  size_t prefixLen;
+};
+
+static char *buf = NULL;     // the line being edited
+static size_t capacity = 0;
+static size_t len = 0;
+static size_t pos = 0;       // of the cursor
+static const char *promptStr = "";
+static int outFd = STDOUT_FILENO;
+
+static unsigned char pending[256]; // bytes read but not handled yet
+static size_t pendingStart = 0;
+static size_t pendingEnd = 0;
+
+static int lastTab = 0;           // Boolean for the last key being Tab
+static unsigned long histPos = 0; // history entry shown, count for none
+static char *draft = NULL;        // the new line, while history is shown
+
+/**
+ * Writes the whole of a buffer to the terminal.
+ */
+static void
+put(const char *s, size_t n)
+{
+  while (n > 0)
+  {
+    ssize_t written = write(outFd, s, n);
+    if (written <= 0 && errno != EINTR)
+    {
+      return;
+    }
+    if (written > 0)
+    {
+      s += written;
+      n -= written;
+    }
+  }
+}
+
+/**
+ * Returns the width of the terminal in columns.
+ */
+static size_t
+term_width(void)
+{
+  struct winsize ws;
+  if (ioctl(outFd, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+  {
+    return 80;
+  }
+  return ws.ws_col;
+}
+
+/**
+ * Draws the prompt and the line again with the cursor in place, showing
+ * the part of the line around the cursor that fits on one row.
+ */
+static void
+refresh_line(void)
+{
+  size_t promptLen = strlen(promptStr);
+  size_t cols = term_width();
+  size_t room = cols > promptLen + 1 ? cols - promptLen - 1 : 1;
+  size_t first = pos >= room ? pos - room + 1 : 0;
+  size_t shown = len - first < room ? len - first : room;
+
+  char *out = malloc(promptLen + shown + 32);
+  size_t n = 0;
+  out[n++] = '\r';
+  memcpy(out + n, promptStr, promptLen);
+  n += promptLen;
+  memcpy(out + n, buf + first, shown);
+  n += shown;
+  n += sprintf(out + n, "\x1b[K\r");
+  if (promptLen + pos - first > 0)
+  {
+    n += sprintf(out + n, "\x1b[%zuC", promptLen + pos - first);
+  }
+  put(out, n);
+  free(out);
+}
+
+/**
+ * Shows the prompt and the line again after background jobs were
+ * reported; set as the event loop's redraw function.
+ */
+static void
+redraw(void)
+{
+  refresh_line();
+}
+
+/**
+ * Makes room in the line for the given number of bytes more.
+ */
+static void
+reserve(size_t more)
+{
+  if (len + more + 1 > capacity)
+  {
+    capacity = (len + more + 1) * 2;
+    buf = realloc(buf, capacity);
+  }
+}
+
+/**
+ * Inserts text at the cursor and moves the cursor past it.
+ *
+ * @param s The text
+ * @param n The length of the text
+ */
+static void
+insert(const char *s, size_t n)
+{
+  reserve(n);
+  memmove(buf + pos + n, buf + pos, len - pos);
+  memcpy(buf + pos, s, n);
+  len += n;
+  pos += n;
+}
+
+/**
+ * Deletes the text between two positions of the line.
+ *
+ * @param from The first byte to delete
+ * @param to One past the last byte to delete
+ */
+static void
+delete_range(size_t from, size_t to)
+{
+  memmove(buf + from, buf + to, len - to);
+  len -= to - from;
+  pos = from;
+}
+
+/**
+ * Replaces the line with a history entry, or with the line that was
+ * being typed when the history is stepped past its end.
+ *
+ * @param i The history entry, or history_count() for the new line
+ */
+static void
+show_history(unsigned long i)
+{
+  unsigned long count = history_count();
+  if (histPos == count)
+  {
+    free(draft); // keep the new line to come back to
+    draft = strndup(buf, len);
+  }
+  histPos = i;
+  const char *line = draft;
+  size_t n = draft != NULL ? strlen(draft) : 0;
+  if (i < count)
+  {
+    line = history_get(i, &n);
+  }
+  len = pos = 0;
+  insert(line != NULL ? line : "", n);
+}
+
+/**
+ * Returns the next byte of input, reading more from the terminal when
+ * none is pending. The event loop reports background jobs meanwhile.
+ *
+ * @param reader The pointer to the LineReader for the terminal
+ * @return The byte, or -1 at the end of input
+ */
+static int
+next_byte(struct LineReader *reader)
+{
+  while (pendingStart == pendingEnd)
+  {
+    if (reader->wait_input != NULL)
+    {
+      reader->wait_input(reader->fd);
+    }
+    ssize_t n = read(reader->fd, pending, sizeof(pending));
+    if (n == -1 && errno == EINTR)
+    {
+      refresh_line(); // e.g. the SIGTSTP handler printed a message
+      continue;
+    }
+    if (n <= 0)
+    {
+      return -1;
+    }
+    pendingStart = 0;
+    pendingEnd = n;
+  }
+  return pending[pendingStart++];
+}
+
+/**
+ * Reads a key, decoding the escape sequences of the arrow keys, Home,
+ * End and Delete.
+ *
+ * @param reader The pointer to the LineReader for the terminal
+ * @return The byte or KEY_* code, 0 for an unknown sequence, or -1 at
+ *         the end of input
+ */
+static int
+read_key(struct LineReader *reader)
+{
+  int c = next_byte(reader);
+  if (c != '\x1b')
+  {
+    return c;
+  }
+  int kind = next_byte(reader);
+  if (kind != '[' && kind != 'O')
+  {
+    return kind == -1 ? -1 : 0;
+  }
+  int code = next_byte(reader);
+  int number = 0;
+  while (code >= '0' && code <= '9')
+  {
+    number = number * 10 + code - '0';
+    code = next_byte(reader);
+  }
+  switch (code)
+  {
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return KEY_RIGHT;
+    case 'D': return KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+    case '~':
+      switch (number)
+      {
+        case 1: case 7: return KEY_HOME;
+        case 4: case 8: return KEY_END;
+        case 3: return KEY_DELETE;
+      }
+      return 0;
+    case -1: return -1;
+  }
+  return 0;
+}
+
+/**
+ * Checks whether a byte ends a word for completion when not escaped.
+ */
+static int
+is_separator(char c)
+{
+  return c == ' ' || c == '\t' || c == '|' || c == '<' || c == '>' ||
+         c == '&' || c == ';';
+}
+
+/**
+ * Checks whether a byte must be escaped with a backslash in a word.
+ */
+static int
+needs_escape(char c)
+{
+  return is_separator(c) || c == '\\' || c == '\'' || c == '"' || c == '$';
+}
+
+/**
+ * Adds a name to the candidates if it starts with their prefix, with a
+ * '/' appended if it is a directory.
+ *
+ * @param name The name
+ * @param cands The pointer to the Candidates
+ * @param isDir Boolean for the name being a directory
+ */
+static void
+add_candidate(const char *name, struct Candidates *cands, int isDir)
+{
+  if (strncmp(name, cands->prefix, cands->prefixLen))
+  {
+    return;
+  }
+  if (cands->count == cands->capacity)
+  {
+    cands->capacity = cands->capacity ? cands->capacity * 2 : 32;
+    cands->names = realloc(cands->names, cands->capacity * sizeof(char *));
+  }
+  char *copy = malloc(strlen(name) + 2);
+  strcpy(copy, name);
+  if (isDir)
+  {
+    strcat(copy, "/");
+  }
+  cands->names[cands->count++] = copy;
+}
+
+/**
+ * Adds a command name to the candidates; called by hash_complete().
+ */
+static void
+add_command(const char *name, void *data)
+{
+  add_candidate(name, data, 0);
+}
+
+/**
+ * Adds the names in a directory that start with a prefix.
+ *
+ * @param dirName The directory, "" for the current one
+ * @param cands The pointer to the Candidates, holding the prefix
+ */
+static void
+add_files(const char *dirName, struct Candidates *cands)
+{
+  DIR *dir = opendir(*dirName ? dirName : ".");
+  if (dir == NULL)
+  {
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    const char *name = entry->d_name;
+    if ((name[0] == '.' && cands->prefix[0] != '.') || !strcmp(name, ".") ||
+        !strcmp(name, "..") || strncmp(name, cands->prefix, cands->prefixLen))
+    {
+      continue;
+    }
+    int isDir = entry->d_type == DT_DIR;
+    struct stat sb;
+    if ((entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) &&
+        !fstatat(dirfd(dir), name, &sb, 0))
+    {
+      isDir = S_ISDIR(sb.st_mode);
+    }
+    add_candidate(name, cands, isDir);
+  }
+  closedir(dir);
+}
+
+/**
+ * Compares two names for qsort().
+ */
+static int
+compare_names(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Lists the candidates in columns below the line, then draws the line
+ * again.
+ *
+ * @param cands The pointer to the Candidates
+ */
+static void
+list_candidates(const struct Candidates *cands)
+{
+  size_t widest = 0;
+  for (size_t i = 0; i < cands->count; ++i)
+  {
+    size_t n = strlen(cands->names[i]);
+    widest = n > widest ? n : widest;
+  }
+  size_t colWidth = widest + 2;
+  size_t cols = term_width() / colWidth;
+  cols = cols > 0 ? cols : 1;
+  size_t rows = (cands->count + cols - 1) / cols;
+
+  put("\r\n", 2);
+  char *row = malloc(cols * colWidth + 3);
+  for (size_t r = 0; r < rows; ++r)
+  {
+    size_t n = 0;
+    for (size_t c = 0; c < cols && c * rows + r < cands->count; ++c)
+    {
+      const char *name = cands->names[c * rows + r];
+      n += sprintf(row + n, "%-*s", (int)colWidth, name);
+    }
+    while (n > 0 && row[n - 1] == ' ')
+    {
+      --n;
+    }
+    memcpy(row + n, "\r\n", 2);
+    put(row, n + 2);
+  }
+  free(row);
+  refresh_line();
+}
+
+/**
+ * Completes the word before the cursor, inserting the rest of the only
+ * match, or what all matches have in common. With nothing to insert, a
+ * second Tab in a row lists the matches and otherwise the bell rings.
+ */
+static void
+complete(void)
+{
+  // Find the start of the word, taking escaped separators as part of it
+  size_t start = pos;
+  while (start > 0 && (!is_separator(buf[start - 1]) ||
+                       (start > 1 && buf[start - 2] == '\\')))
+  {
+    --start;
+  }
+  char *word = malloc(pos - start + 1);
+  size_t wordLen = 0;
+  for (size_t i = start; i < pos; ++i)
+  {
+    if (buf[i] == '\\' && i + 1 < pos)
+    {
+      ++i;
+    }
+    else if (buf[i] == '\'' || buf[i] == '"')
+    {
+      continue;
+    }
+    word[wordLen++] = buf[i];
+  }
+  word[wordLen] = '\0';
+
+  // A command is expected at the start of the line or after '|', ';'
+  // or '&'
+  size_t before = start;
+  while (before > 0 && (buf[before - 1] == ' ' || buf[before - 1] == '\t'))
+  {
+    --before;
+  }
+  int command = (before == 0 || buf[before - 1] == '|' ||
+                 buf[before - 1] == ';' || buf[before - 1] == '&') &&
+                strchr(word, '/') == NULL;
+
+  struct Candidates cands = {NULL, 0, 0, word, wordLen};
+  char *slash = strrchr(word, '/');
+  if (command)
+  {
+    const char *name;
+    for (size_t i = 0; (name = builtin_name(i)) != NULL; ++i)
+    {
+      add_candidate(name, &cands, 0);
+    }
+    hash_complete(word, add_command, &cands);
+  }
+  else
+  {
+    char *dirName = strndup(word, slash != NULL ? slash - word + 1 : 0);
+    cands.prefix = slash != NULL ? slash + 1 : word;
+    cands.prefixLen = strlen(cands.prefix);
+    add_files(dirName, &cands);
+    free(dirName);
+  }
+  if (cands.count > 0)
+  { // names is NULL when nothing matches
+    qsort(cands.names, cands.count, sizeof(char *), compare_names);
+  }
+  size_t unique = 0;
+  for (size_t i = 0; i < cands.count; ++i)
+  {
+    if (unique > 0 && !strcmp(cands.names[i], cands.names[unique - 1]))
+    {
+      free(cands.names[i]); // the same command in two PATH directories
+    }
+    else
+    {
+      cands.names[unique++] = cands.names[i];
+    }
+  }
+  cands.count = unique;
+
+  // Insert what every match has beyond the prefix, escaped
+  size_t common = 0;
+  if (cands.count > 0)
+  {
+    common = strlen(cands.names[0]);
+    for (size_t i = 1; i < cands.count; ++i)
+    {
+      size_t n = 0;
+      while (n < common && cands.names[i][n] == cands.names[0][n])
+      {
+        ++n;
+      }
+      common = n;
+    }
+  }
+  if (common > cands.prefixLen)
+  {
+    for (size_t i = cands.prefixLen; i < common; ++i)
+    {
+      char c = cands.names[0][i];
+      if (needs_escape(c))
+      {
+        insert("\\", 1);
+      }
+      insert(&c, 1);
+    }
+    if (cands.count == 1 && cands.names[0][common - 1] != '/')
+    {
+      insert(" ", 1);
+    }
+    refresh_line();
+  }
+  else if (cands.count == 1 && cands.names[0][common - 1] != '/')
+  {
+    insert(" ", 1); // already complete
+    refresh_line();
+  }
+  else if (cands.count > 1 && lastTab)
+  {
+    list_candidates(&cands);
+  }
+  else
+  {
+    put("\a", 1);
+  }
+
+  for (size_t i = 0; i < cands.count; ++i)
+  {
+    free(cands.names[i]);
+  }
+  free(cands.names);
+  free(word);
+}
+
+/**
+ * Reads a line from a terminal, letting it be edited as it is typed.
+ * The terminal is set up for editing only while the line is read.
+ *
+ * @param reader The pointer to the LineReader for the terminal
+ * @param prompt The prompt to show
+ * @param length Set to the length of the line
+ * @return The line, valid until the next call, or NULL at the end of
+ *         input
+ */
+char *
+edit_line(struct LineReader *reader, const char *prompt, size_t *length)
+{
+  struct termios saved, raw;
+  if (tcgetattr(reader->fd, &saved) == -1)
+  {
+    put(prompt, strlen(prompt));
+    return read_line(reader, length);
+  }
+  raw = saved;
+  raw.c_lflag &= ~(ICANON | ECHO | IEXTEN);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  raw.c_cc[VINTR] = _POSIX_VDISABLE; // Ctrl-C drops the line instead
+  tcsetattr(reader->fd, TCSANOW, &raw);
+  set_redraw(redraw);
+
+  promptStr = prompt;
+  len = pos = 0;
+  reserve(0);
+  histPos = history_count();
+  lastTab = 0;
+  refresh_line();
+
+  int done = 0;
+  int eof = 0;
+  while (!done)
+  {
+    int key = read_key(reader);
+    int tab = 0;
+    switch (key)
+    {
+      case -1:
+        eof = len == 0;
+        done = 1;
+        break;
+      case '\r':
+      case '\n':
+        done = 1;
+        break;
+      case '\t':
+        complete();
+        tab = 1;
+        break;
+      case CTRL_KEY('C'):
+        put("^C\r\n", 4);
+        len = pos = 0;
+        histPos = history_count();
+        break;
+      case CTRL_KEY('D'):
+        if (len == 0)
+        {
+          eof = done = 1;
+        }
+        else if (pos < len)
+        {
+          delete_range(pos, pos + 1);
+        }
+        break;
+      case KEY_DELETE:
+        if (pos < len)
+        {
+          delete_range(pos, pos + 1);
+        }
+        break;
+      case 127:
+      case CTRL_KEY('H'):
+        if (pos > 0)
+        {
+          delete_range(pos - 1, pos);
+        }
+        break;
+      case KEY_LEFT:
+      case CTRL_KEY('B'):
+        pos -= pos > 0;
+        break;
+      case KEY_RIGHT:
+      case CTRL_KEY('F'):
+        pos += pos < len;
+        break;
+      case KEY_HOME:
+      case CTRL_KEY('A'):
+        pos = 0;
+        break;
+      case KEY_END:
+      case CTRL_KEY('E'):
+        pos = len;
+        break;
+      case CTRL_KEY('K'):
+        len = pos;
+        break;
+      case CTRL_KEY('U'):
+        delete_range(0, pos);
+        break;
+      case CTRL_KEY('W'):
+      {
+        size_t start = pos;
+        while (start > 0 && buf[start - 1] == ' ')
+        {
+          --start;
+        }
+        while (start > 0 && buf[start - 1] != ' ')
+        {
+          --start;
+        }
+        delete_range(start, pos);
+        break;
+      }
+      case CTRL_KEY('L'):
+        put("\x1b[H\x1b[2J", 7);
+        break;
+      case KEY_UP:
+      case CTRL_KEY('P'):
+        if (histPos > 0)
+        {
+          show_history(histPos - 1);
+        }
+        break;
+      case KEY_DOWN:
+      case CTRL_KEY('N'):
+        if (histPos < history_count())
+        {
+          show_history(histPos + 1);
+        }
+        break;
+      default:
+        if (key >= ' ' && key < 127)
+        {
+          char c = key;
+          insert(&c, 1);
+        }
+        else if (key >= 128 && key < 256)
+        {
+          char c = key; // part of a UTF-8 character
+          insert(&c, 1);
+        }
+        break;
+    }
+    lastTab = tab;
+    if (!done && !tab)
+    {
+      refresh_line();
+    }
+  }
+
+  pos = len;
+  refresh_line();
+  put("\r\n", 2);
+  set_redraw(NULL);
+  tcsetattr(reader->fd, TCSANOW, &saved);
+  free(draft);
+  draft = NULL;
+  if (eof)
+  {
+    return NULL;
+  }
+  buf[len] = '\0';
+  *length = len;
+  return buf;
+}
+
+/**
+ * Frees the line editor's buffers.
+ */
+void
+cleanup_editor(void)
+{
+  free(buf);
+  free(draft);
+  buf = draft = NULL;
+  capacity = len = pos = 0;
+}
@@ -0,0 +1,13 @@
+/* Header file for the line editor used on terminals */
+
+#ifndef LINE_EDITOR_H
+#define LINE_EDITOR_H
+
+#include <stddef.h>
+
+#include "line_reader.h"
+
+char * edit_line(struct LineReader *reader, const char *prompt, size_t *len);
+void cleanup_editor(void);
+
+#endif
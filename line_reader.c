@@ -0,0 +1,175 @@
+/**
+ * Definitions for the block-buffered line reader.
+ *
+ * Input is pulled from the file descriptor in large blocks with read(2)
+ * into a single reusable buffer. Lines are located with memchr and
+ * handed out as spans pointing into that buffer, so no byte is copied
+ * on its way to the tokenizer. The unconsumed tail is moved back to the
+ * front of the buffer before each refill and the buffer only grows when
+ * a single line is longer than its capacity.
+ */
+
+#define _POSIX_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "line_reader.h"
+
+#define READER_BLOCK_SIZE (64 * 1024)
+
+/**
+ * Creates a new LineReader for the given file descriptor.
+ *
+ * @param fd The file descriptor to read lines from
+ * @return A pointer to the new LineReader
+ */
+struct LineReader *
+init_reader(int fd)
+{
+  struct LineReader *reader = malloc(sizeof(struct LineReader));
+  reader->fd = fd;
+  reader->size = READER_BLOCK_SIZE;
+  reader->buf = malloc(reader->size);
+  reader->start = 0;
+  reader->end = 0;
+  reader->scan = 0;
+  reader->eof = 0;
+  reader->wait_input = NULL;
+  reader->terminal = 0;
+  return reader;
+}
+
+/**
+ * Creates a new LineReader that hands out the lines of the given string
+ * instead of reading from a file descriptor.
+ *
+ * @param str The string holding the input lines
+ * @return A pointer to the new LineReader
+ */
+struct LineReader *
+init_reader_str(const char *str)
+{
+  size_t len = strlen(str);
+  struct LineReader *reader = malloc(sizeof(struct LineReader));
+  reader->fd = -1;
+  reader->size = len + 1;
+  reader->buf = malloc(reader->size);
+  memcpy(reader->buf, str, len);
+  reader->start = 0;
+  reader->end = len;
+  reader->scan = 0;
+  reader->eof = 1; // everything is already buffered
+  reader->wait_input = NULL;
+  reader->terminal = 0;
+  return reader;
+}
+
+/**
+ * Makes room for at least one more block at the end of the buffer by
+ * moving the unconsumed bytes to the front, growing the buffer if the
+ * pending line already fills most of it.
+ *
+ * @param reader The pointer to the LineReader
+ */
+static void
+make_room(struct LineReader *reader)
+{
+  size_t pending = reader->end - reader->start;
+  if (reader->start > 0)
+  {
+    memmove(reader->buf, reader->buf + reader->start, pending);
+    reader->scan -= reader->start;
+    reader->start = 0;
+    reader->end = pending;
+  }
+  if (reader->size - reader->end < READER_BLOCK_SIZE / 2)
+  { // the pending line is too long for the buffer
+    reader->size *= 2;
+    reader->buf = realloc(reader->buf, reader->size);
+  }
+}
+
+/**
+ * Reads the next line from the reader. The returned line points into
+ * the reader's buffer with its newline replaced by '\0' and stays valid
+ * until the next call. A final line without a newline is returned as is.
+ *
+ * @param reader The pointer to the LineReader
+ * @param len Set to the length of the returned line if not NULL
+ * @return The pointer to the line, or NULL at the end of input
+ */
+char *
+read_line(struct LineReader *reader, size_t *len)
+{
+  while (1)
+  {
+    char *nl = memchr(reader->buf + reader->scan, '\n',
+                      reader->end - reader->scan);
+    if (nl != NULL || (reader->eof && reader->start < reader->end))
+    { // found a complete line, or the unterminated last one
+      char *line = reader->buf + reader->start;
+      reader->start = (nl != NULL) ? (size_t)(nl - reader->buf) + 1
+                                   : reader->end;
+      reader->scan = reader->start;
+      if (nl == NULL)
+      { // the spare byte at the end of the buffer holds the '\0'
+        nl = reader->buf + reader->end;
+      }
+      *nl = '\0';
+      if (len != NULL)
+      {
+        *len = nl - line;
+      }
+      return line;
+    }
+    if (reader->eof)
+    {
+      return NULL;
+    }
+
+    // No newline buffered yet; pull in the next block
+    reader->scan = reader->end;
+    make_room(reader);
+    if (reader->wait_input != NULL)
+    {
+      reader->wait_input(reader->fd);
+    }
+    ssize_t n = read(reader->fd, reader->buf + reader->end,
+                     reader->size - reader->end - 1);
+    if (n == -1 && errno == EINTR)
+    {
+      continue; // interrupted by a signal handler, try again
+    }
+    if (n == -1)
+    {
+      perror("read()");
+      fflush(stderr);
+    }
+    if (n <= 0)
+    {
+      reader->eof = 1;
+    }
+    else
+    {
+      reader->end += n;
+    }
+  }
+}
+
+/**
+ * Frees the memory used by the given LineReader. The file descriptor is
+ * left open.
+ *
+ * @param reader The pointer to the LineReader
+ */
+void
+cleanup_reader(struct LineReader *reader)
+{
+  free(reader->buf);
+  free(reader);
+}
@@ -0,0 +1,24 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <stddef.h>
+
+struct LineReader // block-buffered source of input lines
+{
+  int fd;
+  char *buf;
+  size_t size;  // capacity of buf, one byte is kept free for a '\0'
+  size_t start; // offset of the first unconsumed byte
+  size_t end;   // offset one past the last buffered byte
+  size_t scan;  // offset where the next newline search resumes
+  int eof;      // Boolean for end of input on fd
+  void (*wait_input)(int fd); // called before each read(2), may be NULL
+  int terminal; // Boolean for lines being edited on a terminal
+};
+
+struct LineReader * init_reader(int fd);
+struct LineReader * init_reader_str(const char *str);
+char * read_line(struct LineReader *reader, size_t *len);
+void cleanup_reader(struct LineReader *reader);
+
+#endif
@@ -1,91 +1,712 @@
 /**
  * NAME: smallsh - a small shell program
- * SYNOPSIS: smallsh
+ * SYNOPSIS: smallsh [FILE | -c COMMAND]
  * DESCRIPTION:
  * Implements a subset of features of well-known shells, such as bash:
- * - Provides a prompt for running commands
+ * - Provides a prompt for running commands, with line editing and Tab
+ *   completion of commands and file names on a terminal
+ * - Runs the lines of FILE or COMMAND without prompting when given,
+ *   exiting with the status of the last command
  * - Handles blank lines for comments (beginning with '#')
- * - Provides expansion for the variable $$
- * - Executes 3 commands built into the shell: exit, cd, and status
+ * - Supports single quotes, double quotes and backslash escapes
+ * - Provides shell variables set with NAME=value and expanded with $NAME
+ *   or ${NAME}, and the special parameters $$, $? and $!
+ * - Substitutes the output of commands given as $(COMMAND), running
+ *   built-in ones without creating a process
+ * - Executes commands built into the shell: exit, cd, status, hash,
+ *   parallel, history, and the job control commands jobs, wait, fg and bg
+ * - Runs the utilities true, false, echo, pwd, test, [ and printf
+ *   without creating a process, redirections included
  * - Executes other commands by creating new processes using a function
  *   from the exec family of functions
- * - Supports input and output redirection
- * - Supports running commands in foreground and background processes
+ * - Supports input and output redirection, here-documents (<<) and
+ *   here-strings (<<<)
+ * - Supports pipelines of commands joined by '|' and lists of commands
+ *   separated by ';'
+ * - Evaluates if/then/elif/else/fi, for/in/do/done, while and until
+ *   inside the shell, parsing their bodies once
+ * - Defines shell functions, called with positional parameters $1 to $N
+ *   without creating a process, and aliases expanded while parsing
+ * - Keeps a history of the commands typed at the prompt, shared by
+ *   concurrent shells, with the history command and !N, !-N, !! and
+ *   !PREFIX recall
+ * - Reports the time and resources a command used with the time keyword
+ * - Runs jobs with a CPU affinity, nice level, scheduling policy and
+ *   resource limits given with the run prefix
+ * - Supports running commands in foreground and background processes,
+ *   reporting background ones as soon as they finish
  * - Uses custom handlers for 2 signals: SIGINT and SIGTSTP
+ * - Traces each command's lifecycle to the file named by SMALLSH_TRACE
+ * - Compiles scripts once into the directory named by SMALLSH_CACHE and
+ *   runs the compiled form on later runs
  * AUTHOR: Allen Blanton (CS 344, Spring 2022)
  */
 
-#define _POSIX_SOURCE
+#define _POSIX_C_SOURCE 200809L
 
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
-#include "llist.h"
+#include "history.h"
+#include "line_editor.h"
+#include "line_reader.h"
+#include "arena.h"
+#include "control_flow.h"
+#include "event_loop.h"
+#include "functions.h"
+#include "job_table.h"
 #include "signal_handlers.h"
 #include "input_parsing.h"
 #include "process_control.h"
+#include "script_cache.h"
 #include "shell_commands.h"
+#include "trace.h"
 #include "utilities.h"
+#include "variables.h"
+
+#define MAX_CALL_DEPTH 1000 // function calls running inside each other
 
 // Boolean for foreground-only mode
 volatile sig_atomic_t fg_mode = 0;
 
-int
-main(void)
-{
-  // Declare parent signal behavior
-  struct sigaction ignore_action, SIGTSTP_action = {0};
-  SIGTSTP_action.sa_handler = toggle_fg_mode_on;
-  SIGTSTP_action.sa_flags = 0;
-  ignore_action.sa_handler = SIG_IGN;
-  sigaction(SIGTSTP, &SIGTSTP_action, NULL);  // parent will catch SIGTSTP
-  sigaction(SIGINT, &ignore_action, NULL);  // parent will ignore SIGINT
+static int call_function(struct Input *input, struct Shell *shell);
 
-  int exitStatus = 0;
-  struct Input *input = get_userinput();
-  struct Llist *bgLlist = init_llist();  // llist to keep track of bg processes
+// Runs a function the way a built-in command runs, redirections included
+static const struct Builtin functionCall = {"function", call_function, 0};
+static int callDepth = 0; // function calls running
 
-  // Parse user input
-  while (1)
+/**
+ * Chooses the source of commands from the command line arguments: the
+ * lines of a script file, the string given with -c, or stdin with a
+ * prompt when neither is given.
+ *
+ * @param argc The number of command line arguments
+ * @param argv The array of command line arguments
+ * @param prompt Set to the prompt to use, or NULL for none
+ * @return The pointer to a LineReader for the source, or NULL on error
+ */
+static struct LineReader *
+open_source(int argc, char *argv[], const char **prompt)
+{
+  *prompt = NULL;
+  if (argc == 1)
   {
-    if (input->args == NULL || input->args[0][0] == '#')
-    { // ignore empty inputs and comments; skip to end of if/else block
-    } 
-    else if (!strcmp(input->args[0], "exit") && !builtin_exit(input))
+    *prompt = ": ";
+    struct LineReader *reader = init_reader(STDIN_FILENO);
+    reader->terminal = isatty(STDIN_FILENO);
+    return reader;
+  }
+  if (argc == 3 && !strcmp(argv[1], "-c"))
+  {
+    return init_reader_str(argv[2]);
+  }
+  if (argc == 2 && argv[1][0] != '-')
+  {
+    int fd = open(argv[1], O_RDONLY);
+    if (fd == -1)
     {
-      break;
+      perror(argv[1]);
+      return NULL;
     }
-    else if (!strcmp(input->args[0], "status"))
+    fcntl(fd, F_SETFD, FD_CLOEXEC); // keep the script from children
+    return init_reader(fd);
+  }
+  fprintf(stderr, "Usage: smallsh [FILE | -c COMMAND]\n");
+  return NULL;
+}
+
+/**
+ * Finds the built-in command to run a single command with. A function
+ * comes before a built-in command of the same name. A utility that is
+ * also installed as a program still runs in a child process in the
+ * background, or under run so the settings apply to it.
+ *
+ * @param input The full user command
+ * @return The pointer to the Builtin, or NULL to run the command in a
+ *         child process
+ */
+static const struct Builtin *
+choose_builtin(struct Input *input)
+{
+  if (input->args == NULL || input->next != NULL)
+  {
+    return NULL;
+  }
+  if (find_function(input->args[0]) != NULL)
+  {
+    return &functionCall;
+  }
+  const struct Builtin *builtin = find_builtin(input->args[0]);
+  if (builtin != NULL && builtin->external &&
+      ((input->background && !fg_mode) || input->limits != NULL))
+  {
+    return NULL;
+  }
+  return builtin;
+}
+
+/**
+ * Sets the shell variables of a command made of NAME=value words from
+ * left to right, expanding each word only once the ones before it are
+ * set, so "x=1 y=$x" sets y to 1.
+ *
+ * @param input The command
+ * @param arena The pointer to the Arena for the expanded words
+ * @return The exit status, always 0
+ */
+static int
+assign_vars(struct Input *input, struct Arena *arena)
+{
+  for (int i = 0; i < input->numArgs; ++i)
+  {
+    char *word = input->words != NULL ? word_text(input->words[i], arena) :
+                                        input->args[i];
+    const char *eq = strchr(word, '=');
+    set_var(word, eq - word, eq + 1);
+  }
+  return 0;
+}
+
+static void run_node(struct Node *node, struct Shell *shell,
+                     struct Arena *arena);
+
+/**
+ * Runs a statement of a "$(...)" substitution in a subshell, a child
+ * process forked from the shell, with its stdout on an anonymous memory
+ * file. Whatever the statement changes, such as the working directory,
+ * variables, functions or aliases, stays in the child.
+ *
+ * @param statement The NODE_LIST of the statement
+ * @param shell The pointer to the Shell state
+ * @param output Set to the allocated output, or NULL
+ * @param len Set to the length of the output
+ * @return The exit status of the subshell
+ */
+static int
+capture_subshell(struct Node *statement, struct Shell *shell,
+                 char **output, size_t *len)
+{
+  *output = NULL;
+  *len = 0;
+  int fd = open_capture();
+  if (fd == -1)
+  {
+    return 1;
+  }
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == -1)
+  {
+    perror("fork()");
+    fflush(stderr);
+    close(fd);
+    return 1;
+  }
+  if (pid == 0)
+  { // exit without the shell's cleanup, such as killing its jobs
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    reset_events();
+    trace_forked();
+    run_node(statement, shell, init_arena(1024));
+    fflush(stdout);
+    flush_trace();
+    _exit(shell->exitStatus < 0 ? 128 - shell->exitStatus
+                                : shell->exitStatus);
+  }
+
+  int status;
+  while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+  {
+  }
+  lseek(fd, 0, SEEK_SET);
+  *output = read_output(fd, len);
+  close(fd);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/**
+ * Runs the command of a "$(...)" substitution and captures its output,
+ * as in a subshell: a utility such as echo or printf, which changes
+ * nothing in the shell, runs in the shell itself, another program in
+ * the foreground with its stdout on a pipe, and anything else, such as
+ * a list, a compound command, an assignment, cd or a function call, in
+ * a forked subshell. The command is parsed into an arena of its own, so
+ * substitutions can nest. Its status becomes $?.
+ *
+ * @param command The text between the parentheses
+ * @param len The length of the text
+ * @param outLen Set to the length of the output
+ * @param data The pointer to the Shell state
+ * @return The allocated output without its trailing newlines, or NULL
+ */
+static char *
+substitute(const char *command, size_t len, size_t *outLen, void *data)
+{
+  struct Shell *shell = data;
+  struct Arena *arena = init_arena(1024);
+  struct LineReader *reader =
+    init_reader_str(arena_strndup(arena, command, len));
+  struct Node *statement = get_statement(reader, NULL, arena);
+  cleanup_reader(reader);
+  struct Node *node = statement != NULL ? statement->body : NULL;
+  char *output = NULL;
+  *outLen = 0;
+  int status = shell->exitStatus;
+
+  if (node == NULL)
+  { // nothing to run
+  }
+  else if (node->type != NODE_COMMAND || node->next != NULL)
+  {
+    status = capture_subshell(statement, shell, &output, outLen);
+  }
+  else
+  {
+    struct Input *input = node_input(node, arena);
+    const struct Builtin *builtin = choose_builtin(input);
+    if (input->args == NULL)
+    { // nothing to run
+    }
+    else if (input->assign || (builtin != NULL && !builtin->external))
     {
-      builtin_status(input, exitStatus);
+      status = capture_subshell(statement, shell, &output, outLen);
     }
-    else if (!strcmp(input->args[0], "cd"))
+    else if (builtin != NULL)
     {
-      builtin_cd(input);
+      status = capture_builtin(builtin, input, shell, &output, outLen);
     }
     else
-    { // try to execute non-built-in command
-      if (!fg_mode && input->background)
+    {
+      status = capture_child_fg(input, shell->jobs, &output, outLen);
+    }
+  }
+  set_last_status(status);
+  cleanup_arena(arena);
+
+  while (*outLen > 0 && output[*outLen - 1] == '\n')
+  {
+    --*outLen;
+  }
+  return output;
+}
+
+/**
+ * Runs the given command or pipeline in child processes, in the
+ * background if requested and foreground-only mode is off.
+ *
+ * @param input The full user command
+ * @param jobs The pointer to the table of background jobs
+ * @param exitStatus Set to the status of a foreground command
+ */
+static void
+run_children(struct Input *input, struct JobTable *jobs, int *exitStatus)
+{
+  if (!fg_mode && input->background)
+  {
+    struct Job *job = fork_child_bg(input, jobs);
+    if (job != NULL)
+    {
+      set_last_bg(job->lastPid);
+    }
+  }
+  else
+  {
+    *exitStatus = fork_child_fg(input, jobs);
+  }
+}
+
+/**
+ * Runs one parsed command: an assignment, a built-in command, or a
+ * command or pipeline in child processes, and records its status.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @param arena The pointer to the Arena for expanded words
+ */
+static void
+run_input(struct Input *input, struct Shell *shell, struct Arena *arena)
+{
+  struct Timer timer;
+  if (input->timed)
+  {
+    start_timer(&timer);
+  }
+
+  const struct Builtin *builtin = choose_builtin(input);
+
+  if (input->args == NULL)
+  { // ignore empty inputs and comments; skip to end of if/else block
+  }
+  else if (input->assign)
+  {
+    shell->exitStatus = assign_vars(input, arena);
+  }
+  else if (builtin != NULL)
+  {
+    long long start = tracing ? trace_clock() : 0;
+    shell->exitStatus = run_builtin(builtin, input, shell);
+    if (tracing)
+    {
+      trace_event(TRACE_BUILTIN, start, 0, shell->exitStatus, input->args);
+    }
+    if (input->timed)
+    { // children report their own usage when they finish
+      report_timer(&timer, shell->exitStatus, input->timed);
+    }
+  }
+  else
+  { // try to execute non-built-in command or pipeline
+    run_children(input, shell->jobs, &shell->exitStatus);
+  }
+  set_last_status(shell->exitStatus);
+
+  // Reap any bg processes the event loop has not seen yet, e.g. when
+  // the input is a file that never needs waiting on
+  reap(shell->jobs, NULL);
+}
+
+/**
+ * Checks whether the rest of a statement should be skipped: after exit,
+ * or when a foreground command was interrupted with Ctrl-C.
+ *
+ * @param shell The pointer to the Shell state
+ * @return Boolean for stopping
+ */
+static int
+stopped(const struct Shell *shell)
+{
+  return shell->exiting || shell->exitStatus == -SIGINT;
+}
+
+/**
+ * Runs the commands of a list in order.
+ *
+ * @param node The first command of the list, or NULL
+ * @param shell The pointer to the Shell state
+ * @param arena The pointer to the Arena for parsing each command
+ */
+static void
+run_list(struct Node *node, struct Shell *shell, struct Arena *arena)
+{
+  for (; node != NULL; node = node->next)
+  {
+    run_node(node, shell, arena);
+    if (stopped(shell))
+    {
+      return;
+    }
+  }
+}
+
+/**
+ * Sets the status of a compound command, which is that of the last
+ * command of its body that ran, or 0 if none did.
+ *
+ * @param shell The pointer to the Shell state
+ * @param status The status
+ */
+static void
+set_status(struct Shell *shell, int status)
+{
+  shell->exitStatus = status;
+  set_last_status(status);
+}
+
+/**
+ * Runs the words of a for loop, expanded once when the loop starts, or
+ * the positional parameters, one after another through the loop's body.
+ *
+ * @param node The pointer to the NODE_FOR
+ * @param shell The pointer to the Shell state
+ * @param arena The pointer to the Arena for parsing each command
+ */
+static void
+run_for(struct Node *node, struct Shell *shell, struct Arena *arena)
+{
+  // The arena is reset by each command, so keep the words elsewhere
+  char **words = node->tokens != NULL ? expand_words(node->tokens, arena) :
+                                        get_params();
+  int count = 0;
+  size_t size = 0;
+  while (words[count] != NULL)
+  {
+    size += strlen(words[count++]) + 1;
+  }
+  char *text = malloc(size + 1);
+  char *end = text;
+  for (int i = 0; i < count; ++i)
+  {
+    end = stpcpy(end, words[i]) + 1;
+  }
+  arena_reset(arena);
+
+  int status = 0;
+  size_t nameLen = strlen(node->name);
+  char *word = text;
+  for (int i = 0; i < count; ++i)
+  {
+    set_var(node->name, nameLen, word);
+    word += strlen(word) + 1;
+    run_list(node->body, shell, arena);
+    status = shell->exitStatus;
+    if (stopped(shell))
+    {
+      break;
+    }
+  }
+  free(text);
+  if (!stopped(shell))
+  {
+    set_status(shell, status);
+  }
+}
+
+struct Subshell // a compound command to run in a background subshell
+{
+  struct Node *node;
+  struct Shell *shell;
+};
+
+/**
+ * Runs a compound command in the background subshell forked for it.
+ *
+ * @param data The pointer to the Subshell
+ * @return The exit status of the command
+ */
+static int
+run_subshell(void *data)
+{
+  struct Subshell *subshell = data;
+  subshell->node->background = 0; // in the subshell's copy of the tree
+  run_node(subshell->node, subshell->shell, init_arena(1024));
+  return subshell->shell->exitStatus;
+}
+
+/**
+ * Starts a compound command ended by '&' as a background job, unless
+ * foreground-only mode is on, in which case it runs in the shell.
+ *
+ * @param node The pointer to the Node
+ * @param shell The pointer to the Shell state
+ * @param arena The pointer to the Arena for parsing each command
+ */
+static void
+run_background(struct Node *node, struct Shell *shell, struct Arena *arena)
+{
+  static const char *const commands[] = {
+    [NODE_LIST] = "{ ... } &", [NODE_IF] = "if ... fi &",
+    [NODE_FOR] = "for ... done &", [NODE_WHILE] = "while ... done &",
+    [NODE_UNTIL] = "until ... done &",
+  };
+  if (fg_mode)
+  {
+    node->background = 0;
+    run_node(node, shell, arena);
+    node->background = 1;
+    return;
+  }
+  struct Subshell subshell = {node, shell};
+  struct Job *job = fork_shell_bg(run_subshell, &subshell,
+                                  commands[node->type], shell->jobs);
+  if (job != NULL)
+  {
+    set_last_bg(job->lastPid);
+  }
+  set_status(shell, 0);
+}
+
+/**
+ * Runs a parsed command, evaluating compound commands in the shell:
+ * conditions are lists whose last command's exit status decides.
+ *
+ * @param node The pointer to the Node
+ * @param shell The pointer to the Shell state
+ * @param arena The pointer to the Arena for parsing each command, reset
+ *        after it runs
+ */
+static void
+run_node(struct Node *node, struct Shell *shell, struct Arena *arena)
+{
+  int status = 0;
+  if (node->background)
+  {
+    run_background(node, shell, arena);
+    return;
+  }
+  switch (node->type)
+  {
+    case NODE_LIST:
+      run_list(node->body, shell, arena);
+      break;
+
+    case NODE_COMMAND:
+      run_input(node_input(node, arena), shell, arena);
+      arena_reset(arena);
+      break;
+
+    case NODE_IF:
+      run_list(node->cond, shell, arena);
+      if (stopped(shell))
+      {
+        break;
+      }
+      if (shell->exitStatus == 0)
       {
-        append_node(bgLlist, fork_child_bg(input));
+        run_list(node->body, shell, arena);
+      }
+      else if (node->orElse != NULL)
+      {
+        run_list(node->orElse, shell, arena);
       }
       else
       {
-        exitStatus = fork_child_fg(input);
+        set_status(shell, 0);
+      }
+      break;
+
+    case NODE_FOR:
+      run_for(node, shell, arena);
+      break;
+
+    case NODE_FUNCTION:
+      define_function(node->name, node->body);
+      set_status(shell, 0);
+      break;
+
+    case NODE_WHILE:
+    case NODE_UNTIL:
+      for (;;)
+      {
+        run_list(node->cond, shell, arena);
+        if (stopped(shell) ||
+            (shell->exitStatus == 0) != (node->type == NODE_WHILE))
+        {
+          break;
+        }
+        run_list(node->body, shell, arena);
+        status = shell->exitStatus;
+        if (stopped(shell))
+        {
+          break;
+        }
       }
-    } 
+      if (!stopped(shell))
+      {
+        set_status(shell, status);
+      }
+      break;
+  }
+}
+
+/**
+ * Calls the function a command names, with the command's arguments as
+ * its positional parameters. The body runs in the shell, with an arena
+ * of its own for its commands, since the caller's command stays in use
+ * until the call returns.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return The exit status of the last command of the body
+ */
+static int
+call_function(struct Input *input, struct Shell *shell)
+{
+  if (callDepth == MAX_CALL_DEPTH)
+  {
+    fprintf(stderr, "%s: functions nested too deeply\n", input->args[0]);
+    fflush(stderr);
+    return 1;
+  }
+  struct Function *function = enter_function(input->args[0]);
+  struct Arena *arena = init_arena(1024);
+  ++callDepth;
+  push_params(input->args + 1, input->numArgs - 1);
+  run_node(function->body, shell, arena);
+  pop_params();
+  --callDepth;
+  cleanup_arena(arena);
+  leave_function(function);
+  return shell->exitStatus;
+}
+
+int
+main(int argc, char *argv[])
+{
+  // Declare parent signal behavior
+  struct sigaction ignore_action, SIGTSTP_action = {0};
+  SIGTSTP_action.sa_handler = toggle_fg_mode_on;
+  SIGTSTP_action.sa_flags = 0;
+  ignore_action.sa_handler = SIG_IGN;
+  sigaction(SIGTSTP, &SIGTSTP_action, NULL);  // parent will catch SIGTSTP
+  sigaction(SIGINT, &ignore_action, NULL);  // parent will ignore SIGINT
 
-    // Attempt to reap any bg processes
-    reap(bgLlist);
+  const char *prompt;
+  struct LineReader *reader = open_source(argc, argv, &prompt);
+  if (reader == NULL)
+  {
+    return EXIT_FAILURE;
+  }
+  init_trace();
+  init_vars();
+  struct CompiledScript *script = NULL; // the script compiled, if cached
+  if (argc == 2)
+  {
+    script = load_script(argv[1], reader->fd);
+  }
+  if (prompt != NULL)
+  {
+    init_history();
+  }
+  struct JobTable *jobs = init_jobs();  // table to keep track of jobs
+  init_events(jobs, prompt);
+  reader->wait_input = wait_for_input;
+  struct Arena *tree = init_arena(4096);  // holds one parsed statement
+  struct Arena *arena = init_arena(4096); // holds one parsed command
+  struct Shell shell = {jobs, 0, 0};  // state the built-in commands use
+  set_substitution(substitute, &shell);
+  struct Node *statement;
+
+  // Parse user input until exit or the end of input
+  while (!shell.exiting &&
+         (statement = script ? next_compiled(script, tree) :
+                               get_statement(reader, prompt, tree)) != NULL)
+  {
+    run_node(statement, &shell, arena);
 
     // Proceed to the next prompt for user input
-    cleanup_input(input);
-    input = get_userinput();
+    arena_reset(tree);
   }
 
   // Final cleanup
-  kill_bg(bgLlist);
-  cleanup_llist(bgLlist);
-  cleanup_input(input);
-  return EXIT_SUCCESS;
+  kill_bg(jobs);
+  cleanup_jobs(jobs);
+  cleanup_events();
+  cleanup_trace();
+  cleanup_history();
+  cleanup_vars();
+  cleanup_functions();
+  cleanup_arena(arena);
+  cleanup_arena(tree);
+  if (script != NULL)
+  {
+    cleanup_script(script);
+  }
+  if (reader->fd > STDIN_FILENO)
+  {
+    close(reader->fd);
+  }
+  cleanup_reader(reader);
+  cleanup_editor();
+
+  // Exit with the status of the last foreground command, reporting a
+  // terminating signal the way other shells do
+  return shell.exitStatus < 0 ? 128 - shell.exitStatus : shell.exitStatus;
 }
@@ -2,287 +2,1434 @@
  * Definitions for process control functions.
 */
 
-#define _POSIX_SOURCE
+#define _GNU_SOURCE
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
-#include "llist.h"
+#include "arena.h"
+#include "command_hash.h"
+#include "event_loop.h"
+#include "job_table.h"
+#include "line_reader.h"
 #include "process_control.h"
+#include "run_limits.h"
 #include "signal_handlers.h"
+#include "trace.h"
+
+static int lastBgStatus = 0;      // status of the last background job to end
+static unsigned long bgDone = 0;  // background jobs that have ended so far
+static int bgRunning = 0;         // background jobs not claimed or ended yet
+
+#define KILL_GRACE 0.5 // seconds for jobs to exit on SIGTERM at exit
+#define CAPTURE_READ 65536 // least room offered to a read of captured output
 
 /**
- * Forks a child to try and execute the user input as a foreground process.
+ * Prints an error for a command that could not be executed.
  *
- * @param input The full user command
+ * @param args The array of arguments
  */
-int 
-fork_child_fg(struct Input *input)
+static void
+report_exec_error(char **args)
 {
-  // Block SIGTSTP until fg process finishes
-  sigset_t block_set;
-  sigaddset(&block_set, SIGTSTP);
-  sigprocmask(SIG_BLOCK, &block_set, NULL); // block SIGTSTP
+  fprintf(stderr, "posix_spawn(): Bad argument(s) '%s", args[0]);
+  for (int i = 1; args[i] != NULL; ++i)
+  {
+    fprintf(stderr, " %s", args[i]);
+  }
+  fprintf(stderr, "'\n");
+  fflush(stderr);
+}
 
-  // Fork a child
-  pid_t childPid = fork();
-  if (childPid == -1)
-  { // Fork error
-    fprintf(stderr, "fork(): Fork failed\n");
+/**
+ * Opens the given file for a redirection in the parent, reporting any
+ * error. The descriptor is close-on-exec so only the dup2'd copy made by
+ * the spawn file actions reaches the child.
+ *
+ * @param filename The name of the file, or NULL for no redirection
+ * @param flags The flags to open the file with
+ * @return The file descriptor, -1 for no file, or -2 for failure
+ */
+static int
+open_redirect(const char *filename, int flags)
+{
+  if (filename == NULL)
+  {
+    return -1;
+  }
+  int fd = open(filename, flags, 0644);
+  if (fd == -1)
+  {
+    perror("open()");
     fflush(stderr);
-    exit(EXIT_FAILURE);
+    return -2;
   }
-  else if (childPid == 0)
-  { // Child Process
-    // Unblock SIGINT
-    sigset_t mask;
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGINT);
-    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return fd;
+}
 
-    // Setup SIGINT action
-    struct sigaction SIGINT_action;
-    SIGINT_action.sa_handler = catch_SIGINT; // custom handler
-    sigemptyset(&SIGINT_action.sa_mask);
-    SIGINT_action.sa_flags = 0;
-    sigaction(SIGINT, &SIGINT_action, NULL); // child will catch SIGINT
+/**
+ * Creates a descriptor to read the text of a here-document or
+ * here-string from, without touching the filesystem. Text that fits in
+ * a pipe's atomic write is written to a pipe up front; anything larger
+ * goes to an anonymous memory file, which cannot fill up and block the
+ * shell while nothing reads it yet. The descriptor is close-on-exec and
+ * positioned at the start of the text.
+ *
+ * @param text The text to read
+ * @param len The length of the text
+ * @return The file descriptor, or -1 for failure
+ */
+int
+open_here(const char *text, size_t len)
+{
+  int fds[2];
+  if (len <= PIPE_BUF)
+  {
+    if (pipe2(fds, O_CLOEXEC) == -1)
+    {
+      perror("pipe2()");
+      fflush(stderr);
+      return -1;
+    }
+    if (len > 0 && write(fds[1], text, len) == -1)
+    {
+      perror("write()");
+      fflush(stderr);
+      close(fds[0]);
+      fds[0] = -1;
+    }
+    close(fds[1]);
+    return fds[0];
+  }
 
-    // Redirect I/O if needed and try to execute the command
-    if (!redirect_input(input->infile) && !redirect_output(input->outfile))
+  int fd = memfd_create("smallsh-here", MFD_CLOEXEC);
+  if (fd == -1)
+  {
+    perror("memfd_create()");
+    fflush(stderr);
+    return -1;
+  }
+  while (len > 0)
+  {
+    ssize_t written = write(fd, text, len);
+    if (written == -1)
     {
-      exec_input(input->args);
+      perror("write()");
+      fflush(stderr);
+      close(fd);
+      return -1;
     }
+    text += written;
+    len -= written;
+  }
+  lseek(fd, 0, SEEK_SET);
+  return fd;
+}
 
-    // Error during execution
-    cleanup_input(input);
-    exit(EXIT_FAILURE);
+/**
+ * Starts a child the way posix_spawn would, but with fork so the child
+ * can apply the settings of run before executing the command. The child
+ * takes its process group, signal dispositions and mask from the spawn
+ * attributes, and reports a failure to apply the settings or execute
+ * the command through a close-on-exec pipe, so the parent learns of it
+ * just as it would from posix_spawn. The child only ever leaves through
+ * exec or _exit, so no buffer of the shell's is flushed twice.
+ *
+ * @param pid Set to the PID of the child
+ * @param path The path of the command
+ * @param attr The spawn attributes for the child
+ * @param args The array of arguments
+ * @param in The descriptor for stdin, or -1 to inherit it
+ * @param out The descriptor for stdout, or -1 to inherit it
+ * @param limits The pointer to the settings to apply
+ * @return 0 for success, the errno of a failed exec, or the negated
+ *         errno of settings that could not be applied
+ */
+static int
+fork_exec(pid_t *pid, const char *path, const posix_spawnattr_t *attr,
+          char **args, int in, int out, const struct RunLimits *limits)
+{
+  int report[2];
+  if (pipe2(report, O_CLOEXEC) == -1)
+  {
+    return errno;
+  }
+  *pid = fork();
+  if (*pid == -1)
+  {
+    int err = errno;
+    close(report[0]);
+    close(report[1]);
+    return err;
   }
-  else
-  { // Parent Process
-    // Wait for the child to finish
-    int childStatus;
-    int exitStatus;
-    childPid = waitpid(childPid, &childStatus, 0);
 
-    // Report its status
-    if (WIFEXITED(childStatus))
+  if (*pid == 0)
+  {
+    short flags;
+    sigset_t set;
+    posix_spawnattr_getflags(attr, &flags);
+    if (flags & POSIX_SPAWN_SETPGROUP)
+    {
+      pid_t pgroup;
+      posix_spawnattr_getpgroup(attr, &pgroup);
+      setpgid(0, pgroup);
+    }
+    if (flags & POSIX_SPAWN_SETSIGDEF)
+    {
+      posix_spawnattr_getsigdefault(attr, &set);
+      for (int signo = 1; signo < NSIG; ++signo)
+      {
+        if (sigismember(&set, signo) == 1)
+        {
+          signal(signo, SIG_DFL);
+        }
+      }
+    }
+    if (flags & POSIX_SPAWN_SETSIGMASK)
     {
-      exitStatus = WEXITSTATUS(childStatus);
+      posix_spawnattr_getsigmask(attr, &set);
+      sigprocmask(SIG_SETMASK, &set, NULL);
+    }
+    if (in >= 0) dup2(in, STDIN_FILENO);
+    if (out >= 0) dup2(out, STDOUT_FILENO);
+
+    int err;
+    if (apply_limits(limits) == -1)
+    {
+      err = -errno;
     }
     else
     {
-      exitStatus = -WTERMSIG(childStatus);
-      printf("terminated by signal %d\n", -exitStatus);
-      fflush(stdout);
+      execve(path, args, environ);
+      err = errno;
     }
-    sigprocmask(SIG_UNBLOCK, &block_set, NULL); // unblock SIGTSTP
-    return exitStatus;
+    write(report[1], &err, sizeof(err));
+    _exit(127);
+  }
+
+  // The pipe reads nothing once the child has executed the command
+  int err = 0;
+  close(report[1]);
+  while (read(report[0], &err, sizeof(err)) == -1 && errno == EINTR)
+  {
   }
+  close(report[0]);
+  if (err != 0)
+  {
+    waitpid(*pid, NULL, 0);
+    *pid = 0;
+  }
+  return err;
 }
 
 /**
- * Forks a child to try and execute the user input as a background
- * process.
+ * Starts a child for one command, with posix_spawn unless there are
+ * settings of run to apply in the child.
  *
- * @param input The full user command
- * @return A pointer to the new child Node 
+ * @param pid Set to the PID of the child
+ * @param path The path of the command
+ * @param actions The spawn file actions for the child
+ * @param attr The spawn attributes for the child
+ * @param args The array of arguments
+ * @param in The descriptor for stdin, or -1 to inherit it
+ * @param out The descriptor for stdout, or -1 to inherit it
+ * @param limits The pointer to the settings to apply, or NULL
+ * @return 0 for success, or an error as for fork_exec()
+ */
+static int
+start_child(pid_t *pid, const char *path,
+            const posix_spawn_file_actions_t *actions,
+            const posix_spawnattr_t *attr, char **args, int in, int out,
+            const struct RunLimits *limits)
+{
+  if (limits != NULL)
+  {
+    return fork_exec(pid, path, attr, args, in, out, limits);
+  }
+  return posix_spawn(pid, path, actions, attr, args, environ);
+}
+
+/**
+ * Spawns one command of a pipeline with posix_spawn, which lets the C
+ * library use a vfork-style clone instead of copying the shell's page
+ * tables. The command is located through the command hash so PATH is
+ * only searched the first time a name is used. Redirection files and
+ * here-documents are opened here and take precedence over the pipe
+ * ends; whichever is used is handed to the child as a dup2 file action.
+ * Under run the child is forked instead, to apply the settings before
+ * executing the command.
+ *
+ * @param stage The command to spawn
+ * @param limits The settings of run for the child, or NULL
+ * @param attr The spawn attributes for the child
+ * @param infile The path for stdin, or NULL to use the stage's here
+ *        text or else pipeIn
+ * @param outfile The path for stdout, or NULL to use pipeOut
+ * @param pipeIn The descriptor for stdin, or -1 to inherit it
+ * @param pipeOut The descriptor for stdout, or -1 to inherit it
+ * @return The PID of the child, or -1 if it could not be started
  */
-struct Node * 
-fork_child_bg(struct Input *input)
+static pid_t
+spawn_stage(struct Input *stage, const struct RunLimits *limits,
+            posix_spawnattr_t *attr,
+            const char *infile, const char *outfile, int pipeIn, int pipeOut)
 {
-  // Fork a child
-  pid_t childPid = fork();
-  if (childPid == -1)
-  { // Fork error
-    fprintf(stderr, "fork(): Fork failed\n");
+  long long start = tracing ? trace_clock() : 0;
+  int in = open_redirect(infile, O_RDONLY);
+  if (stage->here != NULL && infile == NULL)
+  {
+    in = open_here(stage->here, stage->hereLen);
+    in = in == -1 ? -2 : in;
+  }
+  int out = open_redirect(outfile, O_WRONLY | O_CREAT | O_TRUNC);
+  if (tracing && (in != -1 || outfile != NULL))
+  {
+    trace_event(TRACE_REDIRECT, start, 0, in == -2 || out == -2 ? errno : 0,
+                NULL);
+  }
+  if (in == -2 || out == -2)
+  {
+    if (in >= 0) close(in);
+    if (out >= 0) close(out);
+    return -1;
+  }
+  if (in == -1) in = pipeIn;
+  if (out == -1) out = pipeOut;
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (in >= 0) posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+  if (out >= 0) posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+
+  // Execute the remembered location directly; if that file is gone,
+  // search PATH once more before giving up
+  pid_t childPid = 0;
+  int err = ENOENT;
+  start = tracing ? trace_clock() : 0;
+  const char *path = hash_lookup(stage->args[0]);
+  if (tracing)
+  {
+    trace_event(TRACE_LOOKUP, start, 0, path != NULL, stage->args);
+    start = trace_clock();
+  }
+  if (path != NULL)
+  {
+    err = start_child(&childPid, path, &actions, attr, stage->args, in,
+                      out, limits);
+    if (err == ENOENT && path != stage->args[0])
+    {
+      hash_forget(stage->args[0]);
+      path = hash_lookup(stage->args[0]);
+      if (path != NULL)
+      {
+        err = start_child(&childPid, path, &actions, attr, stage->args, in,
+                          out, limits);
+      }
+    }
+  }
+  if (tracing)
+  { // posix_spawn returns once the child has executed the command
+    trace_event(TRACE_SPAWN, start, childPid, err, stage->args);
+    trace_event(err ? TRACE_EXEC_FAIL : TRACE_EXEC_OK, 0, childPid, err,
+                NULL);
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+  if (in >= 0 && in != pipeIn) close(in);
+  if (out >= 0 && out != pipeOut) close(out);
+
+  if (err < 0)
+  {
+    fprintf(stderr, "run: %s: %s\n", stage->args[0], strerror(-err));
     fflush(stderr);
-    exit(EXIT_FAILURE);
+    return -1;
+  }
+  if (err != 0)
+  {
+    report_exec_error(stage->args);
+    return -1;
   }
-  else if (childPid == 0)
-  { // Child Process
-    struct sigaction ignore_action = {0};
-    ignore_action.sa_handler = SIG_IGN;
-    sigaction(SIGTSTP, &ignore_action, NULL); // child will ignore SIGTSTP
+  return childPid;
+}
 
-    // Define the path for I/O redirection
-    char *in = "/dev/null";
-    char *out = "/dev/null";
-    if (input->infile != NULL)
+/**
+ * Creates a close-on-exec pipe, resizing it when SMALLSH_PIPESZ asks for
+ * a capacity other than the kernel default.
+ *
+ * @param fds Set to the read and write ends of the pipe
+ * @return -1 for failure, 0 for success
+ */
+static int
+open_pipe(int fds[2])
+{
+  if (pipe2(fds, O_CLOEXEC) == -1)
+  {
+    perror("pipe2()");
+    fflush(stderr);
+    return -1;
+  }
+  const char *size = getenv("SMALLSH_PIPESZ");
+  if (size != NULL && fcntl(fds[1], F_SETPIPE_SZ, atoi(size)) == -1)
+  {
+    perror("fcntl(F_SETPIPE_SZ)");
+    fflush(stderr);
+  }
+  return 0;
+}
+
+/**
+ * Spawns every command of the given pipeline, connecting each one's
+ * stdout to the next one's stdin. The children start with an empty
+ * signal mask and SIGINT at its default only in the foreground, so
+ * background children keep ignoring it. SIGTSTP is briefly ignored in
+ * the parent so the children inherit that disposition across exec.
+ * Background pipelines are put in a process group of their own, led by
+ * the first command that starts; foreground ones stay in the shell's group so
+ * terminal signals keep reaching them.
+ *
+ * @param input The first command of the pipeline
+ * @param background Boolean for running the pipeline in the background
+ * @param out The descriptor for the last command's stdout, or -1 to
+ *        inherit the shell's
+ * @param pids Filled with the PID of each command, or -1 for failures
+ * @return The number of commands in the pipeline
+ */
+static int
+spawn_pipeline(struct Input *input, int background, int out, pid_t *pids)
+{
+  posix_spawnattr_t attr;
+  sigset_t mask;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+                                  POSIX_SPAWN_SETSIGDEF |
+                                  (background ? POSIX_SPAWN_SETPGROUP : 0));
+  sigemptyset(&mask);
+  posix_spawnattr_setsigmask(&attr, &mask);
+  if (!background)
+  {
+    sigaddset(&mask, SIGINT); // fg children can be interrupted
+  }
+  posix_spawnattr_setsigdefault(&attr, &mask);
+  posix_spawnattr_setpgroup(&attr, 0);
+
+  // Ignore SIGTSTP while spawning so the children inherit SIG_IGN; it is
+  // blocked meanwhile so a Ctrl-Z in this window is delivered afterwards
+  struct sigaction ignore_action = {0}, saved_action;
+  sigset_t tstp_set, old_set;
+  sigemptyset(&tstp_set);
+  sigaddset(&tstp_set, SIGTSTP);
+  sigprocmask(SIG_BLOCK, &tstp_set, &old_set);
+  ignore_action.sa_handler = SIG_IGN;
+  sigaction(SIGTSTP, &ignore_action, &saved_action);
+
+  int count = 0;
+  int pipeIn = -1;
+  pid_t leader = -1; // the background group's leader once one starts
+  for (struct Input *stage = input; stage != NULL; stage = stage->next)
+  {
+    const char *infile = stage->infile;
+    const char *outfile = stage->outfile;
+    if (background && stage == input && infile == NULL &&
+        stage->here == NULL)
     {
-      in = input->infile;
+      infile = "/dev/null";
     }
-    if (input->outfile != NULL)
+    if (background && stage->next == NULL && outfile == NULL)
     {
-      out = input->outfile;
+      outfile = "/dev/null";
     }
 
-    // Redirect I/O and try to execute the input
-    if (!redirect_input(in) && !redirect_output(out))
+    int fds[2] = {-1, -1};
+    if (stage->next != NULL && open_pipe(fds) == -1)
     {
-      exec_input(input->args);
+      pids[count++] = -1;
+      break;
     }
 
-    // Error while executing
-    cleanup_input(input);
-    exit(EXIT_FAILURE);
+    int stageOut = stage->next != NULL ? fds[1] : out;
+    pids[count] = spawn_stage(stage, input->limits, &attr, infile, outfile,
+                              pipeIn, stageOut);
+    if (background && leader == -1 && pids[count] > 0)
+    {
+      leader = pids[count];
+      posix_spawnattr_setpgroup(&attr, leader); // the rest join its group
+    }
+    ++count;
+
+    // The parent keeps only the read end for the next command
+    if (pipeIn >= 0) close(pipeIn);
+    if (fds[1] >= 0) close(fds[1]);
+    pipeIn = fds[0];
+  }
+  if (pipeIn >= 0) close(pipeIn);
+
+  sigaction(SIGTSTP, &saved_action, NULL);
+  sigprocmask(SIG_SETMASK, &old_set, NULL);
+  posix_spawnattr_destroy(&attr);
+  return count;
+}
+
+/**
+ * Counts the commands in the given pipeline.
+ *
+ * @param input The first command of the pipeline
+ * @return The number of commands
+ */
+static int
+count_stages(struct Input *input)
+{
+  int count = 0;
+  for (; input != NULL; input = input->next)
+  {
+    ++count;
+  }
+  return count;
+}
+
+/**
+ * Returns the seconds elapsed since the given time.
+ *
+ * @param start The pointer to a time from CLOCK_MONOTONIC
+ * @return The elapsed time in seconds
+ */
+static double
+seconds_since(const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Converts a time from a struct rusage to seconds.
+ *
+ * @param tv The time to convert
+ * @return The time in seconds
+ */
+static double
+seconds(struct timeval tv)
+{
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/**
+ * Adds the resources used by one process to the total for its job. The
+ * maximum resident set size is the largest of any one process.
+ *
+ * @param total The pointer to the job's total
+ * @param usage The pointer to the resources used by the process
+ */
+static void
+add_usage(struct rusage *total, const struct rusage *usage)
+{
+  timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+  timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+  if (usage->ru_maxrss > total->ru_maxrss)
+  {
+    total->ru_maxrss = usage->ru_maxrss;
+  }
+  total->ru_majflt += usage->ru_majflt;
+  total->ru_minflt += usage->ru_minflt;
+  total->ru_nvcsw += usage->ru_nvcsw;
+  total->ru_nivcsw += usage->ru_nivcsw;
+}
+
+/**
+ * Prints the resources a command used to stderr: one per line for
+ * TIME_HUMAN, the real, user and sys lines POSIX specifies for
+ * TIME_PORTABLE, or for TIME_KEYVALUE a single line of key=value pairs
+ * that scripts can parse.
+ *
+ * @param usage The pointer to the resources used
+ * @param real The wall clock time in seconds
+ * @param status The exit value, or the negated terminating signal
+ * @param format TIME_HUMAN, TIME_PORTABLE or TIME_KEYVALUE
+ */
+static void
+print_times(const struct rusage *usage, double real, int status, int format)
+{
+  double user = seconds(usage->ru_utime);
+  double sys = seconds(usage->ru_stime);
+  if (format == TIME_PORTABLE)
+  {
+    fprintf(stderr, "real %.2f\nuser %.2f\nsys %.2f\n", real, user, sys);
+  }
+  else if (format == TIME_KEYVALUE)
+  {
+    fprintf(stderr, "time real=%.6f user=%.6f sys=%.6f maxrss_kb=%ld "
+            "majflt=%ld minflt=%ld nvcsw=%ld nivcsw=%ld status=%d\n",
+            real, user, sys, usage->ru_maxrss, usage->ru_majflt,
+            usage->ru_minflt, usage->ru_nvcsw, usage->ru_nivcsw, status);
   }
   else
-  { // Parent Process
-    printf("background PID is %d\n", childPid);
-    fflush(stdout);
-    struct Node *newChild = init_node(childPid);
-    return newChild;
+  {
+    fprintf(stderr, "real     %.3fs\n"
+                    "user     %.3fs\n"
+                    "sys      %.3fs\n"
+                    "maxrss   %ld KiB\n"
+                    "faults   %ld major, %ld minor\n"
+                    "switches %ld voluntary, %ld involuntary\n",
+            real, user, sys, usage->ru_maxrss, usage->ru_majflt,
+            usage->ru_minflt, usage->ru_nvcsw, usage->ru_nivcsw);
+  }
+  fflush(stderr);
+}
+
+/**
+ * Starts timing a command the shell runs itself.
+ *
+ * @param timer The pointer to the Timer to start
+ */
+void
+start_timer(struct Timer *timer)
+{
+  clock_gettime(CLOCK_MONOTONIC, &timer->start);
+  getrusage(RUSAGE_SELF, &timer->self);
+  getrusage(RUSAGE_CHILDREN, &timer->children);
+}
+
+/**
+ * Subtracts the usage at the start of a Timer from the usage now.
+ *
+ * @param now The pointer to the usage now, updated in place
+ * @param start The pointer to the usage at the start
+ */
+static void
+sub_usage(struct rusage *now, const struct rusage *start)
+{
+  timersub(&now->ru_utime, &start->ru_utime, &now->ru_utime);
+  timersub(&now->ru_stime, &start->ru_stime, &now->ru_stime);
+  now->ru_majflt -= start->ru_majflt;
+  now->ru_minflt -= start->ru_minflt;
+  now->ru_nvcsw -= start->ru_nvcsw;
+  now->ru_nivcsw -= start->ru_nivcsw;
+}
+
+/**
+ * Reports the resources used since the given Timer was started by a
+ * timed built-in command: the shell's own, plus those of any children
+ * reaped meanwhile, such as the runs of parallel or a job brought to
+ * the foreground.
+ *
+ * @param timer The pointer to the started Timer
+ * @param status The exit status of the command
+ * @param format TIME_HUMAN, TIME_PORTABLE or TIME_KEYVALUE
+ */
+void
+report_timer(const struct Timer *timer, int status, int format)
+{
+  struct rusage usage, children;
+  getrusage(RUSAGE_SELF, &usage);
+  getrusage(RUSAGE_CHILDREN, &children);
+  sub_usage(&usage, &timer->self);
+  sub_usage(&children, &timer->children);
+  add_usage(&usage, &children);
+  print_times(&usage, seconds_since(&timer->start), status, format);
+}
+
+/**
+ * Spawns the given pipeline and enters it in the job table as one job.
+ *
+ * @param input The full user command
+ * @param jobs The pointer to the table of jobs
+ * @param background Boolean for running the pipeline in the background
+ * @param out The descriptor for the last command's stdout, or -1 to
+ *        inherit the shell's
+ * @param lastStarted If not NULL, set to whether the last command of
+ *        the pipeline could be started
+ * @return A pointer to the new Job, or NULL if nothing could be started
+ */
+static struct Job *
+launch_job(struct Input *input, struct JobTable *jobs, int background,
+           int out, int *lastStarted)
+{
+  pid_t *pids = malloc(count_stages(input) * sizeof(pid_t));
+  int count = spawn_pipeline(input, background, out, pids);
+  int started = 0;
+  for (int i = 0; i < count; ++i)
+  {
+    started += pids[i] != -1;
+  }
+  if (lastStarted != NULL)
+  {
+    *lastStarted = pids[count - 1] != -1;
+  }
+
+  struct Job *job = NULL;
+  if (started > 0)
+  {
+    char *command = background ? format_input(input) : NULL;
+    job = add_job(jobs, command, pids, count, background);
+    free(command);
   }
+  free(pids);
+  return job;
 }
 
+/**
+ * Converts the wait status of a finished job to the shell's exit status.
+ *
+ * @param job The pointer to the finished Job
+ * @return The exit value, or the negated terminating signal
+ */
+static int
+job_status(const struct Job *job)
+{
+  if (WIFEXITED(job->status))
+  {
+    return WEXITSTATUS(job->status);
+  }
+  return -WTERMSIG(job->status);
+}
 
 /**
- * (adapted from "Processes and I/O" Exploration)
- * Redirects stdin to the file with the given filename.
+ * Removes a job the shell is done with from the table.
  *
- * @param infile The name of the input file
- * @return -1 for failure, 0 for success
+ * @param jobs The pointer to the table of jobs
+ * @param job The pointer to the finished Job
+ */
+static void
+finish_job(struct JobTable *jobs, struct Job *job)
+{
+  if (tracing)
+  {
+    trace_event(TRACE_REAP, 0, job->lastPid, job_status(job), NULL);
+  }
+  remove_job(jobs, job);
+}
+
+/**
+ * Reads everything from the given descriptor up to the end of file into
+ * a buffer that grows as needed, offering each read(2) plenty of room
+ * so large outputs take few system calls.
+ *
+ * @param fd The descriptor to read from
+ * @param len Set to the number of bytes read
+ * @return The allocated buffer, with a '\0' after the bytes read
+ */
+char *
+read_output(int fd, size_t *len)
+{
+  size_t capacity = CAPTURE_READ;
+  char *buf = malloc(capacity + 1);
+  *len = 0;
+  for (;;)
+  {
+    if (capacity - *len < CAPTURE_READ / 2)
+    {
+      capacity *= 2;
+      buf = realloc(buf, capacity + 1);
+    }
+    ssize_t n = read(fd, buf + *len, capacity - *len);
+    if (n == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      break;
+    }
+    *len += n;
+  }
+  buf[*len] = '\0';
+  return buf;
+}
+
+/**
+ * Creates an anonymous memory file to capture the output of a built-in
+ * command in, which cannot fill up the way a pipe would while nothing
+ * reads it.
+ *
+ * @return The close-on-exec file descriptor, or -1 for failure
  */
 int
-redirect_input(char *filename)
+open_capture(void)
 {
-  if (filename != NULL)
+  int fd = memfd_create("smallsh-capture", MFD_CLOEXEC);
+  if (fd == -1)
+  {
+    perror("memfd_create()");
+    fflush(stderr);
+  }
+  return fd;
+}
+
+/**
+ * Spawns children to try and execute the user input as a foreground
+ * pipeline and waits for all of them to finish, optionally reading the
+ * last command's stdout from a pipe meanwhile. The pipeline is entered
+ * in the job table like any other job, so the event loop reaps it along
+ * with background jobs that finish in the meantime.
+ *
+ * @param input The full user command
+ * @param jobs The pointer to the table of jobs
+ * @param output If not NULL, set to the allocated output of the last
+ *        command instead of letting it reach the shell's stdout
+ * @param len Set to the length of the output when it is captured
+ * @return The exit value of the last command, or its negated
+ *         terminating signal
+ */
+static int
+run_foreground(struct Input *input, struct JobTable *jobs, char **output,
+               size_t *len)
+{
+  // Block SIGTSTP until fg process finishes
+  sigset_t block_set;
+  sigemptyset(&block_set);
+  sigaddset(&block_set, SIGTSTP);
+  sigprocmask(SIG_BLOCK, &block_set, NULL); // block SIGTSTP
+
+  int fds[2] = {-1, -1};
+  if (output != NULL && pipe2(fds, O_CLOEXEC) == -1)
+  {
+    perror("pipe2()");
+    fflush(stderr);
+    *output = NULL;
+    *len = 0;
+    sigprocmask(SIG_UNBLOCK, &block_set, NULL);
+    return EXIT_FAILURE;
+  }
+
+  int exitStatus = EXIT_FAILURE; // the last command failed to start
+  int lastStarted;
+  struct Job *job = launch_job(input, jobs, 0, fds[1], &lastStarted);
+  if (output != NULL)
+  { // the output ends once every child has closed the write end
+    close(fds[1]);
+    *output = read_output(fds[0], len);
+    close(fds[0]);
+  }
+  if (job != NULL)
   {
-    int in = open(filename, O_RDONLY);
-    fcntl(in, F_SETFD, FD_CLOEXEC);
-    if (in == -1)
+    // Wait for every child, keeping the status of the last one
+    long long start = tracing ? trace_clock() : 0;
+    while (job->liveProcs > 0)
     {
-      perror("open()");
-      fflush(stderr);
-      return -1;
+      wait_for_children();
     }
-    if (dup2(in, 0) == -1)
+    if (tracing)
     {
-      perror("dup2()");
-      fflush(stderr);
-      return -1;
+      trace_event(TRACE_WAIT, start, job->lastPid, job_status(job), NULL);
+    }
+
+    // Report the last child's status
+    if (lastStarted)
+    {
+      exitStatus = job_status(job);
+    }
+    if (exitStatus < 0)
+    {
+      printf("terminated by signal %d\n", -exitStatus);
+      fflush(stdout);
+    }
+    if (input->timed)
+    {
+      print_times(&job->usage, seconds_since(&job->start), exitStatus,
+                  input->timed);
     }
+    finish_job(jobs, job);
   }
-  return 0;
+  sigprocmask(SIG_UNBLOCK, &block_set, NULL); // unblock SIGTSTP
+  return exitStatus;
 }
 
 /**
- * (adapted from "Processes and I/O" Exploration)
- * Redirects stdout to the file with the given filename.
+ * Spawns children to try and execute the user input as a foreground
+ * pipeline and waits for all of them to finish.
  *
- * @param outfile The name of the output file
- * @return -1 for failure, 0 for success
+ * @param input The full user command
+ * @param jobs The pointer to the table of jobs
+ * @return The exit value of the last command, or its negated
+ *         terminating signal
+ */
+int 
+fork_child_fg(struct Input *input, struct JobTable *jobs)
+{
+  return run_foreground(input, jobs, NULL, NULL);
+}
+
+/**
+ * Runs the user input as a foreground pipeline like fork_child_fg(),
+ * capturing the last command's stdout through a pipe, as for a command
+ * substitution.
+ *
+ * @param input The full user command
+ * @param jobs The pointer to the table of jobs
+ * @param output Set to the allocated output
+ * @param len Set to the length of the output
+ * @return The exit value of the last command, or its negated
+ *         terminating signal
  */
 int
-redirect_output(char *filename)
+capture_child_fg(struct Input *input, struct JobTable *jobs, char **output,
+                 size_t *len)
 {
-  if (filename != NULL)
+  return run_foreground(input, jobs, output, len);
+}
+
+/**
+ * Spawns children to try and execute the user input as a background
+ * pipeline, adding them to the job table as one job. The pipeline's
+ * I/O defaults to /dev/null unless redirected. A timed job has its
+ * resource usage reported along with its status when it finishes.
+ *
+ * @param input The full user command
+ * @param jobs The pointer to the table of background jobs
+ * @return A pointer to the new Job, or NULL if nothing could be started
+ */
+struct Job *
+fork_child_bg(struct Input *input, struct JobTable *jobs)
+{
+  struct Job *job = launch_job(input, jobs, 1, -1, NULL);
+  if (job != NULL)
   {
-    int out = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    fcntl(out, F_SETFD, FD_CLOEXEC);
-    if (out == -1)
+    ++bgRunning;
+    job->timed = input->timed;
+    printf("background PID is %d\n", job->lastPid);
+    fflush(stdout);
+  }
+  return job;
+}
+
+/**
+ * Forks a subshell to run part of a script, such as a compound command,
+ * as a background job in a process group of its own. Like a background
+ * pipeline, its stdin and stdout default to /dev/null.
+ *
+ * @param run The function the subshell runs, returning its exit status
+ * @param data The pointer passed on to run
+ * @param command The command to list the job as
+ * @param jobs The pointer to the table of background jobs
+ * @return A pointer to the new Job, or NULL if the fork failed
+ */
+struct Job *
+fork_shell_bg(int (*run)(void *data), void *data, const char *command,
+              struct JobTable *jobs)
+{
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == -1)
+  {
+    perror("fork()");
+    fflush(stderr);
+    return NULL;
+  }
+  if (pid == 0)
+  {
+    setpgid(0, 0);
+    signal(SIGTSTP, SIG_IGN);
+    int null = open("/dev/null", O_RDWR);
+    dup2(null, STDIN_FILENO);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+    reset_events();
+    trace_forked();
+    int status = run(data);
+    fflush(stdout);
+    flush_trace();
+    _exit(status < 0 ? 128 - status : status);
+  }
+
+  setpgid(pid, pid); // either side may get there first
+  struct Job *job = add_job(jobs, command, &pid, 1, 1);
+  ++bgRunning;
+  printf("background PID is %d\n", pid);
+  fflush(stdout);
+  return job;
+}
+
+/**
+ * Builds the arguments for one item of a parallel run. Every "{}" in
+ * the command's arguments is replaced with the item, which is appended
+ * as a last argument instead when none of them has one.
+ *
+ * @param input The command with its arguments
+ * @param item The item to substitute
+ * @param arena The pointer to the Arena for the arguments
+ * @return The NULL-terminated array of arguments
+ */
+static char **
+fill_template(struct Input *input, const char *item, struct Arena *arena)
+{
+  char **args = arena_alloc(arena, (input->numArgs + 2) * sizeof(char*));
+  size_t itemLen = strlen(item);
+  int substituted = 0;
+  for (int i = 0; i < input->numArgs; ++i)
+  {
+    const char *arg = input->args[i];
+    const char *next = strstr(arg, "{}");
+    if (next == NULL)
     {
-      perror("open()");
-      fflush(stderr);
-      return -1;
+      args[i] = input->args[i];
+      continue;
     }
-    if (dup2(out, 1) == -1)
+
+    // At most one item for every two bytes of the argument
+    size_t len = strlen(arg);
+    char *out = arena_alloc(arena, len / 2 * itemLen + len + 1);
+    args[i] = out;
+    for (; next != NULL; next = strstr(arg, "{}"))
     {
-      perror("dup2()");
-      fflush(stderr);
-      return -1;
+      memcpy(out, arg, next - arg);
+      out += next - arg;
+      memcpy(out, item, itemLen);
+      out += itemLen;
+      arg = next + 2;
     }
+    strcpy(out, arg);
+    substituted = 1;
   }
-  return 0;
+
+  int count = input->numArgs;
+  if (!substituted)
+  {
+    args[count++] = arena_strndup(arena, item, itemLen);
+  }
+  args[count] = NULL;
+  return args;
 }
 
 /**
- * Attempts to execute the given argument(s), printing an error and
- * returning if not.
+ * Runs the given command once for each line read from itemFd, keeping
+ * at most maxJobs of them running at a time. Each run is a job in the
+ * job table, reaped by the event loop, and a new one is started as soon
+ * as one finishes. The runs stay in the shell's process group with
+ * stdin from /dev/null, so Ctrl-C stops them, after which no more are
+ * started. Empty lines are skipped.
  *
- * @param args The array of arguments
- * @return -1 to signify failure
+ * @param input The command, whose arguments may contain "{}"
+ * @param maxJobs The most runs to keep going at once
+ * @param itemFd The descriptor to read items from
+ * @param jobs The pointer to the table of jobs
+ * @return 0 if every run succeeded, the number that failed up to 101,
+ *         or the negated signal that interrupted the runs
  */
 int
-exec_input(char **args)
+run_parallel(struct Input *input, int maxJobs, int itemFd,
+             struct JobTable *jobs)
 {
-    // Attempt to exec the command
-    execvp(args[0], args);
+  // Block SIGTSTP until the runs finish, as for a foreground command
+  sigset_t block_set;
+  sigemptyset(&block_set);
+  sigaddset(&block_set, SIGTSTP);
+  sigprocmask(SIG_BLOCK, &block_set, NULL);
+
+  struct Job **running = calloc(maxJobs, sizeof(struct Job *));
+  struct LineReader *items = init_reader(itemFd);
+  struct Arena *arena = init_arena(1024);
+  struct Input run = *input;
+  run.infile = "/dev/null";
+  run.here = NULL;
+  run.outfile = NULL;
+  run.background = 0;
+  run.next = NULL;
 
-    // Error during execution
-    fprintf(stderr, "execvp(): Bad argument(s) '%s", args[0]);
-    for (int i = 1; args[i] != NULL; ++i)
+  int numRunning = 0;
+  int launched = 0;
+  int failed = 0;
+  int stopSignal = 0;
+  char *item;
+  size_t len;
+  for (;;)
+  {
+    // Fill every free slot with a run for the next item
+    while (numRunning < maxJobs && stopSignal == 0 &&
+           (item = read_line(items, &len)) != NULL)
     {
-      fprintf(stderr, " %s", args[i]);
+      if (len == 0)
+      {
+        continue;
+      }
+      run.args = fill_template(input, item, arena);
+      struct Job *job = launch_job(&run, jobs, 0, -1, NULL);
+      arena_reset(arena);
+      ++launched;
+      if (job == NULL)
+      {
+        ++failed;
+        continue;
+      }
+      int slot = 0;
+      while (running[slot] != NULL)
+      {
+        ++slot;
+      }
+      running[slot] = job;
+      ++numRunning;
+    }
+    if (numRunning == 0)
+    {
+      break;
+    }
+
+    // Collect the runs that have finished
+    wait_for_children();
+    for (int i = 0; i < maxJobs; ++i)
+    {
+      struct Job *job = running[i];
+      if (job == NULL || job->liveProcs > 0)
+      {
+        continue;
+      }
+      int status = job_status(job);
+      if (status != 0)
+      {
+        ++failed;
+      }
+      if (status == -SIGINT)
+      {
+        stopSignal = SIGINT;
+      }
+      finish_job(jobs, job);
+      running[i] = NULL;
+      --numRunning;
     }
-    fprintf(stderr, "'\n");
+  }
+
+  if (failed > 0)
+  {
+    fprintf(stderr, "parallel: %d of %d jobs failed\n", failed, launched);
     fflush(stderr);
-    return -1;
+  }
+  cleanup_arena(arena);
+  cleanup_reader(items);
+  free(running);
+  sigprocmask(SIG_UNBLOCK, &block_set, NULL);
+  if (stopSignal != 0)
+  {
+    return -stopSignal;
+  }
+  return failed > 101 ? 101 : failed;
 }
 
 /**
- * Attempts to reap any will child processes, returning the PID of the
- * reaped process if successful or 0 otherwise.
+ * Prints the report for a background job that has finished, followed
+ * by its resource usage if it was timed. The report is left in the
+ * stdout buffer so a batch of them can be written at once.
  *
- * @param bgLlist The pointer to the list of current background processes
+ * @param job The pointer to the finished Job
  */
-void
-reap(struct Llist *bgLlist)
+static void
+report_job(const struct Job *job)
 {
-  if (bgLlist == NULL || bgLlist->size == 0) 
+  printf("background process %d finished: ", job->lastPid);
+  if (WIFEXITED(job->status))
+  {
+    printf("exit value %d\n", WEXITSTATUS(job->status));
+  }
+  else if (WIFSIGNALED(job->status))
   {
-    return;  // No processes to reap
+    printf("terminated by signal %d\n", WTERMSIG(job->status));
+  }
+  if (job->timed)
+  {
+    fflush(stdout);
+    print_times(&job->usage, seconds_since(&job->start), job_status(job),
+                job->timed);
+  }
+}
+
+/**
+ * Reaps every finished child without blocking, adding up the resources
+ * each job's processes used, and notes the children that were stopped
+ * or continued. A background job is reported once the last of its
+ * processes is reaped, with the status of the last command of its
+ * pipeline; a foreground job is only updated for the shell to collect.
+ * The reports are flushed together after the batch, so a burst of
+ * finished jobs costs one write rather than one per job.
+ *
+ * @param jobs The pointer to the table of jobs
+ * @param prompt If not NULL, the reports interrupt a prompt: they start
+ *        on a new line and the prompt is shown again after them
+ * @return The number of background jobs reported
+ */
+int
+reap(struct JobTable *jobs, const char *prompt)
+{
+  int reported = 0;
+  if (jobs == NULL || jobs->size == 0) 
+  {
+    return reported;  // No processes to reap
   }
 
   // Attempt to reap a process and report its exit status
   int reapedPid;
   int childStatus;
-  int exitStatus;
+  struct rusage usage;
 
-  do 
+  while ((reapedPid = wait4(-1, &childStatus,
+                            WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0)
   {
-    reapedPid = waitpid(-1, &childStatus, WNOHANG);
-    if (reapedPid > 0)
+    struct Job *job = find_job(jobs, reapedPid);
+    if (job == NULL)
     {
-      // Process has finished
-      printf("background process %d finished: ", reapedPid);
-      if WIFEXITED(childStatus)
-      {
-        exitStatus = WEXITSTATUS(childStatus);
-        printf("exit value %d\n", exitStatus);
-      }
-      else if (WIFSIGNALED(childStatus))
-      {
-        exitStatus = WTERMSIG(childStatus);
-        printf("terminated by signal %d\n", exitStatus);     
-      }
+      continue; // not a background process
+    }
+    if (WIFSTOPPED(childStatus))
+    {
+      job->stoppedProcs++;
+      continue;
+    }
+    if (WIFCONTINUED(childStatus))
+    {
+      job->stoppedProcs -= job->stoppedProcs > 0;
+      continue;
+    }
+    forget_pid(jobs, reapedPid);
+    add_usage(&job->usage, &usage);
+    if (tracing)
+    {
+      trace_event(TRACE_EXIT, 0, reapedPid, WIFEXITED(childStatus) ?
+                  WEXITSTATUS(childStatus) : -WTERMSIG(childStatus), NULL);
+    }
+    if (reapedPid == job->lastPid)
+    {
+      job->status = childStatus;
+    }
+    if (--job->liveProcs < job->stoppedProcs)
+    {
+      job->stoppedProcs = job->liveProcs; // killed while stopped
+    }
+    if (job->liveProcs > 0 || !job->background)
+    {
+      continue; // still running, or the shell is waiting on it
+    }
+
+    // Job has finished
+    if (prompt != NULL && reported == 0)
+    {
+      printf("\n");
+    }
+    ++reported;
+    report_job(job);
+    lastBgStatus = job_status(job);
+    ++bgDone;
+    --bgRunning;
+    finish_job(jobs, job);
+  }
+  if (reported > 0)
+  {
+    if (prompt != NULL)
+    {
+      fputs(prompt, stdout);
+    }
+    fflush(stdout);
+  }
+  return reported;
+}
+
+/**
+ * Waits for the given background job to finish, as the wait and fg
+ * built-in commands do. The job is claimed from reap() meanwhile so its
+ * status is not lost. Waiting in the foreground first continues the job
+ * if it was stopped, and reports it like a foreground command; otherwise
+ * it is reported like any finished background job.
+ *
+ * @param jobs The pointer to the table of jobs
+ * @param job The pointer to the Job to wait for
+ * @param foreground Boolean for bringing the job to the foreground
+ * @return The exit value of the job, or its negated terminating signal
+ */
+int
+wait_job(struct JobTable *jobs, struct Job *job, int foreground)
+{
+  sigset_t block_set;
+  sigemptyset(&block_set);
+  sigaddset(&block_set, SIGTSTP);
+  sigprocmask(SIG_BLOCK, &block_set, NULL); // as for a foreground command
+
+  bgRunning -= job->background;
+  job->background = 0;
+  if (foreground && job->stoppedProcs > 0 && kill(-job->pgid, SIGCONT))
+  {
+    perror("kill()");
+  }
+  while (job->liveProcs > 0)
+  {
+    wait_for_children();
+  }
+
+  int exitStatus = job_status(job);
+  if (!foreground)
+  {
+    report_job(job);
+    fflush(stdout);
+  }
+  else
+  {
+    if (exitStatus < 0)
+    {
+      printf("terminated by signal %d\n", -exitStatus);
       fflush(stdout);
-      delete_node(bgLlist, reapedPid);
+    }
+    if (job->timed)
+    {
+      print_times(&job->usage, seconds_since(&job->start), exitStatus,
+                  job->timed);
     }
   }
-  while (reapedPid > 0);
+  finish_job(jobs, job);
+  sigprocmask(SIG_UNBLOCK, &block_set, NULL);
+  return exitStatus;
 }
 
 /**
- * Iterates over the list of background processes to kill them.
+ * Waits for the next background job to finish, whichever it is.
  *
- * @param bgLlist The pointer to the list of background processes
+ * @return The exit value of the job, its negated terminating signal, or
+ *         127 if there are no background jobs
  */
-void 
-kill_bg(struct Llist *bgLlist)
+int
+wait_next(void)
 {
-  struct Node *current = bgLlist->head;
-  while (current != NULL)
+  unsigned long done = bgDone;
+  while (bgDone == done)
   {
-    if (kill(current->value, SIGTERM))
+    if (bgRunning == 0)
     {
-      perror("kill()");
+      return 127;
     }
-    current = current->next;
+    wait_for_children();
+  }
+  return lastBgStatus;
+}
+
+/**
+ * Waits for every background job to finish, reporting each one as it
+ * does.
+ */
+void
+wait_all(void)
+{
+  while (bgRunning > 0)
+  {
+    wait_for_children();
+  }
+}
+
+/**
+ * Sends a signal to the processes of a job that are still running,
+ * continuing them first if any are stopped so they act on it.
+ *
+ * @param job The pointer to the Job
+ * @param signo The signal to send
+ */
+static void
+signal_job(const struct Job *job, int signo)
+{
+  if (job->liveProcs == 0)
+  {
+    return;
+  }
+  if (kill(-job->pgid, signo) && errno != ESRCH)
+  {
+    perror("kill()"); // ESRCH: all exited, waiting to be reaped
+  }
+  if (job->stoppedProcs > 0)
+  {
+    kill(-job->pgid, SIGCONT);
+  }
+}
+
+/**
+ * Sends a signal to every process the table still holds, one at a
+ * time, continuing each so it acts on it. This reaches stages of a
+ * pipeline outside their job's process group.
+ *
+ * @param jobs The pointer to the table of jobs
+ * @param signo The signal to send
+ */
+static void
+signal_pids(struct JobTable *jobs, int signo)
+{
+  for (size_t i = 0; i < jobs->capacity; ++i)
+  {
+    if (jobs->slots[i].pid != 0)
+    {
+      kill(jobs->slots[i].pid, signo);
+      kill(jobs->slots[i].pid, SIGCONT);
+    }
+  }
+}
+
+/**
+ * Removes the finished jobs at the head of the table.
+ *
+ * @param jobs The pointer to the table of jobs
+ * @return Boolean for jobs being left
+ */
+static int
+remove_finished(struct JobTable *jobs)
+{
+  struct Job *job;
+  while ((job = get_job(jobs, jobs->head)) != NULL && job->liveProcs == 0)
+  {
+    finish_job(jobs, job);
+  }
+  return job != NULL;
+}
+
+/**
+ * Waits up to KILL_GRACE seconds for the jobs to finish, removing the
+ * finished ones.
+ *
+ * @param jobs The pointer to the table of jobs
+ */
+static void
+reap_for_grace(struct JobTable *jobs)
+{
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  double left;
+  while (remove_finished(jobs) &&
+         (left = KILL_GRACE - seconds_since(&start)) > 0)
+  {
+    wait_for_children_timed(left * 1000 + 1);
+  }
+}
+
+/**
+ * Ends every background job as the shell exits. The jobs are claimed so
+ * none is reported, sent SIGTERM and given KILL_GRACE seconds to exit;
+ * the ones still running then get SIGKILL and KILL_GRACE seconds more
+ * to be reaped. Each signal goes to the job's process group and to each
+ * of its processes, so however many jobs there are, the shell exits in
+ * bounded time and leaves no zombies behind.
+ *
+ * @param jobs The pointer to the table of background jobs
+ */
+void 
+kill_bg(struct JobTable *jobs)
+{
+  for (struct Job *job = get_job(jobs, jobs->head); job != NULL;
+       job = get_job(jobs, job->next))
+  {
+    job->background = 0;
+    signal_job(job, SIGTERM);
+  }
+  signal_pids(jobs, SIGTERM);
+  bgRunning = 0;
+  reap_for_grace(jobs);
+
+  for (struct Job *job = get_job(jobs, jobs->head); job != NULL;
+       job = get_job(jobs, job->next))
+  {
+    signal_job(job, SIGKILL);
   }
+  signal_pids(jobs, SIGKILL);
+  reap_for_grace(jobs);
 }
@@ -1,15 +1,36 @@
 #ifndef PROCESS_CONTROL_H
 #define PROCESS_CONTROL_H
 
-#include "llist.h"
+#include <sys/resource.h>
+#include <time.h>
+
+#include "job_table.h"
 #include "input_parsing.h"
 
-int fork_child_fg(struct Input *input);
-struct Node * fork_child_bg(struct Input *input);
-int redirect_input(char *filename);
-int redirect_output(char *filename);
-int exec_input(char **args);
-void reap(struct Llist *bgLlist);
-void kill_bg(struct Llist *bgLlist);
+struct Timer // start of a timed command the shell runs itself
+{
+  struct timespec start;
+  struct rusage self;     // the shell's own usage at the start
+  struct rusage children; // usage of the reaped children at the start
+};
+
+int fork_child_fg(struct Input *input, struct JobTable *jobs);
+int capture_child_fg(struct Input *input, struct JobTable *jobs,
+                     char **output, size_t *len);
+char * read_output(int fd, size_t *len);
+int open_capture(void);
+struct Job * fork_child_bg(struct Input *input, struct JobTable *jobs);
+struct Job * fork_shell_bg(int (*run)(void *data), void *data,
+                           const char *command, struct JobTable *jobs);
+int run_parallel(struct Input *input, int maxJobs, int itemFd,
+                 struct JobTable *jobs);
+int open_here(const char *text, size_t len);
+int reap(struct JobTable *jobs, const char *prompt);
+int wait_job(struct JobTable *jobs, struct Job *job, int foreground);
+int wait_next(void);
+void wait_all(void);
+void kill_bg(struct JobTable *jobs);
+void start_timer(struct Timer *timer);
+void report_timer(const struct Timer *timer, int status, int format);
 
 #endif
\ No newline at end of file
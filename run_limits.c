@@ -0,0 +1,270 @@
+/**
+ * Definitions for the scheduling settings and resource limits of run.
+ *
+ * "run" is a prefix like "time": its options are checked when the line
+ * is parsed, and the settings are applied by each child of the job
+ * between fork and exec, since posix_spawn has no way to set them.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "run_limits.h"
+
+/**
+ * Clears every setting.
+ *
+ * @param limits The pointer to the RunLimits
+ */
+void
+init_limits(struct RunLimits *limits)
+{
+  memset(limits, 0, sizeof(*limits));
+}
+
+/**
+ * Parses a list of CPU numbers and ranges, such as "0-3,6".
+ *
+ * @param cpus The bit set to fill
+ * @param list The list
+ * @return -1 for an invalid list, 0 for success
+ */
+static int
+parse_cpus(unsigned long *cpus, const char *list)
+{
+  const char *p = list;
+  do
+  {
+    char *end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (end == p || first < 0)
+    {
+      return -1;
+    }
+    if (*end == '-')
+    {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first)
+      {
+        return -1;
+      }
+    }
+    if (last >= RUN_MAX_CPUS || (*end != ',' && *end != '\0'))
+    {
+      return -1;
+    }
+    for (long cpu = first; cpu <= last; ++cpu)
+    {
+      cpus[cpu / (8 * sizeof(unsigned long))] |=
+        1UL << (cpu % (8 * sizeof(unsigned long)));
+    }
+    p = end + 1;
+  } while (p[-1] == ',');
+  return 0;
+}
+
+/**
+ * Parses a limit, which may end in K, M or G for binary multiples.
+ *
+ * @param value The text of the limit
+ * @param limit Set to the limit
+ * @return -1 for an invalid limit, 0 for success
+ */
+static int
+parse_rlim(const char *value, rlim_t *limit)
+{
+  char *end;
+  errno = 0;
+  unsigned long long n = strtoull(value, &end, 10);
+  if (end == value || value[0] == '-' || errno != 0)
+  {
+    return -1;
+  }
+  const char *units = "KMG";
+  const char *unit = *end ? strchr(units, *end) : NULL;
+  if (unit != NULL)
+  {
+    int shift = 10 * (unit - units + 1);
+    if (n > (ULLONG_MAX >> shift))
+    {
+      return -1;
+    }
+    n <<= shift;
+    ++end;
+  }
+  if (*end != '\0')
+  {
+    return -1;
+  }
+  *limit = n;
+  return 0;
+}
+
+/**
+ * Records one option of run, reporting any that is not valid.
+ *
+ * @param limits The pointer to the RunLimits
+ * @param option The option: --cpus, --nice, --sched or --rlimit
+ * @param value Its value: a CPU list, a nice level, batch, idle or
+ *        other, or one of as=BYTES, cpu=SECONDS and nofile=COUNT
+ * @return -1 for an invalid option, 0 for success
+ */
+int
+set_limit(struct RunLimits *limits, const char *option, const char *value)
+{
+  int valid = 0;
+  if (!strcmp(option, "--cpus"))
+  {
+    memset(limits->cpus, 0, sizeof(limits->cpus));
+    valid = parse_cpus(limits->cpus, value) == 0;
+    limits->flags |= RUN_CPUS;
+  }
+  else if (!strcmp(option, "--nice"))
+  {
+    char *end;
+    long nice = strtol(value, &end, 10);
+    valid = end != value && *end == '\0' && nice >= -20 && nice <= 19;
+    limits->nice = nice;
+    limits->flags |= RUN_NICE;
+  }
+  else if (!strcmp(option, "--sched"))
+  {
+    valid = 1;
+    if (!strcmp(value, "batch"))
+    {
+      limits->sched = RUN_SCHED_BATCH;
+    }
+    else if (!strcmp(value, "idle"))
+    {
+      limits->sched = RUN_SCHED_IDLE;
+    }
+    else if (!strcmp(value, "other"))
+    {
+      limits->sched = RUN_SCHED_OTHER;
+    }
+    else
+    {
+      valid = 0;
+    }
+    limits->flags |= RUN_SCHED;
+  }
+  else if (!strcmp(option, "--rlimit"))
+  {
+    if (!strncmp(value, "as=", 3))
+    {
+      valid = parse_rlim(value + 3, &limits->as) == 0;
+      limits->flags |= RUN_AS;
+    }
+    else if (!strncmp(value, "cpu=", 4))
+    {
+      valid = parse_rlim(value + 4, &limits->cpu) == 0;
+      limits->flags |= RUN_CPU_TIME;
+    }
+    else if (!strncmp(value, "nofile=", 7))
+    {
+      valid = parse_rlim(value + 7, &limits->nofile) == 0;
+      limits->flags |= RUN_NOFILE;
+    }
+  }
+  else
+  {
+    fprintf(stderr, "run: unknown option '%s'\n" RUN_USAGE, option);
+    fflush(stderr);
+    return -1;
+  }
+  if (!valid)
+  {
+    fprintf(stderr, "run: invalid value '%s' for %s\n", value, option);
+    fflush(stderr);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Sets a soft and hard resource limit, never raising the hard one.
+ *
+ * @param resource The RLIMIT_* resource
+ * @param value The limit
+ * @return -1 for failure, 0 for success
+ */
+static int
+lower_rlimit(int resource, rlim_t value)
+{
+  struct rlimit limit;
+  if (getrlimit(resource, &limit) == -1)
+  {
+    return -1;
+  }
+  if (limit.rlim_max != RLIM_INFINITY && value > limit.rlim_max)
+  {
+    value = limit.rlim_max;
+  }
+  limit.rlim_cur = limit.rlim_max = value;
+  return setrlimit(resource, &limit);
+}
+
+/**
+ * Applies the settings to the calling process, which is meant to be a
+ * child about to execute the job's command.
+ *
+ * @param limits The pointer to the RunLimits
+ * @return -1 for failure with errno set, 0 for success
+ */
+int
+apply_limits(const struct RunLimits *limits)
+{
+  if (limits->flags & RUN_CPUS)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu = 0; cpu < RUN_MAX_CPUS && cpu < CPU_SETSIZE; ++cpu)
+    {
+      if (limits->cpus[cpu / (8 * sizeof(unsigned long))] &
+          (1UL << (cpu % (8 * sizeof(unsigned long)))))
+      {
+        CPU_SET(cpu, &set);
+      }
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+    {
+      return -1;
+    }
+  }
+  if (limits->flags & RUN_SCHED)
+  {
+    static const int policies[] = {
+      [RUN_SCHED_OTHER] = SCHED_OTHER,
+      [RUN_SCHED_BATCH] = SCHED_BATCH,
+      [RUN_SCHED_IDLE] = SCHED_IDLE,
+    };
+    struct sched_param param = {0};
+    if (sched_setscheduler(0, policies[limits->sched], &param) == -1)
+    {
+      return -1;
+    }
+  }
+  if ((limits->flags & RUN_NICE) &&
+      setpriority(PRIO_PROCESS, 0, limits->nice) == -1)
+  {
+    return -1;
+  }
+  if (((limits->flags & RUN_AS) && lower_rlimit(RLIMIT_AS, limits->as)) ||
+      ((limits->flags & RUN_CPU_TIME) &&
+       lower_rlimit(RLIMIT_CPU, limits->cpu)) ||
+      ((limits->flags & RUN_NOFILE) &&
+       lower_rlimit(RLIMIT_NOFILE, limits->nofile)))
+  {
+    return -1;
+  }
+  return 0;
+}
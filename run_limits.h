@@ -0,0 +1,46 @@
+/* Header file for the scheduling settings and resource limits of run */
+
+#ifndef RUN_LIMITS_H
+#define RUN_LIMITS_H
+
+#include <sys/resource.h>
+
+#define RUN_CPUS 1      // --cpus: restrict the CPUs the job may use
+#define RUN_NICE 2      // --nice: set the nice level
+#define RUN_SCHED 4     // --sched: set the scheduling policy
+#define RUN_AS 8        // --rlimit as=: limit the address space
+#define RUN_CPU_TIME 16 // --rlimit cpu=: limit the CPU seconds
+#define RUN_NOFILE 32   // --rlimit nofile=: limit the open files
+
+#define RUN_USAGE "Usage: run [--cpus LIST] [--nice N] " \
+  "[--sched batch|idle|other] [--rlimit as|cpu|nofile=N]... COMMAND\n"
+
+#define RUN_MAX_CPUS 1024 // highest CPU number plus one
+#define RUN_CPU_WORDS (RUN_MAX_CPUS / (8 * sizeof(unsigned long)))
+
+enum RunSched
+{
+  RUN_SCHED_OTHER,
+  RUN_SCHED_BATCH,
+  RUN_SCHED_IDLE
+};
+
+struct RunLimits // settings applied to each process of a job
+{
+  int flags; // RUN_* settings given
+  unsigned long cpus[RUN_CPU_WORDS]; // bit set of the CPUs to run on
+  int nice;
+  enum RunSched sched;
+  rlim_t as;     // bytes
+  rlim_t cpu;    // seconds
+  rlim_t nofile; // descriptors
+  char **words;  // the options as given, for job listings
+  int numWords;
+};
+
+void init_limits(struct RunLimits *limits);
+int set_limit(struct RunLimits *limits, const char *option,
+              const char *value);
+int apply_limits(const struct RunLimits *limits);
+
+#endif
@@ -0,0 +1,719 @@
+/**
+ * Definitions for the cache of compiled scripts.
+ *
+ * When SMALLSH_CACHE names a directory, a script run as "smallsh FILE"
+ * is compiled into a file there once, and later runs map that file
+ * instead of lexing and parsing the script again. The file holds a
+ * header, one record per command line and a pool of strings. Records
+ * are arrays of 32-bit words that refer to strings by their offset in
+ * the pool, so the file can be mapped anywhere and used in place: the
+ * arguments of a compiled command point straight into the mapping.
+ *
+ * Most statements are a single pipeline, kept already parsed as its
+ * stages with arguments and redirections. One whose words are expanded
+ * when it runs, that starts with "run" or that has a syntax error is
+ * kept as its tokens instead, and get_input() parses those when the
+ * line runs, so expansions and errors happen at the same point as
+ * without the cache. The body of a here-document is kept with the
+ * pipeline reading it. Lists and compound commands are kept as their
+ * text and parsed into a tree when they run, which still spares the
+ * script's other lines. So are all the lines after one that mentions
+ * alias, whose meaning depends on the aliases defined when they are
+ * parsed. Blank lines and comments are left out.
+ *
+ * The cache file is named after a hash of the script's full path and
+ * records the script's size, modification time and hash. A matching
+ * size and time is trusted without reading the script; when only the
+ * time differs the script is hashed, and a changed script is compiled
+ * again.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "control_flow.h"
+#include "input_parsing.h"
+#include "lexer.h"
+#include "line_reader.h"
+#include "script_cache.h"
+#include "trace.h"
+
+#define CACHE_MAGIC "smsh-ir3" // 8 bytes, changed with the format
+
+#define RECORD_COMMAND 1 // a parsed pipeline
+#define RECORD_TOKENS 2  // the tokens of a line parsed when it runs
+#define RECORD_TEXT 3    // a statement parsed from its text when it runs
+
+#define NO_STRING UINT32_MAX // offset standing for a NULL string
+
+struct CacheHeader // start of a compiled script
+{
+  char magic[8];
+  uint64_t hash;      // hash of the script's contents
+  int64_t mtimeSec;   // modification time of the script
+  int64_t mtimeNsec;
+  uint64_t size;      // length of the script
+  uint32_t numRecords;
+  uint32_t pool;      // offset of the string pool in the file
+  uint32_t path;      // offset of the script's full path in the pool
+  uint32_t length;    // length of the file
+};
+
+/*
+ * Every record starts with its kind and its length in words.
+ *
+ * RECORD_COMMAND: flags (timed | background << 2 | assign << 3), the
+ * number of stages, then for each stage its number of arguments, the
+ * infile, outfile and here strings, the length of here and the
+ * arguments.
+ *
+ * RECORD_TOKENS: the number of tokens including the last one, the
+ * string of here-document bodies following the line, then for each
+ * token its type | flags << 8 and its text.
+ *
+ * RECORD_TEXT: the string of the statement's lines.
+ */
+
+struct Buffer // growable array of bytes for building a compiled script
+{
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
+/**
+ * Computes the 64-bit FNV-1a hash of the given bytes.
+ *
+ * @param s The bytes to hash
+ * @param len The number of bytes
+ * @return The hash value
+ */
+static uint64_t
+hash_bytes(const char *s, size_t len)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; ++i)
+  {
+    h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+/**
+ * Appends bytes to a Buffer, growing it as needed.
+ *
+ * @param buf The pointer to the Buffer
+ * @param data The bytes to append
+ * @param len The number of bytes
+ */
+static void
+append(struct Buffer *buf, const void *data, size_t len)
+{
+  if (buf->len + len > buf->cap)
+  {
+    buf->cap = buf->cap ? buf->cap : 4096;
+    while (buf->len + len > buf->cap)
+    {
+      buf->cap *= 2;
+    }
+    buf->data = realloc(buf->data, buf->cap);
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+}
+
+/**
+ * Appends one word to a record.
+ *
+ * @param records The pointer to the Buffer of records
+ * @param word The word
+ */
+static void
+put_word(struct Buffer *records, uint32_t word)
+{
+  append(records, &word, sizeof(word));
+}
+
+/**
+ * Adds a string to the pool.
+ *
+ * @param pool The pointer to the Buffer of strings
+ * @param s The string, or NULL
+ * @param len The length of the string
+ * @return The offset of the string in the pool, or NO_STRING for NULL
+ */
+static uint32_t
+put_string(struct Buffer *pool, const char *s, size_t len)
+{
+  if (s == NULL)
+  {
+    return NO_STRING;
+  }
+  uint32_t offset = pool->len;
+  append(pool, s, len);
+  append(pool, "", 1);
+  return offset;
+}
+
+/**
+ * Stores a parsed pipeline as a RECORD_COMMAND.
+ *
+ * @param records The pointer to the Buffer of records
+ * @param pool The pointer to the Buffer of strings
+ * @param input The first command of the pipeline
+ */
+static void
+compile_command(struct Buffer *records, struct Buffer *pool,
+                struct Input *input)
+{
+  size_t start = records->len;
+  uint32_t numStages = 0;
+  for (struct Input *stage = input; stage != NULL; stage = stage->next)
+  {
+    ++numStages;
+  }
+  put_word(records, RECORD_COMMAND);
+  put_word(records, 0);
+  put_word(records, input->timed | input->background << 2 |
+                    input->assign << 3);
+  put_word(records, numStages);
+  for (struct Input *stage = input; stage != NULL; stage = stage->next)
+  {
+    put_word(records, stage->numArgs);
+    put_word(records, put_string(pool, stage->infile, stage->infile ?
+                                 strlen(stage->infile) : 0));
+    put_word(records, put_string(pool, stage->outfile, stage->outfile ?
+                                 strlen(stage->outfile) : 0));
+    put_word(records, put_string(pool, stage->here, stage->hereLen));
+    put_word(records, stage->hereLen);
+    for (int i = 0; i < stage->numArgs; ++i)
+    {
+      put_word(records, put_string(pool, stage->args[i],
+                                   strlen(stage->args[i])));
+    }
+  }
+  ((uint32_t *)(records->data + start))[1] =
+    (records->len - start) / sizeof(uint32_t);
+}
+
+/**
+ * Stores the tokens of a line as a RECORD_TOKENS.
+ *
+ * @param records The pointer to the Buffer of records
+ * @param pool The pointer to the Buffer of strings
+ * @param tokens The tokens, ending with a TOKEN_END or TOKEN_ERROR
+ * @param body The here-document bodies following the line, or NULL
+ * @param bodyLen The length of the bodies
+ */
+static void
+compile_tokens(struct Buffer *records, struct Buffer *pool,
+               const struct Token *tokens, const char *body, size_t bodyLen)
+{
+  size_t start = records->len;
+  uint32_t count = 0;
+  while (tokens[count].type != TOKEN_END &&
+         tokens[count].type != TOKEN_ERROR)
+  {
+    ++count;
+  }
+  put_word(records, RECORD_TOKENS);
+  put_word(records, 0);
+  put_word(records, count + 1);
+  put_word(records, put_string(pool, body, bodyLen));
+  for (uint32_t i = 0; i <= count; ++i)
+  {
+    const char *text = tokens[i].text;
+    put_word(records, tokens[i].type | tokens[i].flags << 8);
+    put_word(records, put_string(pool, text, text ? strlen(text) : 0));
+  }
+  ((uint32_t *)(records->data + start))[1] =
+    (records->len - start) / sizeof(uint32_t);
+}
+
+/**
+ * Stores the text of a statement as a RECORD_TEXT.
+ *
+ * @param records The pointer to the Buffer of records
+ * @param pool The pointer to the Buffer of strings
+ * @param text The lines of the statement
+ * @param len The length of the lines
+ */
+static void
+compile_text(struct Buffer *records, struct Buffer *pool, const char *text,
+             size_t len)
+{
+  put_word(records, RECORD_TEXT);
+  put_word(records, 3);
+  put_word(records, put_string(pool, text, len));
+}
+
+/**
+ * Compiles the statements of a script into records and their strings.
+ *
+ * @param src The script, '\0'-terminated
+ * @param records The pointer to the Buffer for the records
+ * @param pool The pointer to the Buffer for the strings
+ * @return The number of records
+ */
+static uint32_t
+compile_statements(const char *src, struct Buffer *records,
+                   struct Buffer *pool)
+{
+  struct Arena *arena = init_arena(4096);
+  struct LineReader *reader = init_reader_str(src);
+  uint32_t numRecords = 0;
+  int aliased = 0; // Boolean for aliases changing from here on
+  for (;;)
+  {
+    size_t start = reader->start;
+    quiet_syntax(1);
+    struct Node *statement = get_statement(reader, NULL, arena);
+    int failed = syntax_failed();
+    quiet_syntax(0);
+    if (statement == NULL)
+    {
+      break;
+    }
+
+    struct Node *node = statement->body;
+    size_t len = reader->start - start;
+    aliased = aliased || memmem(src + start, len, "alias", 5) != NULL;
+    if (failed || (aliased && node != NULL) ||
+        (node != NULL && (node->type != NODE_COMMAND || node->next != NULL)))
+    { // errors are reported when the statement runs
+      compile_text(records, pool, src + start, len);
+    }
+    else if (node == NULL ||
+             (node->input != NULL && node->input->args == NULL))
+    { // nothing to run: a blank line, comment or only a redirection
+      arena_reset(arena);
+      continue;
+    }
+    else if (node->input != NULL)
+    {
+      compile_command(records, pool, node->input);
+    }
+    else
+    {
+      compile_tokens(records, pool, node->tokens, node->here,
+                     node->here ? strlen(node->here) : 0);
+    }
+    ++numRecords;
+    arena_reset(arena);
+  }
+  cleanup_reader(reader);
+  cleanup_arena(arena);
+  return numRecords;
+}
+
+/**
+ * Reads a whole script.
+ *
+ * @param fd The file descriptor of the script
+ * @param size The length of the script
+ * @return The allocated contents, or NULL on error
+ */
+static char *
+read_source(int fd, size_t size)
+{
+  char *src = malloc(size + 1);
+  size_t done = 0;
+  while (done < size)
+  {
+    ssize_t n = pread(fd, src + done, size - done, done);
+    if (n == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      free(src);
+      return NULL;
+    }
+    done += n;
+  }
+  src[size] = '\0';
+  return src;
+}
+
+/**
+ * Wraps a compiled script's bytes for running its records.
+ *
+ * @param base The compiled script
+ * @param size Its length
+ * @param mapped Boolean for base being a mapping rather than allocated
+ * @return The pointer to the new CompiledScript
+ */
+static struct CompiledScript *
+init_script(char *base, size_t size, int mapped)
+{
+  const struct CacheHeader *header = (const struct CacheHeader *)base;
+  struct CompiledScript *script = malloc(sizeof(struct CompiledScript));
+  script->base = base;
+  script->size = size;
+  script->mapped = mapped;
+  script->record = (const uint32_t *)(base + sizeof(struct CacheHeader));
+  script->left = header->numRecords;
+  script->pool = base + header->pool;
+  return script;
+}
+
+/**
+ * Maps the cache file of a script if it is still up to date, refreshing
+ * the time it records when only the script's time changed.
+ *
+ * @param cachePath The path of the cache file
+ * @param path The full path of the script
+ * @param fd The file descriptor of the script
+ * @param st The status of the script
+ * @return The pointer to the CompiledScript, or NULL if there is no
+ *         usable cache file
+ */
+static struct CompiledScript *
+map_cache(const char *cachePath, const char *path, int fd,
+          const struct stat *st)
+{
+  int cacheFd = open(cachePath, O_RDWR | O_CLOEXEC);
+  if (cacheFd == -1)
+  {
+    return NULL;
+  }
+  struct stat cacheSt;
+  char *base = MAP_FAILED;
+  if (fstat(cacheFd, &cacheSt) == 0 &&
+      cacheSt.st_size > (off_t)sizeof(struct CacheHeader))
+  {
+    // Private and writable, though nothing is meant to write to it
+    base = mmap(NULL, cacheSt.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                cacheFd, 0);
+  }
+  if (base == MAP_FAILED)
+  {
+    close(cacheFd);
+    return NULL;
+  }
+
+  size_t size = cacheSt.st_size;
+  struct CacheHeader *header = (struct CacheHeader *)base;
+  int valid = !memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) &&
+              header->length == size && base[size - 1] == '\0' &&
+              header->pool < size && header->path < size - header->pool &&
+              !strcmp(base + header->pool + header->path, path) &&
+              header->size == (uint64_t)st->st_size;
+  if (valid && (header->mtimeSec != st->st_mtim.tv_sec ||
+                header->mtimeNsec != st->st_mtim.tv_nsec))
+  { // touched, but maybe not changed
+    char *src = read_source(fd, st->st_size);
+    valid = src != NULL && hash_bytes(src, st->st_size) == header->hash;
+    free(src);
+    if (valid)
+    {
+      int64_t mtime[2] = {st->st_mtim.tv_sec, st->st_mtim.tv_nsec};
+      pwrite(cacheFd, mtime, sizeof(mtime),
+             offsetof(struct CacheHeader, mtimeSec));
+    }
+  }
+  close(cacheFd);
+  if (!valid)
+  {
+    munmap(base, size);
+    return NULL;
+  }
+  return init_script(base, size, 1);
+}
+
+/**
+ * Writes a compiled script to its cache file, through a temporary file
+ * renamed into place so concurrent runs never see half of it.
+ *
+ * @param cachePath The path of the cache file
+ * @param data The compiled script
+ * @param len Its length
+ */
+static void
+write_cache(const char *cachePath, const char *data, size_t len)
+{
+  char *tmpPath = malloc(strlen(cachePath) + 32);
+  sprintf(tmpPath, "%s.%ld", cachePath, (long)getpid());
+  int fd = open(tmpPath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd == -1)
+  {
+    free(tmpPath);
+    return;
+  }
+  size_t done = 0;
+  while (done < len)
+  {
+    ssize_t n = write(fd, data + done, len - done);
+    if (n == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      break;
+    }
+    done += n;
+  }
+  if (close(fd) == -1 || done < len || rename(tmpPath, cachePath) == -1)
+  {
+    unlink(tmpPath);
+  }
+  free(tmpPath);
+}
+
+/**
+ * Compiles a script and saves it in its cache file. The compiled script
+ * is run from memory, so a cache directory that cannot be written only
+ * costs the compiling.
+ *
+ * @param cachePath The path of the cache file
+ * @param path The full path of the script
+ * @param fd The file descriptor of the script
+ * @param st The status of the script
+ * @return The pointer to the CompiledScript, or NULL on error
+ */
+static struct CompiledScript *
+compile_script(const char *cachePath, const char *path, int fd,
+               const struct stat *st)
+{
+  char *src = read_source(fd, st->st_size);
+  if (src == NULL)
+  {
+    return NULL;
+  }
+  struct Buffer records = {NULL, 0, 0};
+  struct Buffer pool = {NULL, 0, 0};
+  uint32_t pathOffset = put_string(&pool, path, strlen(path));
+  struct CacheHeader header;
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.hash = hash_bytes(src, st->st_size);
+  header.mtimeSec = st->st_mtim.tv_sec;
+  header.mtimeNsec = st->st_mtim.tv_nsec;
+  header.size = st->st_size;
+  header.numRecords = compile_statements(src, &records, &pool);
+  header.pool = sizeof(header) + records.len;
+  header.path = pathOffset;
+  header.length = header.pool + pool.len;
+  free(src);
+
+  struct Buffer file = {NULL, 0, 0};
+  append(&file, &header, sizeof(header));
+  append(&file, records.data, records.len);
+  append(&file, pool.data, pool.len);
+  free(records.data);
+  free(pool.data);
+  write_cache(cachePath, file.data, file.len);
+  return init_script(file.data, file.len, 0);
+}
+
+/**
+ * Loads the compiled form of a script when SMALLSH_CACHE names a cache
+ * directory, compiling the script if it has no up-to-date cache file.
+ *
+ * @param path The path of the script
+ * @param fd The file descriptor of the script
+ * @return The pointer to the CompiledScript, or NULL to read the script
+ *         as text
+ */
+struct CompiledScript *
+load_script(const char *path, int fd)
+{
+  const char *dir = getenv("SMALLSH_CACHE");
+  struct stat st;
+  if (dir == NULL || dir[0] == '\0' || fstat(fd, &st) == -1 ||
+      !S_ISREG(st.st_mode) || st.st_size >= UINT32_MAX / 2)
+  {
+    return NULL;
+  }
+  char *fullPath = realpath(path, NULL);
+  if (fullPath == NULL)
+  {
+    return NULL;
+  }
+  mkdir(dir, 0700);
+  char *cachePath = malloc(strlen(dir) + 32);
+  sprintf(cachePath, "%s/%016llx.smc", dir,
+          (unsigned long long)hash_bytes(fullPath, strlen(fullPath)));
+
+  struct CompiledScript *script = map_cache(cachePath, fullPath, fd, &st);
+  if (script == NULL)
+  {
+    script = compile_script(cachePath, fullPath, fd, &st);
+  }
+  free(cachePath);
+  free(fullPath);
+  return script;
+}
+
+/**
+ * Returns the string at the given offset in the pool.
+ *
+ * @param script The pointer to the CompiledScript
+ * @param offset The offset, or NO_STRING
+ * @return The string, or NULL
+ */
+static char *
+pool_string(const struct CompiledScript *script, uint32_t offset)
+{
+  return offset == NO_STRING ? NULL : script->pool + offset;
+}
+
+/**
+ * Rebuilds the Input structs of a RECORD_COMMAND, with the arguments
+ * and paths pointing into the pool.
+ *
+ * @param script The pointer to the CompiledScript
+ * @param w The record
+ * @param arena The pointer to the Arena for the structs
+ * @return The pointer to the first command of the pipeline
+ */
+static struct Input *
+run_command(const struct CompiledScript *script, const uint32_t *w,
+            struct Arena *arena)
+{
+  struct Input *input = NULL;
+  struct Input **link = &input;
+  uint32_t flags = w[2];
+  uint32_t numStages = w[3];
+  w += 4;
+  for (uint32_t s = 0; s < numStages; ++s)
+  {
+    struct Input *stage = init_input(arena);
+    stage->numArgs = w[0];
+    stage->infile = pool_string(script, w[1]);
+    stage->outfile = pool_string(script, w[2]);
+    stage->here = pool_string(script, w[3]);
+    stage->hereLen = w[4];
+    stage->args = arena_alloc(arena, (w[0] + 1) * sizeof(char *));
+    for (uint32_t i = 0; i < w[0]; ++i)
+    {
+      stage->args[i] = pool_string(script, w[5 + i]);
+    }
+    stage->args[w[0]] = NULL;
+    *link = stage;
+    link = &stage->next;
+    w += 5 + w[0];
+  }
+  input->timed = flags & 3;
+  input->background = (flags >> 2) & 1;
+  input->assign = (flags >> 3) & 1;
+  return input;
+}
+
+/**
+ * Rebuilds the pipeline of a RECORD_TOKENS, left to be parsed when it
+ * runs, with the bodies of its here-documents.
+ *
+ * @param script The pointer to the CompiledScript
+ * @param w The record
+ * @param arena The pointer to the Arena for the tokens and node
+ * @return The pointer to the NODE_COMMAND
+ */
+static struct Node *
+run_tokens(const struct CompiledScript *script, const uint32_t *w,
+           struct Arena *arena)
+{
+  uint32_t count = w[2];
+  struct Token *tokens = arena_alloc(arena, count * sizeof(struct Token));
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    tokens[i].type = w[4 + 2 * i] & 0xff;
+    tokens[i].flags = w[4 + 2 * i] >> 8;
+    tokens[i].text = pool_string(script, w[5 + 2 * i]);
+  }
+  struct Node *node = command_node(tokens, arena);
+  node->here = pool_string(script, w[3]);
+  return node;
+}
+
+/**
+ * Parses the statement of a RECORD_TEXT.
+ *
+ * @param script The pointer to the CompiledScript
+ * @param w The record
+ * @param arena The pointer to the Arena for the tree
+ * @return The NODE_LIST of the statement
+ */
+static struct Node *
+run_text(const struct CompiledScript *script, const uint32_t *w,
+         struct Arena *arena)
+{
+  struct LineReader *reader = init_reader_str(pool_string(script, w[2]));
+  struct Node *statement = get_statement(reader, NULL, arena);
+  cleanup_reader(reader);
+  return statement != NULL ? statement : init_node(NODE_LIST, arena);
+}
+
+/**
+ * Returns the next statement of a compiled script, as get_statement()
+ * does for a script read as text.
+ *
+ * @param script The pointer to the CompiledScript
+ * @param arena The pointer to the Arena for the tree
+ * @return The NODE_LIST of the statement's commands, or NULL at the end
+ *         of the script
+ */
+struct Node *
+next_compiled(struct CompiledScript *script, struct Arena *arena)
+{
+  if (script->left == 0)
+  {
+    return NULL;
+  }
+  const uint32_t *w = script->record;
+  script->record += w[1];
+  --script->left;
+  if (w[0] == RECORD_TEXT)
+  {
+    return run_text(script, w, arena);
+  }
+
+  long long start = tracing ? trace_clock() : 0;
+  struct Node *statement = init_node(NODE_LIST, arena);
+  if (w[0] == RECORD_COMMAND)
+  {
+    statement->body = init_node(NODE_COMMAND, arena);
+    statement->body->input = run_command(script, w, arena);
+  }
+  else
+  {
+    statement->body = run_tokens(script, w, arena);
+  }
+  if (tracing)
+  {
+    trace_event(TRACE_PARSE, start, 0, 1, NULL);
+  }
+  return statement;
+}
+
+/**
+ * Unmaps or frees a compiled script.
+ *
+ * @param script The pointer to the CompiledScript
+ */
+void
+cleanup_script(struct CompiledScript *script)
+{
+  if (script->mapped)
+  {
+    munmap(script->base, script->size);
+  }
+  else
+  {
+    free(script->base);
+  }
+  free(script);
+}
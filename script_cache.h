@@ -0,0 +1,27 @@
+/* Header file for the cache of compiled scripts */
+
+#ifndef SCRIPT_CACHE_H
+#define SCRIPT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "control_flow.h"
+
+struct CompiledScript // a script's lines in their compiled form
+{
+  char *base;     // the compiled file, mapped or in memory
+  size_t size;    // its length in bytes
+  int mapped;     // Boolean for base being a mapping of the cache file
+  const uint32_t *record; // next record to run
+  uint32_t left;  // records not run yet
+  char *pool;     // strings the records refer to
+};
+
+struct CompiledScript * load_script(const char *path, int fd);
+struct Node * next_compiled(struct CompiledScript *script,
+                            struct Arena *arena);
+void cleanup_script(struct CompiledScript *script);
+
+#endif
@@ -1,23 +1,36 @@
 /**
- * Definitions for built-in shell command functions.
+ * Definitions for built-in shell command functions, and the registry
+ * the shell finds them in.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "command_hash.h"
+#include "functions.h"
+#include "history.h"
+#include "process_control.h"
 #include "shell_commands.h"
 #include "utilities.h"
+#include "utility_commands.h"
 
 /**
- * Returns a 0 if the command to exit the shell is successful, or 1
- * otherwise.
+ * Asks the shell to exit once the command returns, keeping the status
+ * of the last command as the shell's exit status.
  *
  * @param input The full user command
- * @return 0 or 1 to signal success or failure
+ * @param shell The pointer to the Shell state
+ * @return The status to keep, or 1 if the command was misused
  */
 int 
-builtin_exit(struct Input *input)
+builtin_exit(struct Input *input, struct Shell *shell)
 {
   if (input->numArgs > 1)
   {
@@ -25,7 +38,8 @@ builtin_exit(struct Input *input)
     fflush(stderr);
     return 1;
   }
-  return 0;
+  shell->exiting = 1;
+  return shell->exitStatus;
 }
 
 /**
@@ -34,25 +48,27 @@ builtin_exit(struct Input *input)
  * negation to differentiate from exit values.
  *
  * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return The status printed, so it is kept, or 1 for misuse
  */
-void 
-builtin_status(struct Input *input, int exitStatus)
+int 
+builtin_status(struct Input *input, struct Shell *shell)
 {
   if (input->numArgs > 1)
   {
     fprintf(stderr, "Invalid number of arguments\nUsage: status\n");
     fflush(stderr);
-    return;
+    return 1;
   }
-  if (exitStatus < 0)
+  if (shell->exitStatus < 0)
   {
-    printf("terminated by signal %d\n", abs(exitStatus));
+    printf("terminated by signal %d\n", abs(shell->exitStatus));
   }
   else
   {
-    printf("exit value %d\n", exitStatus);
+    printf("exit value %d\n", shell->exitStatus);
   }
-  fflush(stdout);
+  return shell->exitStatus;
 }
 
 /**
@@ -61,32 +77,638 @@ builtin_status(struct Input *input, int exitStatus)
  * variable.
  *
  * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return 0 for success, or 1 for failure
  */
-void 
-builtin_cd(struct Input *input)
+int 
+builtin_cd(struct Input *input, struct Shell *shell)
 {
   if (input->numArgs > 2)
   {
     fprintf(stderr, "Invalid number of arguments\nUsage: cd [PATH]\n");
     fflush(stderr);
-    return;
+    return 1;
   }
 
   // Change the directory according to the given arguments
-  const char *home = getenv("HOME");
-  char *cwd = getcwd_a();
-  char *path = input->args[1];
-  if (path == NULL)
+  const char *path = input->args[1] ? input->args[1] : getenv("HOME");
+  if (path == NULL || chdir(path))
+  {
+    perror("chdir()");
+    fflush(stderr);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Lists the commands in the history with their numbers, only the last N
+ * of them when given N.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return 0 for success, or 1 if N is not a number
+ */
+int
+builtin_history(struct Input *input, struct Shell *shell)
+{
+  long last = 0;
+  char *end = "";
+  if (input->numArgs == 2)
+  {
+    last = strtol(input->args[1], &end, 10);
+  }
+  if (input->numArgs > 2 || last < 0 || *end != '\0')
+  {
+    fprintf(stderr, "Usage: history [N]\n");
+    fflush(stderr);
+    return 1;
+  }
+  history_print(last);
+  return 0;
+}
+
+/**
+ * Shows or defines aliases. Without arguments every alias is listed,
+ * NAME=VALUE defines one and NAME shows one.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return 0 for success, or 1 if a named alias was not found
+ */
+int
+builtin_alias(struct Input *input, struct Shell *shell)
+{
+  if (input->numArgs == 1)
   {
-    if (chdir(home))
+    alias_print(NULL);
+    return 0;
+  }
+
+  int status = 0;
+  for (int i = 1; i < input->numArgs; ++i)
+  {
+    const char *eq = strchr(input->args[i], '=');
+    if (eq != NULL && eq > input->args[i])
+    {
+      set_alias(input->args[i], eq - input->args[i], eq + 1);
+    }
+    else if (alias_print(input->args[i]) == -1)
     {
-      perror("chdir()");
+      fprintf(stderr, "alias: %s: not found\n", input->args[i]);
+      fflush(stderr);
+      status = 1;
     }
   }
-  else if (chdir(path))
+  return status;
+}
+
+/**
+ * Removes the aliases named, or all of them with "-a".
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return 0 for success, or 1 if a named alias was not found
+ */
+int
+builtin_unalias(struct Input *input, struct Shell *shell)
+{
+  if (input->numArgs == 1)
   {
-    perror("chdir()");
+    fprintf(stderr, "Usage: unalias -a | NAME...\n");
+    fflush(stderr);
+    return 1;
   }
 
-  free(cwd);
+  int status = 0;
+  for (int i = 1; i < input->numArgs; ++i)
+  {
+    if (!strcmp(input->args[i], "-a"))
+    {
+      remove_aliases();
+    }
+    else if (remove_alias(input->args[i]) == -1)
+    {
+      fprintf(stderr, "unalias: %s: not found\n", input->args[i]);
+      fflush(stderr);
+      status = 1;
+    }
+  }
+  return status;
+}
+
+/**
+ * Shows or changes the remembered locations of commands. Without
+ * arguments the remembered commands are listed, "-r" forgets all of
+ * them, and any names given are looked up and remembered.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return 0 for success, or 1 if a named command was not found
+ */
+int
+builtin_hash(struct Input *input, struct Shell *shell)
+{
+  if (input->numArgs == 1)
+  {
+    hash_print();
+    return 0;
+  }
+
+  int status = 0;
+  for (int i = 1; i < input->numArgs; ++i)
+  {
+    if (!strcmp(input->args[i], "-r"))
+    {
+      hash_reset();
+    }
+    else if (hash_lookup(input->args[i]) == NULL)
+    {
+      fprintf(stderr, "hash: %s: not found\n", input->args[i]);
+      fflush(stderr);
+      status = 1;
+    }
+  }
+  return status;
+}
+
+/**
+ * Prints the usage of the parallel built-in command.
+ *
+ * @return 1 for the failed command
+ */
+static int
+parallel_usage(void)
+{
+  fprintf(stderr, "Invalid argument(s)\n"
+          "Usage: parallel [-j N] [-a FILE] COMMAND [ARG]...\n");
+  fflush(stderr);
+  return 1;
+}
+
+/**
+ * Runs a command once for each line of stdin, or of the file given with
+ * -a or '<', substituting the line for every "{}" in the arguments or
+ * appending it when there is none. At most N commands run at a time,
+ * one per CPU by default. A '>' redirection applies to the whole batch.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return 0 if every command succeeded, the number that failed up to
+ *         101, or the negated signal that interrupted them
+ */
+int
+builtin_parallel(struct Input *input, struct Shell *shell)
+{
+  long maxJobs = sysconf(_SC_NPROCESSORS_ONLN);
+  const char *itemFile = NULL;
+  int i = 1;
+  while (i < input->numArgs && input->args[i][0] == '-')
+  {
+    const char *arg = input->args[i];
+    if (!strcmp(arg, "--"))
+    {
+      ++i;
+      break;
+    }
+    else if (!strcmp(arg, "-j") || !strcmp(arg, "-a"))
+    {
+      if (i + 1 == input->numArgs)
+      {
+        return parallel_usage();
+      }
+      if (arg[1] == 'j')
+      {
+        maxJobs = atol(input->args[i + 1]);
+      }
+      else
+      {
+        itemFile = input->args[i + 1];
+      }
+      i += 2;
+    }
+    else if (!strncmp(arg, "-j", 2))
+    {
+      maxJobs = atol(arg + 2);
+      ++i;
+    }
+    else
+    {
+      return parallel_usage();
+    }
+  }
+  if (maxJobs < 1 || i == input->numArgs)
+  {
+    return parallel_usage();
+  }
+
+  // Redirections are already in place, so items default to stdin
+  int itemFd = itemFile ? open(itemFile, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+  if (itemFd == -1)
+  {
+    perror(itemFile);
+    fflush(stderr);
+    return 1;
+  }
+  struct Input command = *input;
+  command.args = input->args + i;
+  command.numArgs = input->numArgs - i;
+  int status = run_parallel(&command, maxJobs, itemFd, shell->jobs);
+  if (itemFd != STDIN_FILENO)
+  {
+    close(itemFd);
+  }
+  return status;
+}
+
+/**
+ * Lists the background jobs in the order they were started, with the
+ * PID reported when each was started, whether it is running or stopped,
+ * how long ago it started and its command line.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return 0 for success, or 1 for misuse
+ */
+int
+builtin_jobs(struct Input *input, struct Shell *shell)
+{
+  if (input->numArgs > 1)
+  {
+    fprintf(stderr, "Invalid number of arguments\nUsage: jobs\n");
+    fflush(stderr);
+    return 1;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  struct JobTable *jobs = shell->jobs;
+  for (struct Job *job = get_job(jobs, jobs->head); job != NULL;
+       job = get_job(jobs, job->next))
+  {
+    if (!job->background)
+    {
+      continue;
+    }
+    double elapsed = (now.tv_sec - job->start.tv_sec) +
+                     (now.tv_nsec - job->start.tv_nsec) / 1e9;
+    printf("[%d] %d %-7s %8.1fs %s\n", job->index + 1, job->lastPid,
+           job->stoppedProcs > 0 ? "Stopped" : "Running", elapsed,
+           job->command);
+  }
+  return 0;
+}
+
+/**
+ * Finds the background job named by the given PID argument, or the most
+ * recently started one if there is none, reporting any error.
+ *
+ * @param input The full user command, with an optional PID argument
+ * @param jobs The pointer to the table of jobs
+ * @return The pointer to the Job, or NULL if there is no such job
+ */
+static struct Job *
+find_bg_job(struct Input *input, struct JobTable *jobs)
+{
+  const char *name = input->args[0];
+  if (input->numArgs > 2)
+  {
+    fprintf(stderr, "Invalid number of arguments\nUsage: %s [PID]\n", name);
+    fflush(stderr);
+    return NULL;
+  }
+
+  struct Job *job = NULL;
+  if (input->numArgs == 1)
+  {
+    for (job = get_job(jobs, jobs->tail); job != NULL && !job->background;
+         job = get_job(jobs, job->prev))
+    {
+      // skip jobs the shell is waiting on
+    }
+    if (job == NULL)
+    {
+      fprintf(stderr, "%s: no current job\n", name);
+    }
+  }
+  else
+  {
+    char *end;
+    long pid = strtol(input->args[1], &end, 10);
+    if (pid > 0 && *end == '\0')
+    {
+      job = find_job(jobs, (pid_t)pid);
+    }
+    if (job == NULL || !job->background)
+    {
+      job = NULL;
+      fprintf(stderr, "%s: %s: no such job\n", name, input->args[1]);
+    }
+  }
+  fflush(stderr);
+  return job;
+}
+
+/**
+ * Waits for background jobs to finish: all of them without arguments,
+ * the ones containing the given PIDs, or with -n whichever finishes
+ * next.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return The status of the last job waited for, 0 when waiting for all
+ *         of them, or 127 if a PID or -n found no job
+ */
+int
+builtin_wait(struct Input *input, struct Shell *shell)
+{
+  struct JobTable *jobs = shell->jobs;
+  if (input->numArgs == 1)
+  {
+    wait_all();
+    return 0;
+  }
+  if (!strcmp(input->args[1], "-n"))
+  {
+    if (input->numArgs > 2)
+    {
+      fprintf(stderr, "Invalid number of arguments\n"
+              "Usage: wait [-n | PID...]\n");
+      fflush(stderr);
+      return 1;
+    }
+    return wait_next();
+  }
+
+  int status = 0;
+  for (int i = 1; i < input->numArgs; ++i)
+  {
+    char *end;
+    long pid = strtol(input->args[i], &end, 10);
+    struct Job *job = NULL;
+    if (pid > 0 && *end == '\0')
+    {
+      job = find_job(jobs, (pid_t)pid);
+    }
+    if (job == NULL || !job->background)
+    {
+      fprintf(stderr, "wait: pid %s is not a child of this shell\n",
+              input->args[i]);
+      fflush(stderr);
+      status = 127;
+      continue;
+    }
+    status = wait_job(jobs, job, 0);
+  }
+  return status;
+}
+
+/**
+ * Brings a background job to the foreground, continuing it if it was
+ * stopped, and waits for it to finish.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return The status of the job, or 1 if there is no such job
+ */
+int
+builtin_fg(struct Input *input, struct Shell *shell)
+{
+  struct Job *job = find_bg_job(input, shell->jobs);
+  if (job == NULL)
+  {
+    return 1;
+  }
+  printf("%s\n", job->command);
+  fflush(stdout);
+  return wait_job(shell->jobs, job, 1);
+}
+
+/**
+ * Continues a stopped background job in the background.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return 0 for success, or 1 if there is no such job
+ */
+int
+builtin_bg(struct Input *input, struct Shell *shell)
+{
+  struct Job *job = find_bg_job(input, shell->jobs);
+  if (job == NULL)
+  {
+    return 1;
+  }
+  if (job->stoppedProcs > 0 && kill(-job->pgid, SIGCONT))
+  {
+    perror("kill()");
+    fflush(stderr);
+    return 1;
+  }
+  printf("background PID is %d\n", job->lastPid);
+  return 0;
+}
+
+// Every built-in command, sorted by name for bsearch()
+static const struct Builtin builtins[] = {
+  {"[", builtin_test, 1},
+  {"alias", builtin_alias, 0},
+  {"bg", builtin_bg, 0},
+  {"cd", builtin_cd, 0},
+  {"echo", builtin_echo, 1},
+  {"exit", builtin_exit, 0},
+  {"false", builtin_false, 1},
+  {"fg", builtin_fg, 0},
+  {"hash", builtin_hash, 0},
+  {"history", builtin_history, 0},
+  {"jobs", builtin_jobs, 0},
+  {"parallel", builtin_parallel, 0},
+  {"printf", builtin_printf, 1},
+  {"pwd", builtin_pwd, 1},
+  {"status", builtin_status, 0},
+  {"test", builtin_test, 1},
+  {"true", builtin_true, 1},
+  {"unalias", builtin_unalias, 0},
+  {"wait", builtin_wait, 0},
+};
+
+/**
+ * Compares a command name with the name of a Builtin for bsearch().
+ *
+ * @param name The command name
+ * @param builtin The pointer to the Builtin
+ * @return The comparison of the names, as for strcmp()
+ */
+static int
+compare_builtin(const void *name, const void *builtin)
+{
+  return strcmp(name, ((const struct Builtin *)builtin)->name);
+}
+
+/**
+ * Returns the name of a built-in command, for completion.
+ *
+ * @param i The index of the command in the registry
+ * @return The name, or NULL past the last command
+ */
+const char *
+builtin_name(size_t i)
+{
+  return i < sizeof(builtins) / sizeof(builtins[0]) ? builtins[i].name : NULL;
+}
+
+/**
+ * Looks up the built-in command with the given name.
+ *
+ * @param name The command name
+ * @return The pointer to the Builtin, or NULL if there is none
+ */
+const struct Builtin *
+find_builtin(const char *name)
+{
+  return bsearch(name, builtins, sizeof(builtins) / sizeof(builtins[0]),
+                 sizeof(builtins[0]), compare_builtin);
+}
+
+/**
+ * Points one of the shell's standard descriptors at the given file for
+ * the length of a built-in command, saving the original first.
+ *
+ * @param filename The name of the file, or NULL for no redirection
+ * @param flags The flags to open the file with
+ * @param target The descriptor to redirect
+ * @param saved Set to a close-on-exec copy of the original descriptor
+ * @return -1 for failure, 0 for success
+ */
+static int
+redirect_fd(const char *filename, int flags, int target, int *saved)
+{
+  if (filename == NULL)
+  {
+    return 0;
+  }
+  int fd = open(filename, flags | O_CLOEXEC, 0644);
+  if (fd == -1)
+  {
+    perror("open()");
+    fflush(stderr);
+    return -1;
+  }
+  *saved = fcntl(target, F_DUPFD_CLOEXEC, 10);
+  dup2(fd, target);
+  close(fd);
+  return 0;
+}
+
+/**
+ * Points the shell's stdin at the text of a here-document or here-string
+ * for the length of a built-in command, saving the original first.
+ *
+ * @param input The command, whose here text is used if it has any
+ * @param saved Set to a close-on-exec copy of the original stdin
+ * @return -1 for failure, 0 for success
+ */
+static int
+redirect_here(const struct Input *input, int *saved)
+{
+  if (input->here == NULL)
+  {
+    return 0;
+  }
+  int fd = open_here(input->here, input->hereLen);
+  if (fd == -1)
+  {
+    return -1;
+  }
+  *saved = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+  dup2(fd, STDIN_FILENO);
+  close(fd);
+  return 0;
+}
+
+/**
+ * Puts back a descriptor saved by redirect_fd().
+ *
+ * @param target The redirected descriptor
+ * @param saved The copy of the original, or -1 if it was not redirected
+ */
+static void
+restore_fd(int target, int saved)
+{
+  if (saved != -1)
+  {
+    dup2(saved, target);
+    close(saved);
+  }
+}
+
+/**
+ * Runs a built-in command in the shell process. Its redirections are
+ * applied to the shell's own stdin and stdout, which are saved first and
+ * put back afterwards, so no child process is needed. Output is flushed
+ * before the descriptors change back.
+ *
+ * @param builtin The pointer to the Builtin to run
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return The exit status of the command
+ */
+int
+run_builtin(const struct Builtin *builtin, struct Input *input,
+            struct Shell *shell)
+{
+  int savedIn = -1;
+  int savedOut = -1;
+  int status = 1;
+  fflush(stdout);
+  if (redirect_fd(input->infile, O_RDONLY, STDIN_FILENO, &savedIn) == 0 &&
+      redirect_here(input, &savedIn) == 0 &&
+      redirect_fd(input->outfile, O_WRONLY | O_CREAT | O_TRUNC,
+                  STDOUT_FILENO, &savedOut) == 0)
+  {
+    status = builtin->run(input, shell);
+  }
+  if (fflush(stdout) == EOF && status == 0)
+  {
+    perror(input->args[0]);
+    fflush(stderr);
+    clearerr(stdout);
+    status = 1;
+  }
+  restore_fd(STDOUT_FILENO, savedOut);
+  restore_fd(STDIN_FILENO, savedIn);
+  return status;
+}
+
+/**
+ * Runs a built-in command in the shell process like run_builtin(), with
+ * its stdout captured in memory, as for a command substitution.
+ *
+ * @param builtin The pointer to the Builtin to run
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @param output Set to the allocated output
+ * @param len Set to the length of the output
+ * @return The exit status of the command
+ */
+int
+capture_builtin(const struct Builtin *builtin, struct Input *input,
+                struct Shell *shell, char **output, size_t *len)
+{
+  *output = NULL;
+  *len = 0;
+  int fd = open_capture();
+  if (fd == -1)
+  {
+    return 1;
+  }
+  fflush(stdout);
+  int saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+  dup2(fd, STDOUT_FILENO);
+  int status = run_builtin(builtin, input, shell);
+  restore_fd(STDOUT_FILENO, saved);
+  lseek(fd, 0, SEEK_SET);
+  *output = read_output(fd, len);
+  close(fd);
+  return status;
 }
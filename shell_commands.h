@@ -2,9 +2,43 @@
 #define SHELL_COMMANDS_H
 
 #include "input_parsing.h"
+#include "job_table.h"
 
-int builtin_exit(struct Input *input);
-void builtin_status(struct Input *input, int exitStatus);
-void builtin_cd(struct Input *input);
+struct Shell // state the built-in commands work on
+{
+  struct JobTable *jobs;
+  int exitStatus; // status of the last command, or its negated signal
+  int exiting;    // Boolean set by exit
+};
 
-#endif
\ No newline at end of file
+// Every built-in command returns its exit status
+typedef int builtin_func(struct Input *input, struct Shell *shell);
+
+struct Builtin
+{
+  const char *name;
+  builtin_func *run;
+  int external; // Boolean, also installed as a program children can run
+};
+
+const struct Builtin *find_builtin(const char *name);
+const char *builtin_name(size_t i);
+int run_builtin(const struct Builtin *builtin, struct Input *input,
+                struct Shell *shell);
+int capture_builtin(const struct Builtin *builtin, struct Input *input,
+                    struct Shell *shell, char **output, size_t *len);
+
+int builtin_exit(struct Input *input, struct Shell *shell);
+int builtin_status(struct Input *input, struct Shell *shell);
+int builtin_cd(struct Input *input, struct Shell *shell);
+int builtin_hash(struct Input *input, struct Shell *shell);
+int builtin_alias(struct Input *input, struct Shell *shell);
+int builtin_unalias(struct Input *input, struct Shell *shell);
+int builtin_history(struct Input *input, struct Shell *shell);
+int builtin_parallel(struct Input *input, struct Shell *shell);
+int builtin_jobs(struct Input *input, struct Shell *shell);
+int builtin_wait(struct Input *input, struct Shell *shell);
+int builtin_fg(struct Input *input, struct Shell *shell);
+int builtin_bg(struct Input *input, struct Shell *shell);
+
+#endif
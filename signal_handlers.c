@@ -2,6 +2,8 @@
  * Definitions for signal handling functions.
 */
 
+#define _POSIX_SOURCE
+
 #include <stdlib.h>
 #include <unistd.h>
 
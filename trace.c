@@ -0,0 +1,402 @@
+/**
+ * Definitions for the trace of command lifecycle events, written when
+ * SMALLSH_TRACE names a file ("%p" in the name stands for the shell's
+ * PID, so nested shells can trace to files of their own).
+ *
+ * Events are recorded into a fixed array of records with their argument
+ * text in a separate pool; both are only turned into text and written,
+ * in one batch, when either fills up or the shell exits. Recording an
+ * event is a clock read and a few stores, plus copying the arguments.
+ *
+ * The file is in the Chrome trace event format, a JSON array with one
+ * event per line, which Perfetto and chrome://tracing load. The closing
+ * ']' is optional in that format, so a shell that was killed still
+ * leaves a loadable trace.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define TRACE_RECORDS 4096      // events held before a flush
+#define TRACE_TEXT 65536        // bytes of argument text held
+#define TRACE_OUT 65536         // bytes formatted per write(2)
+
+struct TraceRecord
+{
+  long long start; // CLOCK_MONOTONIC in nanoseconds
+  long long end;   // the same as start for an instant event
+  pid_t pid;       // the child the event is about, or 0
+  int value;
+  int kind;
+  unsigned text;    // offset of the argument text in the pool
+  unsigned textLen;
+};
+
+struct TraceType
+{
+  const char *name;
+  const char *valueKey; // name of the value in the event's args
+  int instant;          // Boolean, false for a span
+};
+
+static const struct TraceType types[] = {
+  [TRACE_READ] = {"read", "bytes", 0},
+  [TRACE_PARSE] = {"parse", "commands", 0},
+  [TRACE_BUILTIN] = {"builtin", "status", 0},
+  [TRACE_REDIRECT] = {"redirect", "errno", 0},
+  [TRACE_LOOKUP] = {"lookup", "found", 0},
+  [TRACE_SPAWN] = {"spawn", "error", 0},
+  [TRACE_EXEC_OK] = {"exec_ok", NULL, 1},
+  [TRACE_EXEC_FAIL] = {"exec_fail", "error", 1},
+  [TRACE_WAIT] = {"wait", "status", 0},
+  [TRACE_EXIT] = {"exit", "status", 1},
+  [TRACE_REAP] = {"reap", "status", 1},
+};
+
+int tracing = 0;
+
+static int traceFd = -1;
+static pid_t shellPid;
+static struct TraceRecord *records = NULL;
+static int numRecords = 0;
+static char *text = NULL;
+static size_t textUsed = 0;
+static char *out = NULL;
+static size_t outUsed = 0;
+
+/**
+ * Returns the current CLOCK_MONOTONIC time in nanoseconds, the clock
+ * every event is stamped with.
+ */
+long long
+trace_clock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Writes out the formatted text.
+ */
+static void
+write_out(void)
+{
+  size_t done = 0;
+  while (done < outUsed)
+  {
+    ssize_t n = write(traceFd, out + done, outUsed - done);
+    if (n <= 0)
+    {
+      break; // a trace is best effort; drop the batch
+    }
+    done += n;
+  }
+  outUsed = 0;
+}
+
+/**
+ * Makes room for the given number of bytes in the output, writing it
+ * out if they would not fit.
+ */
+static void
+out_reserve(size_t len)
+{
+  if (TRACE_OUT - outUsed < len)
+  {
+    write_out();
+  }
+}
+
+/**
+ * Appends a string to the output.
+ */
+static void
+out_str(const char *s)
+{
+  size_t len = strlen(s);
+  out_reserve(len);
+  memcpy(out + outUsed, s, len);
+  outUsed += len;
+}
+
+/**
+ * Appends an integer to the output in decimal. The events are formatted
+ * by hand rather than with printf, which would cost more than recording
+ * them does.
+ */
+static void
+out_int(long long n)
+{
+  char digits[24];
+  int len = 0;
+  unsigned long long u = n < 0 ? -(unsigned long long)n : n;
+  do
+  {
+    digits[len++] = '0' + u % 10;
+    u /= 10;
+  } while (u > 0);
+  out_reserve(len + 1);
+  if (n < 0)
+  {
+    out[outUsed++] = '-';
+  }
+  while (len > 0)
+  {
+    out[outUsed++] = digits[--len];
+  }
+}
+
+/**
+ * Appends a time in nanoseconds to the output as microseconds, the unit
+ * of the trace format, with three decimals.
+ */
+static void
+out_us(long long ns)
+{
+  out_int(ns / 1000);
+  out_reserve(4);
+  int frac = ns % 1000;
+  out[outUsed++] = '.';
+  out[outUsed++] = '0' + frac / 100;
+  out[outUsed++] = '0' + frac / 10 % 10;
+  out[outUsed++] = '0' + frac % 10;
+}
+
+/**
+ * Appends text to the output as the inside of a JSON string.
+ *
+ * @param s The text
+ * @param len The length of the text
+ */
+static void
+out_json(const char *s, size_t len)
+{
+  for (size_t i = 0; i < len; ++i)
+  {
+    out_reserve(6);
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\')
+    {
+      out[outUsed++] = '\\';
+      out[outUsed++] = c;
+    }
+    else if (c < 0x20)
+    {
+      outUsed += sprintf(out + outUsed, "\\u%04x", c);
+    }
+    else
+    {
+      out[outUsed++] = c;
+    }
+  }
+}
+
+/**
+ * Formats every recorded event as a line of the trace and writes them
+ * out, emptying the records and the text pool.
+ */
+void
+flush_trace(void)
+{
+  if (!tracing)
+  {
+    return;
+  }
+  for (int i = 0; i < numRecords; ++i)
+  {
+    const struct TraceRecord *rec = &records[i];
+    const struct TraceType *type = &types[rec->kind];
+    out_str("{\"name\":\"");
+    out_str(type->name);
+    out_str(type->instant ? "\",\"cat\":\"smallsh\",\"ph\":\"i\",\"s\":\"t\""
+                          : "\",\"cat\":\"smallsh\",\"ph\":\"X\",\"dur\":");
+    if (!type->instant)
+    {
+      out_us(rec->end - rec->start);
+    }
+    out_str(",\"ts\":");
+    out_us(rec->start);
+    out_str(",\"pid\":");
+    out_int(shellPid);
+    out_str(",\"tid\":");
+    out_int(shellPid);
+    out_str(",\"args\":{");
+
+    const char *sep = "";
+    if (rec->pid != 0)
+    {
+      out_str("\"child\":");
+      out_int(rec->pid);
+      sep = ",";
+    }
+    if (type->valueKey != NULL)
+    {
+      out_str(sep);
+      out_str("\"");
+      out_str(type->valueKey);
+      out_str("\":");
+      out_int(rec->value);
+      sep = ",";
+    }
+    if (rec->textLen > 0)
+    {
+      out_str(sep);
+      out_str("\"argv\":\"");
+      out_json(text + rec->text, rec->textLen);
+      out_str("\"");
+    }
+    out_str("}},\n");
+  }
+  write_out();
+  numRecords = 0;
+  textUsed = 0;
+}
+
+/**
+ * Records an event. Spans run from the given start to now; instant
+ * events happen now.
+ *
+ * @param kind The kind of event
+ * @param start The trace_clock() time a span started at, ignored for
+ *        instant events
+ * @param pid The child the event is about, or 0
+ * @param value The value the kind of event carries
+ * @param args The NULL-terminated arguments of the command, joined by
+ *        spaces in the trace, or NULL for none
+ */
+void
+trace_event(enum TraceKind kind, long long start, pid_t pid, int value,
+            char *const *args)
+{
+  size_t len = 0;
+  for (int i = 0; args != NULL && args[i] != NULL; ++i)
+  {
+    len += strlen(args[i]) + 1;
+  }
+  if (numRecords == TRACE_RECORDS || len > TRACE_TEXT - textUsed)
+  {
+    flush_trace();
+  }
+  struct TraceRecord *rec = &records[numRecords++];
+  rec->end = trace_clock();
+  rec->start = types[kind].instant ? rec->end : start;
+  rec->pid = pid;
+  rec->value = value;
+  rec->kind = kind;
+  rec->textLen = 0;
+  if (args == NULL)
+  {
+    return;
+  }
+
+  rec->text = textUsed;
+  for (int i = 0; args[i] != NULL && textUsed < TRACE_TEXT; ++i)
+  {
+    size_t n = strlen(args[i]);
+    if (n > TRACE_TEXT - textUsed - (i > 0))
+    {
+      n = TRACE_TEXT - textUsed - (i > 0); // truncate a huge command
+    }
+    if (i > 0)
+    {
+      text[textUsed++] = ' ';
+    }
+    memcpy(text + textUsed, args[i], n);
+    textUsed += n;
+  }
+  rec->textLen = textUsed - rec->text;
+}
+
+/**
+ * Turns tracing on if SMALLSH_TRACE names a file that can be created.
+ */
+void
+init_trace(void)
+{
+  const char *name = getenv("SMALLSH_TRACE");
+  if (name == NULL || *name == '\0')
+  {
+    return;
+  }
+  shellPid = getpid();
+
+  // Replace each "%p" with the PID
+  char path[4096];
+  size_t len = 0;
+  for (const char *p = name; *p != '\0' && len < sizeof(path) - 16; ++p)
+  {
+    if (p[0] == '%' && p[1] == 'p')
+    {
+      len += sprintf(path + len, "%d", shellPid);
+      ++p;
+    }
+    else
+    {
+      path[len++] = *p;
+    }
+  }
+  path[len] = '\0';
+
+  traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (traceFd == -1)
+  {
+    perror("SMALLSH_TRACE");
+    return;
+  }
+  records = malloc(TRACE_RECORDS * sizeof(struct TraceRecord));
+  text = malloc(TRACE_TEXT);
+  out = malloc(TRACE_OUT);
+  tracing = 1;
+  out_str("[\n");
+  write_out(); // before any forked child writes events of its own
+}
+
+/**
+ * Starts the trace of a child forked to run part of the shell. The
+ * events it inherited are dropped, since the parent writes them, and
+ * its own are stamped with its PID. The child must call flush_trace()
+ * before it exits.
+ */
+void
+trace_forked(void)
+{
+  if (!tracing)
+  {
+    return;
+  }
+  shellPid = getpid();
+  numRecords = 0;
+  textUsed = 0;
+  outUsed = 0;
+}
+
+/**
+ * Writes out the remaining events, ends the trace and closes it.
+ */
+void
+cleanup_trace(void)
+{
+  if (!tracing)
+  {
+    return;
+  }
+  flush_trace();
+  out_str("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":");
+  out_int(shellPid);
+  out_str(",\"args\":{\"name\":\"smallsh\"}}\n]\n");
+  write_out();
+  close(traceFd);
+  free(records);
+  free(text);
+  free(out);
+  tracing = 0;
+}
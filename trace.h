@@ -0,0 +1,33 @@
+/* Header file for the trace of command lifecycle events */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <sys/types.h>
+
+enum TraceKind
+{
+  TRACE_READ,      // span reading a line, value its length
+  TRACE_PARSE,     // span parsing a line, value its number of commands
+  TRACE_BUILTIN,   // span running a built-in command, value its status
+  TRACE_REDIRECT,  // span opening redirection files, value an errno
+  TRACE_LOOKUP,    // span finding a command on PATH, value 1 if found
+  TRACE_SPAWN,     // span starting a child, value the posix_spawn error
+  TRACE_EXEC_OK,   // the child executed its command
+  TRACE_EXEC_FAIL, // the child could not, value the error
+  TRACE_WAIT,      // span waiting on a foreground job, value its status
+  TRACE_EXIT,      // a child was reaped, value its exit status or -signal
+  TRACE_REAP       // a job was done with, value its status
+};
+
+extern int tracing; // Boolean for SMALLSH_TRACE naming a trace file
+
+void init_trace(void);
+long long trace_clock(void);
+void trace_event(enum TraceKind kind, long long start, pid_t pid, int value,
+                 char *const *args);
+void flush_trace(void);
+void trace_forked(void);
+void cleanup_trace(void);
+
+#endif
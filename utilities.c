@@ -2,11 +2,14 @@
  * Definitions for various utility functions.
 */
 
+#define _POSIX_SOURCE
+
 #include <err.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 #include <unistd.h>
 
 #include "utilities.h"
@@ -0,0 +1,809 @@
+/**
+ * Definitions for standard utilities run inside the shell: true, false,
+ * echo, pwd, test (also as '[') and printf. Scripts use these so often
+ * that spawning a process for each one dominates their run time; here
+ * they cost a function call. They follow POSIX, and the installed
+ * programs still run them in pipelines and in the background.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utilities.h"
+#include "utility_commands.h"
+
+/**
+ * Does nothing, successfully.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return 0
+ */
+int
+builtin_true(struct Input *input, struct Shell *shell)
+{
+  return 0;
+}
+
+/**
+ * Does nothing, unsuccessfully.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return 1
+ */
+int
+builtin_false(struct Input *input, struct Shell *shell)
+{
+  return 1;
+}
+
+static int put_escaped(const char *s);
+
+/**
+ * Writes the arguments separated by spaces and followed by a newline.
+ * Leading options made of the letters n, e and E, as the installed echo
+ * takes them, leave out the newline (-n) and turn interpreting
+ * backslash escapes as printf's %b does on (-e) or off (-E); with
+ * escapes on, \c ends the output there.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return 0
+ */
+int
+builtin_echo(struct Input *input, struct Shell *shell)
+{
+  int i = 1;
+  int newline = 1;
+  int escapes = 0;
+  for (; i < input->numArgs; ++i)
+  {
+    const char *arg = input->args[i];
+    if (arg[0] != '-' || arg[1] == '\0' ||
+        strspn(arg + 1, "neE") != strlen(arg + 1))
+    {
+      break;
+    }
+    for (const char *c = arg + 1; *c != '\0'; ++c)
+    {
+      if (*c == 'n')
+      {
+        newline = 0;
+      }
+      else
+      {
+        escapes = *c == 'e';
+      }
+    }
+  }
+
+  for (int first = i; i < input->numArgs; ++i)
+  {
+    if (i > first)
+    {
+      putchar(' ');
+    }
+    if (!escapes)
+    {
+      fputs(input->args[i], stdout);
+    }
+    else if (put_escaped(input->args[i]))
+    {
+      return 0; // \c: no further output
+    }
+  }
+  if (newline)
+  {
+    putchar('\n');
+  }
+  return 0;
+}
+
+/**
+ * Writes the current working directory.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return 0
+ */
+int
+builtin_pwd(struct Input *input, struct Shell *shell)
+{
+  char *cwd = getcwd_a();
+  puts(cwd);
+  free(cwd);
+  return 0;
+}
+
+/**
+ * Parses an integer operand of test.
+ *
+ * @param arg The operand
+ * @param value Set to its value
+ * @return -1 if it is not an integer, 0 for success
+ */
+static int
+test_integer(const char *arg, long long *value)
+{
+  char *end;
+  errno = 0;
+  *value = strtoll(arg, &end, 10);
+  if (end == arg || *end != '\0' || errno != 0)
+  {
+    fprintf(stderr, "test: %s: integer expression expected\n", arg);
+    fflush(stderr);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Evaluates a unary primary of test.
+ *
+ * @param op The operator, such as "-f"
+ * @param arg The operand
+ * @return 0 for true, 1 for false, or 2 if op is not a unary operator
+ */
+static int
+test_unary(const char *op, const char *arg)
+{
+  if (op[0] != '-' || op[1] == '\0' || op[2] != '\0')
+  {
+    return 2;
+  }
+
+  struct stat st;
+  switch (op[1])
+  {
+    case 'n': return arg[0] == '\0';
+    case 'z': return arg[0] != '\0';
+    case 't': return !isatty(atoi(arg));
+    case 'r': return access(arg, R_OK) != 0;
+    case 'w': return access(arg, W_OK) != 0;
+    case 'x': return access(arg, X_OK) != 0;
+    case 'h':
+    case 'L': return lstat(arg, &st) != 0 || !S_ISLNK(st.st_mode);
+  }
+  if (strchr("bcdefgpsSu", op[1]) == NULL)
+  {
+    return 2;
+  }
+  if (stat(arg, &st) != 0)
+  {
+    return 1;
+  }
+  switch (op[1])
+  {
+    case 'b': return !S_ISBLK(st.st_mode);
+    case 'c': return !S_ISCHR(st.st_mode);
+    case 'd': return !S_ISDIR(st.st_mode);
+    case 'f': return !S_ISREG(st.st_mode);
+    case 'g': return !(st.st_mode & S_ISGID);
+    case 'p': return !S_ISFIFO(st.st_mode);
+    case 's': return st.st_size == 0;
+    case 'S': return !S_ISSOCK(st.st_mode);
+    case 'u': return !(st.st_mode & S_ISUID);
+    default:  return 0; // -e
+  }
+}
+
+/**
+ * Evaluates a binary primary of test. Between two strings, -a and -o
+ * are the and and or of their being non-empty.
+ *
+ * @param left The left operand
+ * @param op The operator, such as "-lt"
+ * @param right The right operand
+ * @return 0 for true, 1 for false, 2 for an error, or 3 if op is not a
+ *         binary operator
+ */
+static int
+test_binary(const char *left, const char *op, const char *right)
+{
+  if (!strcmp(op, "=") || !strcmp(op, "=="))
+  {
+    return strcmp(left, right) != 0;
+  }
+  if (!strcmp(op, "!="))
+  {
+    return strcmp(left, right) == 0;
+  }
+  if (!strcmp(op, "-a"))
+  {
+    return left[0] == '\0' || right[0] == '\0';
+  }
+  if (!strcmp(op, "-o"))
+  {
+    return left[0] == '\0' && right[0] == '\0';
+  }
+  if (!strcmp(op, "-nt") || !strcmp(op, "-ot"))
+  {
+    struct stat l, r;
+    int haveLeft = stat(left, &l) == 0;
+    int haveRight = stat(right, &r) == 0;
+    if (op[1] == 'o')
+    {
+      return !(haveRight && (!haveLeft || l.st_mtime < r.st_mtime));
+    }
+    return !(haveLeft && (!haveRight || l.st_mtime > r.st_mtime));
+  }
+
+  static const char *const ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+  int which = 0;
+  while (which < 6 && strcmp(op, ops[which]))
+  {
+    ++which;
+  }
+  if (which == 6)
+  {
+    return 3;
+  }
+  long long l, r;
+  if (test_integer(left, &l) || test_integer(right, &r))
+  {
+    return 2;
+  }
+  switch (which)
+  {
+    case 0:  return !(l == r);
+    case 1:  return !(l != r);
+    case 2:  return !(l < r);
+    case 3:  return !(l <= r);
+    case 4:  return !(l > r);
+    default: return !(l >= r);
+  }
+}
+
+/**
+ * Negates the result of a test expression, keeping errors.
+ *
+ * @param result 0 for true, 1 for false, or 2 for an error
+ * @return The negated result
+ */
+static int
+test_not(int result)
+{
+  return result == 2 ? 2 : !result;
+}
+
+struct TestParser // position in the arguments of a test expression
+{
+  char **args;
+  int count;
+  int pos;
+};
+
+static int test_or(struct TestParser *t);
+
+/**
+ * Checks whether an argument joins primaries of a test expression.
+ *
+ * @param arg The argument
+ * @return Boolean for -a or -o
+ */
+static int
+is_connective(const char *arg)
+{
+  return !strcmp(arg, "-a") || !strcmp(arg, "-o");
+}
+
+/**
+ * Evaluates a negated, parenthesized, binary, unary or one-string
+ * primary of a test expression, trying them in that order.
+ *
+ * @param t The pointer to the TestParser
+ * @return 0 for true, 1 for false, or 2 for an error
+ */
+static int
+test_primary(struct TestParser *t)
+{
+  char **args = t->args + t->pos;
+  int left = t->count - t->pos;
+  int result;
+  if (left == 0)
+  {
+    fprintf(stderr, "test: argument expected\n");
+    fflush(stderr);
+    return 2;
+  }
+  if (!strcmp(args[0], "!"))
+  {
+    ++t->pos;
+    return test_not(test_primary(t));
+  }
+  if (left >= 3 && !is_connective(args[1]) &&
+      (result = test_binary(args[0], args[1], args[2])) != 3)
+  {
+    t->pos += 3;
+    return result;
+  }
+  if (!strcmp(args[0], "("))
+  {
+    ++t->pos;
+    result = test_or(t);
+    if (result != 2 &&
+        (t->pos == t->count || strcmp(t->args[t->pos], ")")))
+    {
+      fprintf(stderr, "test: missing ')'\n");
+      fflush(stderr);
+      return 2;
+    }
+    ++t->pos;
+    return result;
+  }
+  if (left >= 2 && (result = test_unary(args[0], args[1])) != 2)
+  {
+    t->pos += 2;
+    return result;
+  }
+  ++t->pos;
+  return args[0][0] == '\0';
+}
+
+/**
+ * Evaluates primaries joined by -a, which binds tighter than -o.
+ *
+ * @param t The pointer to the TestParser
+ * @return 0 for true, 1 for false, or 2 for an error
+ */
+static int
+test_and(struct TestParser *t)
+{
+  int result = test_primary(t);
+  while (result != 2 && t->pos < t->count && !strcmp(t->args[t->pos], "-a"))
+  {
+    ++t->pos;
+    int right = test_primary(t);
+    result = right == 2 ? 2 : result || right;
+  }
+  return result;
+}
+
+/**
+ * Evaluates terms joined by -o.
+ *
+ * @param t The pointer to the TestParser
+ * @return 0 for true, 1 for false, or 2 for an error
+ */
+static int
+test_or(struct TestParser *t)
+{
+  int result = test_and(t);
+  while (result != 2 && t->pos < t->count && !strcmp(t->args[t->pos], "-o"))
+  {
+    ++t->pos;
+    int right = test_and(t);
+    result = right == 2 ? 2 : result && right;
+  }
+  return result;
+}
+
+/**
+ * Evaluates a test expression of any length with the grammar of '!',
+ * parentheses, -a and -o, for the forms the rules by number of
+ * arguments do not settle.
+ *
+ * @param args The arguments of the expression
+ * @param count The number of arguments
+ * @return 0 for true, 1 for false, or 2 for an error
+ */
+static int
+test_grammar(char **args, int count)
+{
+  struct TestParser t = {args, count, 0};
+  int result = test_or(&t);
+  if (result != 2 && t.pos < count)
+  {
+    fprintf(stderr, "test: %s: unexpected operator\n", args[t.pos]);
+    fflush(stderr);
+    return 2;
+  }
+  return result;
+}
+
+/**
+ * Evaluates a test expression with the rules POSIX gives for up to four
+ * arguments, and with test_grammar() for longer ones and the rest.
+ *
+ * @param args The arguments of the expression
+ * @param count The number of arguments
+ * @return 0 for true, 1 for false, or 2 for an error
+ */
+static int
+test_expression(char **args, int count)
+{
+  int result = 2;
+  switch (count)
+  {
+    case 0:
+      return 1;
+    case 1:
+      return args[0][0] == '\0';
+    case 2:
+      if (!strcmp(args[0], "!"))
+      {
+        return test_not(test_expression(args + 1, 1));
+      }
+      result = test_unary(args[0], args[1]);
+      break;
+    case 3:
+      result = test_binary(args[0], args[1], args[2]);
+      if (result != 3)
+      {
+        return result;
+      }
+      result = 2;
+      if (!strcmp(args[0], "!"))
+      {
+        return test_not(test_expression(args + 1, 2));
+      }
+      if (!strcmp(args[0], "(") && !strcmp(args[2], ")"))
+      {
+        return test_expression(args + 1, 1);
+      }
+      break;
+    case 4:
+      if (!strcmp(args[0], "!"))
+      {
+        return test_not(test_expression(args + 1, 3));
+      }
+      if (!strcmp(args[0], "(") && !strcmp(args[3], ")"))
+      {
+        return test_expression(args + 1, 2);
+      }
+      break;
+  }
+  return result == 2 ? test_grammar(args, count) : result;
+}
+
+/**
+ * Evaluates a conditional expression: file checks such as -f and -d,
+ * string checks and comparisons, and integer comparisons, combined with
+ * '!', parentheses, -a and -o. Called as '[', the last argument must be ']'.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return 0 for true, 1 for false, or 2 for an error
+ */
+int
+builtin_test(struct Input *input, struct Shell *shell)
+{
+  int count = input->numArgs - 1;
+  if (!strcmp(input->args[0], "["))
+  {
+    if (count == 0 || strcmp(input->args[count], "]"))
+    {
+      fprintf(stderr, "[: missing ']'\n");
+      fflush(stderr);
+      return 2;
+    }
+    --count;
+  }
+  return test_expression(input->args + 1, count);
+}
+
+/**
+ * Writes the character for the escape sequence after a backslash. The
+ * escapes are those of C, plus octal values of up to three digits,
+ * which may start with a 0 as %b allows, and \c to stop all output.
+ *
+ * @param p The pointer to the character after the backslash, advanced
+ *        past the sequence
+ * @return 1 for \c, otherwise 0
+ */
+static int
+put_escape(const char **p)
+{
+  static const char from[] = "\\abfnrtv\"'";
+  static const char to[] = "\\\a\b\f\n\r\t\v\"'";
+  const char *s = *p;
+  const char *found;
+  if (*s == 'c')
+  {
+    *p = s + 1;
+    return 1;
+  }
+  if (*s >= '0' && *s <= '7')
+  {
+    int value = 0;
+    int digits = *s == '0' ? 4 : 3; // "\0NNN" or "\NNN"
+    for (; digits > 0 && *s >= '0' && *s <= '7'; --digits, ++s)
+    {
+      value = value * 8 + (*s - '0');
+    }
+    putchar(value & 0xff);
+  }
+  else if (*s != '\0' && (found = strchr(from, *s)) != NULL)
+  {
+    putchar(to[found - from]);
+    ++s;
+  }
+  else
+  {
+    putchar('\\'); // not an escape; keep the backslash
+  }
+  *p = s;
+  return 0;
+}
+
+/**
+ * Writes a string, interpreting its backslash escapes as %b does.
+ *
+ * @param s The string to write
+ * @return 1 if it contained \c, otherwise 0
+ */
+static int
+put_escaped(const char *s)
+{
+  while (*s != '\0')
+  {
+    if (*s != '\\')
+    {
+      putchar(*s++);
+    }
+    else
+    {
+      ++s;
+      if (put_escape(&s))
+      {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+ * Checks that a numeric argument of printf was converted completely,
+ * reporting it otherwise.
+ *
+ * @param arg The argument
+ * @param end The end of the conversion
+ * @param status Set to 1 if the argument is not a valid number
+ */
+static void
+check_number(const char *arg, const char *end, int *status)
+{
+  if (end == arg || *end != '\0' || errno != 0)
+  {
+    fprintf(stderr, "printf: %s: invalid number\n", arg);
+    fflush(stderr);
+    *status = 1;
+  }
+}
+
+/**
+ * Converts an integer argument of printf. A leading quote gives the
+ * value of the character after it, as POSIX requires.
+ *
+ * @param arg The argument, or NULL if the arguments ran out
+ * @param status Set to 1 if the argument is not a valid number
+ * @return The value of the argument; unsigned values wrap around
+ */
+static long long
+printf_integer(const char *arg, int *status)
+{
+  if (arg == NULL || arg[0] == '\0')
+  {
+    return 0;
+  }
+  if (arg[0] == '\'' || arg[0] == '"')
+  {
+    return (unsigned char)arg[1];
+  }
+
+  char *end;
+  long long value;
+  errno = 0;
+  if (arg[0] == '-')
+  {
+    value = strtoll(arg, &end, 0);
+  }
+  else
+  {
+    value = (long long)strtoull(arg, &end, 0);
+  }
+  check_number(arg, end, status);
+  return value;
+}
+
+/**
+ * Converts a floating point argument of printf.
+ *
+ * @param arg The argument, or NULL if the arguments ran out
+ * @param status Set to 1 if the argument is not a valid number
+ * @return The value of the argument
+ */
+static long double
+printf_float(const char *arg, int *status)
+{
+  if (arg == NULL || arg[0] == '\0')
+  {
+    return 0;
+  }
+  if (arg[0] == '\'' || arg[0] == '"')
+  {
+    return (unsigned char)arg[1];
+  }
+
+  char *end;
+  errno = 0;
+  long double value = strtold(arg, &end);
+  check_number(arg, end, status);
+  return value;
+}
+
+/**
+ * Writes the format once, taking arguments for its conversions from
+ * args starting at *next. Missing arguments count as empty strings or
+ * zero.
+ *
+ * @param format The format string
+ * @param args The arguments after the format
+ * @param count The number of arguments
+ * @param next The index of the next argument, advanced as they are used
+ * @param status Set to 1 if an argument or conversion was invalid
+ * @return 1 if output was stopped by \c or an invalid conversion,
+ *         otherwise 0
+ */
+static int
+printf_once(const char *format, char **args, int count, int *next,
+            int *status)
+{
+  const char *p = format;
+  while (*p != '\0')
+  {
+    if (*p == '\\')
+    {
+      ++p;
+      if (put_escape(&p))
+      {
+        return 1;
+      }
+      continue;
+    }
+    if (*p != '%')
+    {
+      putchar(*p++);
+      continue;
+    }
+    if (p[1] == '%')
+    {
+      putchar('%');
+      p += 2;
+      continue;
+    }
+
+    // Copy the flags, width and precision into a conversion for
+    // printf(), taking '*' values from the arguments
+    char spec[48] = "%";
+    size_t len = 1;
+    int fieldWidth = -1;
+    int precision = -1;
+    ++p;
+    while (*p != '\0' && strchr("-+ #0", *p) != NULL && len < 8)
+    {
+      spec[len++] = *p++;
+    }
+    if (*p == '*')
+    {
+      const char *arg = *next < count ? args[(*next)++] : NULL;
+      fieldWidth = (int)printf_integer(arg, status);
+      ++p;
+    }
+    else
+    {
+      fieldWidth = (int)strtol(p, (char **)&p, 10);
+    }
+    if (*p == '.')
+    {
+      ++p;
+      if (*p == '*')
+      {
+        const char *arg = *next < count ? args[(*next)++] : NULL;
+        precision = (int)printf_integer(arg, status);
+        ++p;
+      }
+      else
+      {
+        precision = (int)strtol(p, (char **)&p, 10);
+      }
+    }
+    len += sprintf(spec + len, "*.*");
+
+    char conversion = *p++;
+    const char *arg = *next < count ? args[(*next)++] : NULL;
+    switch (conversion)
+    {
+      case 'd':
+      case 'i':
+        strcpy(spec + len, "lld");
+        printf(spec, fieldWidth, precision,
+               printf_integer(arg, status));
+        break;
+      case 'o':
+      case 'u':
+      case 'x':
+      case 'X':
+        sprintf(spec + len, "ll%c", conversion);
+        printf(spec, fieldWidth, precision,
+               (unsigned long long)printf_integer(arg, status));
+        break;
+      case 'f':
+      case 'F':
+      case 'e':
+      case 'E':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        sprintf(spec + len, "L%c", conversion);
+        printf(spec, fieldWidth, precision,
+               printf_float(arg, status));
+        break;
+      case 'c':
+        strcpy(spec + len - 2, "c"); // "%*c": a precision does not apply
+        printf(spec, fieldWidth, arg ? arg[0] : '\0');
+        break;
+      case 's':
+        strcpy(spec + len, "s");
+        printf(spec, fieldWidth, precision, arg ? arg : "");
+        break;
+      case 'b':
+        if (put_escaped(arg ? arg : ""))
+        {
+          return 1;
+        }
+        break;
+      default:
+        fprintf(stderr, "printf: %%%c: invalid conversion\n", conversion);
+        fflush(stderr);
+        *status = 1;
+        return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Writes its arguments under the control of a format, as printf(3)
+ * does. The format is reused while arguments remain, and %b writes an
+ * argument with its backslash escapes interpreted.
+ *
+ * @param input The full user command
+ * @param shell The pointer to the Shell state
+ * @return 0 for success, or 1 if an argument or conversion was invalid
+ */
+int
+builtin_printf(struct Input *input, struct Shell *shell)
+{
+  if (input->numArgs < 2)
+  {
+    fprintf(stderr, "Invalid number of arguments\n"
+            "Usage: printf FORMAT [ARG]...\n");
+    fflush(stderr);
+    return 1;
+  }
+
+  char **args = input->args + 2;
+  int count = input->numArgs - 2;
+  int next = 0;
+  int status = 0;
+  for (;;)
+  {
+    int start = next;
+    if (printf_once(input->args[1], args, count, &next, &status) ||
+        next >= count || next == start)
+    {
+      break;
+    }
+  }
+  return status;
+}
@@ -0,0 +1,16 @@
+/* Header file for the standard utilities run inside the shell */
+
+#ifndef UTILITY_COMMANDS_H
+#define UTILITY_COMMANDS_H
+
+#include "input_parsing.h"
+#include "shell_commands.h"
+
+int builtin_true(struct Input *input, struct Shell *shell);
+int builtin_false(struct Input *input, struct Shell *shell);
+int builtin_echo(struct Input *input, struct Shell *shell);
+int builtin_pwd(struct Input *input, struct Shell *shell);
+int builtin_test(struct Input *input, struct Shell *shell);
+int builtin_printf(struct Input *input, struct Shell *shell);
+
+#endif
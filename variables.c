@@ -0,0 +1,479 @@
+/**
+ * Definitions for the store of shell variables.
+ *
+ * Variables live in a table using open addressing with linear probing,
+ * keyed by name. Their values are interned: each distinct string is
+ * kept once, with a count of the variables holding it, so copying one
+ * variable to another or setting the same value again allocates
+ * nothing. Lookups take the name as a pointer and length, so expansion
+ * can look names up in place inside a word.
+ *
+ * The special parameters are formatted when they change rather than
+ * when they are used: $$ once at startup, $? after each command, $!
+ * when a background job starts, and $# and $* when a function call
+ * sets the positional parameters, which are kept on a stack of calls.
+ * Names not set in the shell fall back to the environment, and setting
+ * one that is in the environment updates it there too so children see
+ * the new value.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "utilities.h"
+#include "variables.h"
+
+#define MAX_ENV_NAME 256 // longest name looked up in the environment
+
+struct Value // an interned string
+{
+  struct Value *next; // next value in the same bucket
+  unsigned long hash;
+  size_t refs;        // variables holding the value
+  size_t len;
+  char text[];
+};
+
+struct VarEntry
+{
+  char *name;         // NULL for an empty slot
+  size_t len;
+  unsigned long hash;
+  struct Value *value;
+};
+
+static struct VarEntry *table = NULL;
+static size_t capacity = 0; // always a power of two
+static size_t count = 0;
+
+static struct Value **values = NULL; // buckets of interned values
+static size_t numBuckets = 0;        // always a power of two
+static size_t numValues = 0;
+
+static char *pidStr = NULL;   // $$
+static char statusStr[16] = "0"; // $?
+static int lastStatus = 0;
+static char bgStr[16] = "";   // $!, empty until a job is started
+
+struct Params // the positional parameters of a function call
+{
+  struct Params *prev; // those of the caller
+  char **args;         // $1 onward, ending with NULL
+  int count;
+  char *joined;        // $* and $@, the parameters separated by spaces
+  char countStr[16];   // $#
+};
+
+static char *noArgs[] = {NULL};
+static struct Params topParams = {NULL, noArgs, 0, "", "0"};
+static struct Params *params = &topParams;
+
+/**
+ * Computes the FNV-1a hash of the given bytes.
+ *
+ * @param s The bytes to hash
+ * @param len The number of bytes
+ * @return The hash value
+ */
+static unsigned long
+hash_bytes(const char *s, size_t len)
+{
+  unsigned long h = 2166136261UL;
+  for (size_t i = 0; i < len; ++i)
+  {
+    h = (h ^ (unsigned char)s[i]) * 16777619UL;
+  }
+  return h;
+}
+
+/**
+ * Returns the interned copy of the given string, adding it if it is not
+ * interned yet, and counts one more holder of it.
+ *
+ * @param text The string
+ * @param len The length of the string
+ * @return The pointer to the interned Value
+ */
+static struct Value *
+intern(const char *text, size_t len)
+{
+  unsigned long hash = hash_bytes(text, len);
+  if (numBuckets != 0)
+  {
+    for (struct Value *v = values[hash & (numBuckets - 1)]; v != NULL;
+         v = v->next)
+    {
+      if (v->hash == hash && v->len == len && !memcmp(v->text, text, len))
+      {
+        ++v->refs;
+        return v;
+      }
+    }
+  }
+
+  // Keep at most one value per bucket on average
+  if (numValues == numBuckets)
+  {
+    size_t newBuckets = numBuckets ? numBuckets * 2 : 64;
+    struct Value **grown = calloc(newBuckets, sizeof(struct Value *));
+    for (size_t i = 0; i < numBuckets; ++i)
+    {
+      struct Value *next;
+      for (struct Value *v = values[i]; v != NULL; v = next)
+      {
+        next = v->next;
+        v->next = grown[v->hash & (newBuckets - 1)];
+        grown[v->hash & (newBuckets - 1)] = v;
+      }
+    }
+    free(values);
+    values = grown;
+    numBuckets = newBuckets;
+  }
+
+  struct Value *v = malloc(sizeof(struct Value) + len + 1);
+  v->hash = hash;
+  v->refs = 1;
+  v->len = len;
+  memcpy(v->text, text, len);
+  v->text[len] = '\0';
+  v->next = values[hash & (numBuckets - 1)];
+  values[hash & (numBuckets - 1)] = v;
+  ++numValues;
+  return v;
+}
+
+/**
+ * Counts one less holder of an interned value, freeing it when none are
+ * left.
+ *
+ * @param v The pointer to the Value
+ */
+static void
+release(struct Value *v)
+{
+  if (--v->refs > 0)
+  {
+    return;
+  }
+  struct Value **link = &values[v->hash & (numBuckets - 1)];
+  while (*link != v)
+  {
+    link = &(*link)->next;
+  }
+  *link = v->next;
+  --numValues;
+  free(v);
+}
+
+/**
+ * Finds the slot holding the given name, or the empty slot where it
+ * would be inserted.
+ *
+ * @param name The name, not necessarily '\0'-terminated
+ * @param len The length of the name
+ * @param hash The hash of the name
+ * @return The index of the slot
+ */
+static size_t
+find_slot(const char *name, size_t len, unsigned long hash)
+{
+  size_t i = hash & (capacity - 1);
+  while (table[i].name != NULL &&
+         (table[i].hash != hash || table[i].len != len ||
+          memcmp(table[i].name, name, len)))
+  {
+    i = (i + 1) & (capacity - 1);
+  }
+  return i;
+}
+
+/**
+ * Doubles the capacity of the table and reinserts every entry.
+ */
+static void
+grow_table(void)
+{
+  struct VarEntry *old = table;
+  size_t oldCapacity = capacity;
+  capacity = capacity ? capacity * 2 : 64;
+  table = calloc(capacity, sizeof(struct VarEntry));
+  for (size_t i = 0; i < oldCapacity; ++i)
+  {
+    if (old[i].name != NULL)
+    {
+      table[find_slot(old[i].name, old[i].len, old[i].hash)] = old[i];
+    }
+  }
+  free(old);
+}
+
+/**
+ * Computes the special parameters that never change.
+ */
+void
+init_vars(void)
+{
+  pidStr = get_pidstr();
+}
+
+/**
+ * Measures the variable name at the start of the given bytes: a letter
+ * or underscore followed by letters, digits and underscores.
+ *
+ * @param s The bytes to check
+ * @param len The number of bytes available
+ * @return The length of the name, or 0 if there is none
+ */
+size_t
+var_name_len(const char *s, size_t len)
+{
+  size_t i = 0;
+  while (i < len && (s[i] == '_' ||
+                     (s[i] >= 'a' && s[i] <= 'z') ||
+                     (s[i] >= 'A' && s[i] <= 'Z') ||
+                     (i > 0 && s[i] >= '0' && s[i] <= '9')))
+  {
+    ++i;
+  }
+  return i;
+}
+
+/**
+ * Looks up a positional parameter, $1 onward.
+ *
+ * @param name The digits of its number
+ * @param len The number of digits
+ * @return The value, or NULL if there is no such parameter
+ */
+static const char *
+get_param(const char *name, size_t len)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < len; ++i)
+  {
+    n = n * 10 + (name[i] - '0');
+    if (n > (size_t)params->count)
+    {
+      return NULL;
+    }
+  }
+  return n > 0 ? params->args[n - 1] : NULL;
+}
+
+/**
+ * Looks up the value of a variable or of one of the special parameters
+ * $, ?, !, #, * and @ and the positional ones, falling back to the
+ * environment.
+ *
+ * @param name The name, not necessarily '\0'-terminated
+ * @param len The length of the name
+ * @param valueLen Set to the length of the value
+ * @return The value, valid until the variable is set again, or NULL if
+ *         the variable is not set
+ */
+const char *
+get_var(const char *name, size_t len, size_t *valueLen)
+{
+  const char *value = NULL;
+  if (len == 1 && name[0] == '$')
+  {
+    value = pidStr;
+  }
+  else if (len == 1 && name[0] == '?')
+  {
+    value = statusStr;
+  }
+  else if (len == 1 && name[0] == '!')
+  {
+    value = bgStr;
+  }
+  else if (len == 1 && name[0] == '#')
+  {
+    value = params->countStr;
+  }
+  else if (len == 1 && (name[0] == '*' || name[0] == '@'))
+  {
+    value = params->joined;
+  }
+  else if (len > 0 && name[0] >= '0' && name[0] <= '9')
+  { // positional parameters are never looked up in the environment
+    value = get_param(name, len);
+    *valueLen = value != NULL ? strlen(value) : 0;
+    return value;
+  }
+  else if (count != 0)
+  {
+    struct VarEntry *entry = &table[find_slot(name, len,
+                                              hash_bytes(name, len))];
+    if (entry->name != NULL)
+    {
+      *valueLen = entry->value->len;
+      return entry->value->text;
+    }
+  }
+  if (value == NULL && len < MAX_ENV_NAME)
+  {
+    char key[MAX_ENV_NAME];
+    memcpy(key, name, len);
+    key[len] = '\0';
+    value = getenv(key);
+  }
+  if (value != NULL)
+  {
+    *valueLen = strlen(value);
+  }
+  return value;
+}
+
+/**
+ * Sets a shell variable, updating the environment as well when the
+ * variable is there.
+ *
+ * @param name The name, not necessarily '\0'-terminated
+ * @param len The length of the name
+ * @param value The new value
+ */
+void
+set_var(const char *name, size_t len, const char *value)
+{
+  if (count + 1 > capacity / 2)
+  {
+    grow_table();
+  }
+  unsigned long hash = hash_bytes(name, len);
+  struct VarEntry *entry = &table[find_slot(name, len, hash)];
+  struct Value *v = intern(value, strlen(value));
+  if (entry->name == NULL)
+  {
+    entry->name = malloc(len + 1);
+    memcpy(entry->name, name, len);
+    entry->name[len] = '\0';
+    entry->len = len;
+    entry->hash = hash;
+    ++count;
+  }
+  else
+  {
+    release(entry->value);
+  }
+  entry->value = v;
+
+  if (getenv(entry->name) != NULL)
+  {
+    setenv(entry->name, value, 1);
+  }
+}
+
+/**
+ * Records the status of the last command for $?, as other shells
+ * report it: a terminating signal is 128 plus its number.
+ *
+ * @param status The exit value, or the negated terminating signal
+ */
+void
+set_last_status(int status)
+{
+  status = status < 0 ? 128 - status : status;
+  if (status != lastStatus)
+  {
+    lastStatus = status;
+    sprintf(statusStr, "%d", status);
+  }
+}
+
+/**
+ * Records the PID of the last background job started for $!.
+ *
+ * @param pid The PID of the job's last process
+ */
+void
+set_last_bg(pid_t pid)
+{
+  sprintf(bgStr, "%d", (int)pid);
+}
+
+/**
+ * Sets the positional parameters for a function call, keeping those of
+ * the caller until pop_params().
+ *
+ * @param args The parameters, which have to outlive the call
+ * @param num The number of parameters
+ */
+void
+push_params(char **args, int num)
+{
+  struct Params *call = malloc(sizeof(struct Params));
+  call->prev = params;
+  call->args = args;
+  call->count = num;
+  size_t size = 1;
+  for (int i = 0; i < num; ++i)
+  {
+    size += strlen(args[i]) + 1;
+  }
+  call->joined = malloc(size);
+  char *end = call->joined;
+  *end = '\0';
+  for (int i = 0; i < num; ++i)
+  {
+    if (i > 0)
+    {
+      *end++ = ' ';
+    }
+    end = stpcpy(end, args[i]);
+  }
+  sprintf(call->countStr, "%d", num);
+  params = call;
+}
+
+/**
+ * Puts back the positional parameters of the caller when a function
+ * call returns.
+ */
+void
+pop_params(void)
+{
+  struct Params *call = params;
+  params = call->prev;
+  free(call->joined);
+  free(call);
+}
+
+/**
+ * Returns the positional parameters, as "$@" expands to them.
+ *
+ * @return The parameters, ending with NULL
+ */
+char **
+get_params(void)
+{
+  return params->args;
+}
+
+/**
+ * Frees every variable and value.
+ */
+void
+cleanup_vars(void)
+{
+  for (size_t i = 0; i < capacity; ++i)
+  {
+    if (table[i].name != NULL)
+    {
+      free(table[i].name);
+      release(table[i].value);
+    }
+  }
+  free(table);
+  free(values);
+  free(pidStr);
+  table = NULL;
+  values = NULL;
+  pidStr = NULL;
+  capacity = count = numBuckets = numValues = 0;
+}
@@ -0,0 +1,20 @@
+/* Header file for the store of shell variables */
+
+#ifndef VARIABLES_H
+#define VARIABLES_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+void init_vars(void);
+size_t var_name_len(const char *s, size_t len);
+const char * get_var(const char *name, size_t len, size_t *valueLen);
+void set_var(const char *name, size_t len, const char *value);
+void set_last_status(int status);
+void set_last_bg(pid_t pid);
+void push_params(char **args, int num);
+void pop_params(void);
+char ** get_params(void);
+void cleanup_vars(void);
+
+#endif